@@ -0,0 +1,129 @@
+:- module(assoc, [
+	empty_assoc/1, get_assoc/3, put_assoc/4, del_assoc/4,
+	list_to_assoc/2, ord_list_to_assoc/2, assoc_to_list/2,
+	assoc_to_keys/2, assoc_to_values/2, gen_assoc/3, assoc_range/4,
+	max_assoc/3, min_assoc/3, del_max_assoc/4, del_min_assoc/4,
+	map_assoc/2, map_assoc/3
+	]).
+
+% AVL trees: t is the empty tree and t(K,V,Balance,L,R) a node, with
+% Balance the order of the heights of L and R. Lookups and updates
+% are done natively, sharing the untouched parts with the old tree.
+
+empty_assoc(t).
+
+get_assoc(Key, A, Val) :- '$get_assoc'(Key, A, Val).
+
+put_assoc(Key, A0, Val, A) :- '$put_assoc'(Key, A0, Val, A).
+
+del_assoc(Key, A0, Val, A) :- '$del_assoc'(Key, A0, Val, A).
+
+del_min_assoc(A0, Key, Val, A) :- '$del_min_assoc'(A0, Key, Val, A).
+
+del_max_assoc(A0, Key, Val, A) :- '$del_max_assoc'(A0, Key, Val, A).
+
+min_assoc(t(K,V,_,L,_), Key, Val) :- min_assoc_(L, K, V, Key, Val).
+
+min_assoc_(t, K, V, K, V).
+min_assoc_(t(K,V,_,L,_), _, _, Key, Val) :- min_assoc_(L, K, V, Key, Val).
+
+max_assoc(t(K,V,_,_,R), Key, Val) :- max_assoc_(R, K, V, Key, Val).
+
+max_assoc_(t, K, V, K, V).
+max_assoc_(t(K,V,_,_,R), _, _, Key, Val) :- max_assoc_(R, K, V, Key, Val).
+
+% Lists are sorted on the key then built straight into a balanced
+% tree, the right side taking the odd element...
+
+list_to_assoc(List, A) :-
+	keysort(List, Pairs),
+	(	strictly_ordered_(Pairs) -> true
+	;	throw(error(domain_error(unique_key_pairs, List), list_to_assoc/2))
+	),
+	length(Pairs, N),
+	build_(N, Pairs, [], A, _).
+
+ord_list_to_assoc(Pairs, A) :-
+	(	strictly_ordered_(Pairs) -> true
+	;	throw(error(domain_error(unique_key_pairs, Pairs), ord_list_to_assoc/2))
+	),
+	length(Pairs, N),
+	build_(N, Pairs, [], A, _).
+
+strictly_ordered_([]).
+strictly_ordered_([K-_|Pairs]) :- strictly_ordered_(Pairs, K).
+
+strictly_ordered_([], _).
+strictly_ordered_([K-_|Pairs], K0) :-
+	K0 @< K,
+	strictly_ordered_(Pairs, K).
+
+build_(0, Pairs, Pairs, t, 0) :- !.
+build_(N, Pairs0, Pairs, t(K,V,B,L,R), H) :-
+	NL is (N - 1) // 2,
+	NR is N - 1 - NL,
+	build_(NL, Pairs0, [K-V|Pairs1], L, HL),
+	build_(NR, Pairs1, Pairs, R, HR),
+	compare(B, HL, HR),
+	H is HR + 1.
+
+assoc_to_list(A, List) :- assoc_to_list_(A, List, []).
+
+assoc_to_list_(t, List, List).
+assoc_to_list_(t(K,V,_,L,R), List0, List) :-
+	assoc_to_list_(L, List0, [K-V|List1]),
+	assoc_to_list_(R, List1, List).
+
+assoc_to_keys(A, Keys) :- assoc_to_keys_(A, Keys, []).
+
+assoc_to_keys_(t, Keys, Keys).
+assoc_to_keys_(t(K,_,_,L,R), Keys0, Keys) :-
+	assoc_to_keys_(L, Keys0, [K|Keys1]),
+	assoc_to_keys_(R, Keys1, Keys).
+
+assoc_to_values(A, Vals) :- assoc_to_values_(A, Vals, []).
+
+assoc_to_values_(t, Vals, Vals).
+assoc_to_values_(t(_,V,_,L,R), Vals0, Vals) :-
+	assoc_to_values_(L, Vals0, [V|Vals1]),
+	assoc_to_values_(R, Vals1, Vals).
+
+gen_assoc(Key, t(K,V,_,L,R), Val) :-
+	(	gen_assoc(Key, L, Val)
+	;	Key = K, Val = V
+	;	gen_assoc(Key, R, Val)
+	).
+
+% The pairs with Lo @=< Key @=< Hi in order, only visiting subtrees
+% that can hold such keys...
+
+assoc_range(A, Lo, Hi, Pairs) :- assoc_range_(A, Lo, Hi, Pairs, []).
+
+assoc_range_(t, _, _, Pairs, Pairs).
+assoc_range_(t(K,V,_,L,R), Lo, Hi, Pairs0, Pairs) :-
+	compare(O1, Lo, K),
+	compare(O2, K, Hi),
+	(	O1 = (<) -> assoc_range_(L, Lo, Hi, Pairs0, Pairs1)
+	;	Pairs1 = Pairs0
+	),
+	(	O1 \== (>), O2 \== (>) -> Pairs1 = [K-V|Pairs2]
+	;	Pairs2 = Pairs1
+	),
+	(	O2 = (<) -> assoc_range_(R, Lo, Hi, Pairs2, Pairs)
+	;	Pairs = Pairs2
+	).
+
+:- meta_predicate(map_assoc(1, ?)).
+:- meta_predicate(map_assoc(2, ?, ?)).
+
+map_assoc(_, t).
+map_assoc(Goal, t(_,V,_,L,R)) :-
+	map_assoc(Goal, L),
+	call(Goal, V),
+	map_assoc(Goal, R).
+
+map_assoc(_, t, t).
+map_assoc(Goal, t(K,V,B,L0,R0), t(K,W,B,L,R)) :-
+	map_assoc(Goal, L0, L),
+	call(Goal, V, W),
+	map_assoc(Goal, R0, R).
@@ -0,0 +1,26 @@
+:- module(hashtable, [
+	ht_new/1, ht_free/1, ht_put/3, nb_ht_put/3, ht_get/3,
+	ht_del/2, nb_ht_del/2, ht_size/2, ht_pairs/2
+	]).
+
+% Hash tables are held natively and referenced by a handle, so they
+% last until ht_free/1 is called. Keys must be ground. ht_put/3 and
+% ht_del/2 are undone on backtracking, the nb_ versions are not.
+
+ht_new(H) :- '$ht_new'(H).
+
+ht_free(H) :- '$ht_free'(H).
+
+ht_put(H, Key, Val) :- '$ht_put'(H, Key, Val).
+
+nb_ht_put(H, Key, Val) :- '$nb_ht_put'(H, Key, Val).
+
+ht_get(H, Key, Val) :- '$ht_get'(H, Key, Val).
+
+ht_del(H, Key) :- '$ht_del'(H, Key).
+
+nb_ht_del(H, Key) :- '$nb_ht_del'(H, Key).
+
+ht_size(H, N) :- '$ht_size'(H, N).
+
+ht_pairs(H, Pairs) :- '$ht_pairs'(H, Pairs).
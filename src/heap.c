@@ -80,9 +80,10 @@ cell *alloc_on_heap(query *q, idx_t nbr_cells)
 		a->h_size = q->h_size;
 		a->nbr = q->st.anbr++;
 		q->arenas = a;
+		q->gc_cells += a->h_size;
 	}
 
-	if ((q->st.hp + nbr_cells) >= q->h_size) {
+	if ((q->st.hp + nbr_cells) >= q->arenas->h_size) {
 		arena *a = calloc(1, sizeof(arena));
 		ensure(a);
 		a->next = q->arenas;
@@ -98,6 +99,10 @@ cell *alloc_on_heap(query *q, idx_t nbr_cells)
 		a->nbr = q->st.anbr++;
 		q->arenas = a;
 		q->st.hp = 0;
+		q->gc_cells += a->h_size;
+
+		if (q->gc_cells >= q->gc_threshold)
+			q->gc_pending = true;
 	}
 
 	cell *c = q->arenas->heap + q->st.hp;
@@ -200,6 +205,31 @@ cell *deep_copy_to_tmp(query *q, cell *p1, idx_t p1_ctx, bool nonlocals_only, bo
 	return q->tmp_heap;
 }
 
+// As above but the variables are numbered from zero in order of
+// appearance and no frame variables are created, so the copy can be
+// stored away and given fresh variables when it is read back...
+
+cell *deep_raw_copy_to_tmp(query *q, cell *p1, idx_t p1_ctx)
+{
+	FAULTINJECT(errno = ENOMEM; return NULL);
+	if (!init_tmp_heap(q))
+		return NULL;
+
+	q->m->pl->varno = 0;
+	q->m->pl->tab_idx = 0;
+	q->cycle_error = false;
+	cell *rec = deep_copy2_to_tmp(q, p1, p1_ctx, 0, false, false);
+	if (!rec || (rec == ERR_CYCLE_CELL)) return rec;
+	cell *c = q->tmp_heap;
+
+	for (idx_t i = 0; i < c->nbr_cells; i++) {
+		if (is_variable(c+i))
+			c[i].attrs = NULL;
+	}
+
+	return c;
+}
+
 cell *deep_copy_to_heap(query *q, cell *p1, idx_t p1_ctx, bool nonlocals_only, bool copy_attrs)
 {
 	cell *tmp = deep_copy_to_tmp(q, p1, p1_ctx, nonlocals_only, copy_attrs);
@@ -267,19 +297,346 @@ cell *deep_clone_to_heap(query *q, cell *p1, idx_t p1_ctx)
 cell *alloc_on_queuen(query *q, int qnbr, const cell *c)
 {
 	FAULTINJECT(errno = ENOMEM; return NULL);
-	if (!q->queue[qnbr]) {
-		q->queue[qnbr] = calloc(q->q_size[qnbr], sizeof(cell));
-		ensure(q->queue[qnbr]);
+	collector *qu = q->queues + qnbr;
+
+	if (!qu->queue) {
+		if (!qu->size)
+			qu->size = q->q_size;
+
+		qu->queue = calloc(qu->size, sizeof(cell));
+		ensure(qu->queue);
 	}
 
-	while ((q->qp[qnbr]+c->nbr_cells) >= q->q_size[qnbr]) {
-		q->q_size[qnbr] += q->q_size[qnbr] / 2;
-		q->queue[qnbr] = realloc(q->queue[qnbr], sizeof(cell)*q->q_size[qnbr]);
-		ensure(q->queue[qnbr]);
+	while ((qu->qp+c->nbr_cells) >= qu->size) {
+		qu->size += qu->size / 2;
+		qu->queue = realloc(qu->queue, sizeof(cell)*qu->size);
+		ensure(qu->queue);
 	}
 
-	cell *dst = q->queue[qnbr] + q->qp[qnbr];
-	q->qp[qnbr] += safe_copy_cells(dst, c, c->nbr_cells);
+	cell *dst = qu->queue + qu->qp;
+	qu->qp += safe_copy_cells(dst, c, c->nbr_cells);
 	return dst;
 }
 
+
+// Heap garbage collection. Only arenas allocated since the youngest
+// choice point are collected, anything older is reclaimed anyway on
+// backtracking by trim_heap(). Live cells are traced from the slots,
+// frames, choices and queues, then copied in order to a fresh arena
+// and the references to them updated...
+
+enum { GC_LIVE=1<<0, GC_WALKED=1<<1 };
+
+typedef struct {
+	arena *a;
+	uint8_t *marks;
+	idx_t *fwd;
+} gc_arena;
+
+typedef struct {
+	cell *c;
+	bool is_cont;
+} gc_item;
+
+typedef struct {
+	gc_arena *arenas;
+	gc_item *stack;
+	size_t nbr_arenas, sp, size;
+} gc_state;
+
+static int gc_arena_cmp(const void *p1, const void *p2)
+{
+	const gc_arena *ga1 = (const gc_arena*)p1;
+	const gc_arena *ga2 = (const gc_arena*)p2;
+	if (ga1->a->heap < ga2->a->heap) return -1;
+	if (ga1->a->heap > ga2->a->heap) return 1;
+	return 0;
+}
+
+static gc_arena *gc_find(const gc_state *gc, const cell *c, idx_t *off)
+{
+	size_t lo = 0, hi = gc->nbr_arenas;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		gc_arena *ga = gc->arenas + mid;
+
+		if (c < ga->a->heap)
+			hi = mid;
+		else if (c >= (ga->a->heap + ga->a->hp))
+			lo = mid + 1;
+		else {
+			*off = c - ga->a->heap;
+			return ga;
+		}
+	}
+
+	return NULL;
+}
+
+static void gc_push(gc_state *gc, cell *c, bool is_cont)
+{
+	if (!c)
+		return;
+
+	if (gc->sp == gc->size) {
+		gc->size = gc->size ? gc->size * 2 : 1024;
+		gc->stack = realloc(gc->stack, sizeof(gc_item)*gc->size);
+		ensure(gc->stack);
+	}
+
+	gc->stack[gc->sp].c = c;
+	gc->stack[gc->sp].is_cont = is_cont;
+	gc->sp++;
+}
+
+static void gc_mark_cells(gc_state *gc, gc_arena *ga, idx_t off, idx_t nbr_cells)
+{
+	idx_t end = off + nbr_cells;
+
+	if (end > ga->a->hp)
+		end = ga->a->hp;
+
+	for (idx_t i = off; i < end; i++) {
+		if (ga->marks[i] & GC_LIVE)
+			continue;
+
+		ga->marks[i] |= GC_LIVE;
+		cell *c = ga->a->heap + i;
+
+		if (is_end(c))
+			gc_push(gc, c->val_ptr, true);
+		else if (is_variable(c) || is_empty(c))
+			gc_push(gc, c->attrs, false);
+	}
+}
+
+// A continuation runs goal by goal to an END cell, which then
+// links on to the next...
+
+static void gc_mark(gc_state *gc, cell *c, bool is_cont)
+{
+	gc_arena *ga;
+	idx_t off;
+
+	if (!is_cont) {
+		if ((ga = gc_find(gc, c, &off)) != NULL)
+			gc_mark_cells(gc, ga, off, c->nbr_cells);
+
+		return;
+	}
+
+	while (c && ((ga = gc_find(gc, c, &off)) != NULL)) {
+		if (ga->marks[off] & GC_WALKED)
+			break;
+
+		ga->marks[off] |= GC_WALKED;
+
+		if (is_end(c)) {
+			gc_mark_cells(gc, ga, off, 1);
+			c = c->val_ptr;
+		} else if (is_noop(c)) {
+			gc_mark_cells(gc, ga, off, 1);
+			c++;
+		} else {
+			gc_mark_cells(gc, ga, off, c->nbr_cells);
+			c += c->nbr_cells;
+		}
+	}
+}
+
+static cell *gc_forward(const gc_state *gc, cell *c, cell *heap)
+{
+	gc_arena *ga;
+	idx_t off;
+
+	if (!c || !(ga = gc_find(gc, c, &off)) || !(ga->marks[off] & GC_LIVE))
+		return c;
+
+	return heap + ga->fwd[off];
+}
+
+static void gc_push_cells(gc_state *gc, cell *c, idx_t nbr_cells)
+{
+	for (idx_t i = 0; i < nbr_cells; i++, c++) {
+		if (is_variable(c))
+			gc_push(gc, c->attrs, false);
+	}
+}
+
+static void gc_forward_cells(const gc_state *gc, cell *c, idx_t nbr_cells, cell *heap)
+{
+	for (idx_t i = 0; i < nbr_cells; i++, c++) {
+		if (is_end(c))
+			c->val_ptr = gc_forward(gc, c->val_ptr, heap);
+		else if (is_variable(c) || is_empty(c))
+			c->attrs = gc_forward(gc, c->attrs, heap);
+	}
+}
+
+void collect_heap(query *q)
+{
+	uint64_t started = get_time_in_usec();
+	q->gc_pending = false;
+	q->gc_cells = 0;
+	unsigned anbr = q->cp ? GET_CURR_CHOICE()->st.anbr : 0;
+	gc_state gc = {0};
+
+	for (arena *a = q->arenas; a && (a->nbr >= anbr); a = a->next)
+		gc.nbr_arenas++;
+
+	if (!gc.nbr_arenas) {
+		q->gc_threshold *= 2;
+		return;
+	}
+
+	// Newest first, as in the arena list...
+
+	gc.arenas = calloc(gc.nbr_arenas, sizeof(gc_arena));
+	ensure(gc.arenas);
+	arena *a = q->arenas;
+
+	for (size_t i = 0; i < gc.nbr_arenas; i++, a = a->next) {
+		gc_arena *ga = gc.arenas + i;
+		ga->a = a;
+		ga->marks = calloc(a->hp+1, sizeof(uint8_t));
+		ensure(ga->marks);
+		ga->fwd = calloc(a->hp+1, sizeof(idx_t));
+		ensure(ga->fwd);
+	}
+
+	arena *older = a;
+	gc_arena *order = malloc(sizeof(gc_arena)*gc.nbr_arenas);
+	ensure(order);
+	memcpy(order, gc.arenas, sizeof(gc_arena)*gc.nbr_arenas);
+	qsort(gc.arenas, gc.nbr_arenas, sizeof(gc_arena), gc_arena_cmp);
+
+	// Mark...
+
+	for (idx_t i = 0; i < q->st.sp; i++) {
+		slot *e = q->slots + i;
+
+		if (is_indirect(&e->c))
+			gc_push(&gc, e->c.val_ptr, false);
+		else if (is_variable(&e->c) || is_empty(&e->c))
+			gc_push(&gc, e->c.attrs, false);
+	}
+
+	for (idx_t i = 0; i < q->st.fp; i++)
+		gc_push(&gc, q->frames[i].prev_cell, true);
+
+	for (idx_t i = 0; i < q->cp; i++)
+		gc_push(&gc, q->choices[i].st.curr_cell, true);
+
+	for (idx_t i = 0; i < q->queues_size; i++) {
+		const collector *qu = q->queues + i;
+
+		if (qu->queue)
+			gc_push_cells(&gc, qu->queue, qu->qp);
+
+		if (qu->tmpq)
+			gc_push_cells(&gc, qu->tmpq, qu->tmpq_size);
+	}
+
+	gc_push(&gc, q->st.curr_cell, true);
+
+	while (gc.sp) {
+		gc_item *item = gc.stack + --gc.sp;
+		gc_mark(&gc, item->c, item->is_cont);
+	}
+
+	// Assign new locations, oldest arena first...
+
+	idx_t live = 0;
+
+	for (size_t i = gc.nbr_arenas; i--;) {
+		gc_arena *ga = order + i;
+
+		for (idx_t j = 0; j < ga->a->hp; j++) {
+			if (ga->marks[j] & GC_LIVE)
+				ga->fwd[j] = live++;
+		}
+	}
+
+	idx_t h_size = live > q->h_size ? live : q->h_size;
+	arena *new_a = calloc(1, sizeof(arena));
+	ensure(new_a);
+	new_a->heap = calloc(h_size, sizeof(cell));
+	ensure(new_a->heap);
+	new_a->h_size = h_size;
+	new_a->hp = live;
+	new_a->nbr = anbr;
+
+	// Move the live cells, releasing the rest...
+
+	for (size_t i = 0; i < gc.nbr_arenas; i++) {
+		gc_arena *ga = gc.arenas + i;
+
+		for (idx_t j = 0; j < ga->a->hp; j++) {
+			cell *c = ga->a->heap + j;
+
+			if (ga->marks[j] & GC_LIVE)
+				new_a->heap[ga->fwd[j]] = *c;
+			else {
+				DECR_REF(c);
+			}
+		}
+	}
+
+	// Update references...
+
+	gc_forward_cells(&gc, new_a->heap, live, new_a->heap);
+
+	for (idx_t i = 0; i < q->st.sp; i++) {
+		slot *e = q->slots + i;
+
+		if (is_indirect(&e->c))
+			e->c.val_ptr = gc_forward(&gc, e->c.val_ptr, new_a->heap);
+		else if (is_variable(&e->c) || is_empty(&e->c))
+			e->c.attrs = gc_forward(&gc, e->c.attrs, new_a->heap);
+	}
+
+	for (idx_t i = 0; i < q->st.fp; i++) {
+		frame *g = q->frames + i;
+		g->prev_cell = gc_forward(&gc, g->prev_cell, new_a->heap);
+	}
+
+	for (idx_t i = 0; i < q->cp; i++) {
+		choice *ch = q->choices + i;
+		ch->st.curr_cell = gc_forward(&gc, ch->st.curr_cell, new_a->heap);
+	}
+
+	for (idx_t i = 0; i < q->queues_size; i++) {
+		collector *qu = q->queues + i;
+
+		if (qu->queue)
+			gc_forward_cells(&gc, qu->queue, qu->qp, new_a->heap);
+
+		if (qu->tmpq)
+			gc_forward_cells(&gc, qu->tmpq, qu->tmpq_size, new_a->heap);
+	}
+
+	q->st.curr_cell = gc_forward(&gc, q->st.curr_cell, new_a->heap);
+
+	// Swap in the new arena...
+
+	for (size_t i = 0; i < gc.nbr_arenas; i++) {
+		gc_arena *ga = gc.arenas + i;
+		free(ga->a->heap);
+		free(ga->a);
+		free(ga->marks);
+		free(ga->fwd);
+	}
+
+	new_a->next = older;
+	q->arenas = new_a;
+	q->st.anbr = anbr + 1;
+	q->st.hp = live;
+	free(order);
+	free(gc.arenas);
+	free(gc.stack);
+
+	q->gc_threshold = live * 2 > q->h_size * GC_MIN_ARENAS ? live * 2 : q->h_size * GC_MIN_ARENAS;
+	q->tot_gcs++;
+	q->gc_time += get_time_in_usec() - started;
+}
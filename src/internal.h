@@ -84,9 +84,11 @@ typedef enum {
 #define MAX_VAR_POOL_SIZE 1000
 #define MAX_ARITY UCHAR_MAX
 #define MAX_OPS 250
-#define MAX_QUEUES 16
 #define MAX_STREAMS 1024
 #define MAX_DEPTH 9000
+#define GC_MIN_ARENAS 64
+#define MAX_JIT_ARGS 4
+#define PRED_CACHE_SIZE 1024
 
 #define STREAM_BUFLEN 1024
 #define CHECK_OVERFLOW 1
@@ -129,6 +131,7 @@ typedef enum {
 #define is_fresh(c) ((c)->flags & FLAG2_FRESH)
 #define is_anon(c) ((c)->flags & FLAG2_ANON)
 #define is_builtin(c) ((c)->flags & FLAG_BUILTIN)
+#define is_noop(c) (is_builtin(c) && !(c)->fn)
 #define is_tail(c) ((c)->flags & FLAG_TAIL)
 #define is_tail_recursive(c) ((c)->flags & FLAG_TAIL_REC)
 #define is_key(c) ((c)->flags & FLAG_KEY)
@@ -165,6 +168,16 @@ typedef struct {
 		}														\
 	}
 
+// Each name in the atom pool is preceded by its hash and length, so
+// interning and LEN_STR don't have to rescan it. Entries are aligned
+// so the header can be read in place...
+
+typedef struct {
+	uint32_t hash, len;
+} pool_hdr;
+
+#define POOL_HDR(pl,off) ((const pool_hdr*)((pl)->pool + (off)) - 1)
+
 #define _GET_STR(pl,c) 											\
 	( !is_cstring(c) ? ((pl)->pool + (c)->val_off)				\
 	: is_strbuf(c) ? ((c)->val_strb->cstr + (c)->strb_off)		\
@@ -173,7 +186,7 @@ typedef struct {
 	)
 
 #define _LEN_STR(pl,c) 											\
-	( !is_cstring(c) ? strlen((pl)->pool + (c)->val_off)		\
+	( !is_cstring(c) ? POOL_HDR(pl, (c)->val_off)->len			\
 	: is_strbuf(c) ? (c)->strb_len								\
 	: is_static(c) ? (c)->str_len								\
 	: strlen((c)->val_chr)										\
@@ -278,6 +291,9 @@ typedef struct module_ module;
 typedef struct query_ query;
 typedef struct predicate_ predicate;
 typedef struct clause_ clause;
+typedef struct clause_ref_ clause_ref;
+typedef struct db_index_ db_index;
+typedef struct tbl_store_ tbl_store;
 typedef struct cell_ cell;
 typedef struct parser_ parser;
 
@@ -372,16 +388,53 @@ typedef struct {
 
 struct clause_ {
 	predicate *owner;
-	clause *prev, *next, *dirty;
+	clause *prev, *next, *dirty, *ref_next;
 	module *m;
+	uint64_t ugen_unlinked;
 	uuid u;
+	bool is_pinned;
 	term t;
 };
 
+// An argument index. Clauses with an atom, small integer or compound
+// (by name/arity) as the argument are hashed into a bucket by that
+// key, all the rest are kept on the 'vars' list. Each list is in
+// clause order and 'seq' allows merging the two on lookup. The
+// first-argument index also holds any built just-in-time on later
+// arguments...
+
+struct clause_ref_ {
+	clause_ref *next;
+	clause *r;
+	int64_t seq;
+};
+
+typedef struct {
+	int_t val_key;
+	clause_ref *head, *tail;
+	uint8_t val_type, arity;
+} db_bucket;
+
+typedef struct ref_chunk_ ref_chunk;
+
+struct db_index_ {
+	db_index *next;
+	db_index *jit[MAX_JIT_ARGS];
+	db_bucket *buckets;
+	clause_ref *vars, *vars_tail;
+	ref_chunk *chunks;
+	idx_t size, count;
+	int64_t lo_seq, hi_seq;
+	uint64_t ugen;
+	idx_t dead;
+	unsigned arg, scans[MAX_JIT_ARGS];
+};
+
 struct predicate_ {
 	predicate *next;
 	clause *head, *tail;
-	skiplist *index, *index_save;
+	db_index *index, *index_save;
+	cell *meta_spec;
 	cell key;
 	unsigned cnt;
 	bool is_prebuilt:1;
@@ -393,6 +446,7 @@ struct predicate_ {
 	bool is_discontiguous:1;
 	bool is_abolished:1;
 	bool is_noindex:1;
+	bool is_tabled:1;
 	bool check_directive:1;
 };
 
@@ -403,12 +457,52 @@ struct builtins {
 	const char *help;
 };
 
+// Builtins are resolved through an open-addressed hash keyed on the
+// interned name and arity, built once by load_builtins()...
+
+typedef struct {
+	const struct builtins *ptr;
+	idx_t val_off;
+	unsigned arity;
+} builtin_slot;
+
 struct op_table {
 	char *name;
 	unsigned specifier;
 	unsigned priority;
 };
 
+// Each module keeps an open-addressed hash from the interned op name
+// to its live op_table entries (ops before def_ops, as they are
+// searched), rebuilt by set_op(). A name has at most one infix and
+// one prefix-or-postfix definition...
+
+#define MAX_OP_VARIANTS 4
+
+typedef struct {
+	idx_t val_off;
+	const struct op_table *ops[MAX_OP_VARIANTS];
+} op_slot;
+
+typedef struct {
+	unsigned nbr_vars;
+	cell cells[];
+} gvar_value;
+
+typedef struct {
+	idx_t key;
+	gvar_value *val;
+} gvar_slot;
+
+enum undo_kind { UNDO_GVAR=0, UNDO_HT_SET=1, UNDO_HT_NEW=2 };
+
+typedef struct {
+	gvar_value *key, *val;
+	uint64_t ht;
+	idx_t atom, tp;
+	enum undo_kind kind;
+} undo_rec;
+
 typedef struct {
 	idx_t ctx;
 	uint16_t var_nbr;
@@ -422,9 +516,11 @@ typedef struct {
 typedef struct {
 	cell *prev_cell;
 	module *m;
+	clause *r;
 	uint64_t ugen;
 	idx_t prev_frame, ctx, overflow, cgen;
 	uint16_t nbr_vars, nbr_slots;
+	bool is_referenced:1;
 } frame;
 
 enum { eof_action_eof_code, eof_action_error, eof_action_reset };
@@ -451,9 +547,11 @@ typedef struct {
 typedef struct {
 	cell *curr_cell;
 	clause *curr_clause, *curr_clause2;
-	sliter *iter, *iter2;
-	idx_t curr_frame, fp, hp, tp, sp, cgen;
-	uint8_t anbr, qnbr;
+	clause_ref *ref, *ref2;
+	sliter *iter2;
+	idx_t curr_frame, fp, hp, tp, sp, cgen, anbr;
+	unsigned qnbr;
+	bool is_keyed:1;
 } state;
 
 typedef struct {
@@ -470,6 +568,7 @@ typedef struct {
 	bool register_term:1;
 	bool chk_is_det:1;
 	bool tail_rec:1;
+	bool is_iter:1;
 } choice;
 
 typedef struct arena_ arena;
@@ -481,6 +580,12 @@ struct arena_ {
 	unsigned nbr;
 };
 
+typedef struct {
+	cell *queue, *tmpq;
+	cell acc;
+	idx_t size, qp, tmpq_size, nbr_vars;
+} collector;
+
 enum q_retry { QUERY_OK=0, QUERY_RETRY=1, QUERY_EXCEPTION=2 };
 enum unknowns { UNK_FAIL=0, UNK_ERROR=1, UNK_WARNING=2, UNK_CHANGEABLE=3 };
 
@@ -494,6 +599,7 @@ typedef struct char_flags_ {
 	bool rational_syntax_natural:1;
 	bool prefer_rationals:1;
 	bool debug:1;
+	bool atom_gc:1;
 } char_flags;
 
 struct query_ {
@@ -505,12 +611,14 @@ struct query_ {
 	choice *choices;
 	trail *trails;
 	cell *tmp_heap, *last_arg, *exception, *variable_names;
-	cell *queue[MAX_QUEUES], *tmpq[MAX_QUEUES];
+	collector *queues;
+	undo_rec *undos;
 	arena *arenas;
 	clause *dirty_list;
 	cell accum;
 	state st;
-	uint64_t tot_goals, tot_retries, tot_matches, tot_tcos;
+	uint64_t tot_goals, tot_retries, tot_matches, tot_tcos, tot_gcs;
+	uint64_t gc_time;
 	uint64_t step, qid, time_started;
 	unsigned max_depth, tmo_msecs;
 	int nv_start;
@@ -518,7 +626,8 @@ struct query_ {
 	idx_t frames_size, slots_size, trails_size, choices_size;
 	idx_t max_choices, max_frames, max_slots, max_trails;
 	idx_t h_size, tmph_size, tot_heaps, tot_heapsize;
-	idx_t q_size[MAX_QUEUES], tmpq_size[MAX_QUEUES], qp[MAX_QUEUES];
+	idx_t gc_cells, gc_threshold, nbr_dirty;
+	idx_t q_size, queues_size, undos_size, nbr_undos;
 	uint8_t nv_mask[MAX_ARITY];
 	char_flags flag;
 	enum q_retry retry;
@@ -527,7 +636,6 @@ struct query_ {
 	bool do_dump_vars:1;
 	bool status:1;
 	bool resume:1;
-	bool no_tco:1;
 	bool error:1;
 	bool did_throw:1;
 	bool trace:1;
@@ -543,6 +651,8 @@ struct query_ {
 	bool cycle_error:1;
 	bool spawned:1;
 	bool run_init:1;
+	bool gc_pending:1;
+	bool purge_pending:1;
 };
 
 struct parser_ {
@@ -592,18 +702,32 @@ struct module_ {
 	FILE *fp;
 	skiplist *index;
 	clause *dirty_list;
+	clause **refs;
 	struct op_table def_ops[MAX_OPS+1];
 	struct op_table ops[MAX_OPS+1];
+	op_slot *op_index;
 	char_flags flag;
-	unsigned spare_ops, loaded_ops;
+	idx_t ref_size, ref_count;
+	unsigned spare_ops, op_index_size;
 	bool prebuilt:1;
 	bool use_persist:1;
 	bool make_public:1;
-	bool loaded_properties:1;
 	bool loading:1;
 	bool error:1;
 };
 
+// Predicate lookups are cached by (module, name, arity). An entry is
+// only valid while its 'gen' matches the prolog's 'pred_gen', which is
+// bumped whenever predicates or modules are created or abolished...
+
+typedef struct {
+	module *m;
+	predicate *h;
+	uint64_t gen;
+	idx_t val_off;
+	unsigned arity;
+} pred_cache_entry;
+
 struct prolog_ {
 	idx_t tab1[64000];
 	idx_t tab3[64000];
@@ -613,11 +737,17 @@ struct prolog_ {
 	module *modules;
 	module *m, *curr_m;
 	uint64_t s_last, s_cnt, seed;
-	skiplist *symtab, *funtab;
+	builtin_slot *funtab;
+	idx_t *symtab;
+	tbl_store *tables;
+	gvar_slot *gvars;
+	skiplist *hashtables;
 	char *pool;
-	uint64_t ugen;
-	idx_t pool_offset, pool_size, tab_idx;
-	unsigned varno;
+	uint64_t ugen, pred_gen, ht_seq;
+	pred_cache_entry pred_cache[PRED_CACHE_SIZE];
+	idx_t pool_offset, pool_size, symtab_size, symtab_count, funtab_size, tab_idx;
+	idx_t gvars_size, gvars_count;
+	unsigned varno, nbr_running;
 	uint8_t current_input, current_output, current_error;
 	int8_t halt_code, opt;
 	bool halt:1;
@@ -632,8 +762,8 @@ struct prolog_ {
 
 extern idx_t g_empty_s, g_pair_s, g_dot_s, g_cut_s, g_nil_s, g_true_s, g_fail_s;
 extern idx_t g_anon_s, g_clause_s, g_eof_s, g_lt_s, g_false_s;
-extern idx_t g_gt_s, g_eq_s, g_sys_elapsed_s, g_sys_queue_s, g_braces_s;
-extern idx_t g_stream_property_s, g_unify_s, g_on_s, g_off_s, g_sys_var_s;
+extern idx_t g_gt_s, g_eq_s, g_sys_elapsed_s, g_sys_queue_s, g_sys_aggregate_s, g_braces_s;
+extern idx_t g_unify_s, g_on_s, g_off_s, g_sys_var_s;
 extern idx_t g_call_s, g_braces_s, g_plus_s, g_minus_s;
 extern stream g_streams[MAX_STREAMS];
 extern unsigned g_cpu_count;
@@ -683,8 +813,13 @@ module *find_module(prolog *pl, const char *name);
 module *find_next_module(prolog *pl, module *m);
 clause *asserta_to_db(module *m, term *t, bool consulting);
 clause *assertz_to_db(module *m, term *t, bool consulting);
-clause *erase_from_db(module *m, uuid *ref);
 clause *find_in_db(module *m, uuid *ref);
+void set_uuid_in_db(module *m, clause *r, const uuid *u);
+void uuid_gen(prolog *pl, uuid *u);
+bool is_index_key(const cell *c);
+clause_ref *find_in_index(const db_index *idx, const cell *c);
+db_index *get_jit_index(predicate *h, unsigned arg);
+void drop_index(module *m, predicate *h);
 unsigned get_op(module *m, const char *name, unsigned *specifier, bool hint_prefix);
 unsigned get_op2(module *m, const char *name, unsigned specifier);
 bool set_op(module *m, const char *name, unsigned specifier, unsigned priority);
@@ -693,6 +828,7 @@ USE_RESULT pl_status make_barrier(query *q);
 USE_RESULT pl_status make_catcher(query *q, enum q_retry type);
 void cut_me(query *q, bool local_cut, bool soft_cut);
 void *get_builtin(prolog *pl, const char *name, unsigned arity, bool *found);
+void *get_builtin_term(prolog *pl, const cell *c, unsigned arity, bool *found);
 pl_status query_execute(query *q, term *t);
 bool check_rule(const cell *c);
 cell *get_head(cell *c);
@@ -701,9 +837,11 @@ cell *get_logical_body(cell *c);
 predicate *find_predicate(module *m, cell *c);
 predicate *find_matching_predicate(module *m, cell *c);
 predicate *find_matching_predicate_quiet(module *m, cell *c);
+void invalidate_pred_cache(prolog *pl);
 predicate *find_functor(module *m, const char *name, unsigned arity);
 USE_RESULT pl_status fn_call_0(query *q, cell *p1);
 void undo_me(query *q);
+USE_RESULT pl_status trail_undo(query *q);
 parser *create_parser(module *m);
 void destroy_parser(parser *p);
 unsigned parser_tokenize(parser *p, bool args, bool consing);
@@ -722,8 +860,10 @@ cell *clone_to_heap(query *q, bool prefix, cell *p1, idx_t suffix);
 cell *deep_copy_to_heap(query *q, cell *p1, idx_t p1_ctx, bool nonlocals_only, bool copy_attrs);
 cell *deep_copy_to_tmp(query *q, cell *p1, idx_t p1_ctx, bool nonlocals_only, bool copy_attrs);
 cell *deep_clone_to_tmp(query *q, cell *p1, idx_t p1_ctx);
+cell *deep_raw_copy_to_tmp(query *q, cell *p1, idx_t p1_ctx);
 
 cell *alloc_on_heap(query *q, idx_t nbr_cells);
+void collect_heap(query *q);
 cell *alloc_on_tmp(query *q, idx_t nbr_cells);
 cell *alloc_on_queuen(query *q, int qnbr, const cell *c);
 
@@ -734,9 +874,12 @@ inline static cell *get_tmp_heap(const query *q, idx_t i) { return q->tmp_heap +
 void make_end(cell *tmp);
 USE_RESULT pl_status match_rule(query *q, cell *p1, idx_t p1_ctx);
 USE_RESULT pl_status match_clause(query *q, cell *p1, idx_t p1_ctx, int retract);
+bool has_next_key(const query *q, const clause *r);
 idx_t index_from_pool(prolog *pl, const char *name);
+idx_t is_in_pool(const prolog *pl, const char *name);
 void do_reduce(cell *n);
 unsigned create_vars(query *q, unsigned nbr);
+USE_RESULT pl_status check_slot(query *q, unsigned cnt);
 unsigned count_bits(const uint8_t *mask, unsigned bit);
 void try_me(const query *q, unsigned vars);
 USE_RESULT pl_status throw_error(query *q, cell *c, const char *err_type, const char *expected);
@@ -754,14 +897,18 @@ void consultall(parser *p, cell *l);
 void fix_list(cell *c);
 module *module_load_text(module *m, const char *src, const char *filename);
 void make_indirect(cell *tmp, cell *c);
-void stash_me(query *q, term *t, bool last_match);
+void stash_me(query *q, clause *r, bool last_match);
 unsigned fake_numbervars(query *q, cell *c, idx_t c_ctx, unsigned start);
 char *relative_to(const char *basefile, const char *relfile);
 void parser_term_to_body(parser *p);
 cell *check_body_callable(parser *p, cell *c);
 void load_builtins(prolog *pl);
+void destroy_tables(prolog *pl);
+void destroy_globals(prolog *pl);
+void undo_trailed(query *q, idx_t tp);
+void free_undos(query *q);
 void add_to_dirty_list(query *q, clause *r);
-char *format_property(char **bufptr, size_t *lenptr, char *dst, const char *name, unsigned arity, const char *type);
+void purge_dirty_list(query *q);
 bool needs_quoting(module *m, const char *src, int srclen);
 size_t formatted(char *dst, size_t dstlen, const char *src, int srclen, bool dq);
 
@@ -19,6 +19,10 @@ extern uint8_t _binary_library_format_pl_start[];
 extern uint8_t _binary_library_format_pl_end[];
 extern uint8_t _binary_library_charsio_pl_start[];
 extern uint8_t _binary_library_charsio_pl_end[];
+extern uint8_t _binary_library_assoc_pl_start[];
+extern uint8_t _binary_library_assoc_pl_end[];
+extern uint8_t _binary_library_hashtable_pl_start[];
+extern uint8_t _binary_library_hashtable_pl_end[];
 #endif
 
 library g_libs[] = {
@@ -32,6 +36,8 @@ library g_libs[] = {
      {"dcgs", _binary_library_dcgs_pl_start, _binary_library_dcgs_pl_end},
      {"format", _binary_library_format_pl_start, _binary_library_format_pl_end},
      {"charsio", _binary_library_charsio_pl_start, _binary_library_charsio_pl_end},
+     {"assoc", _binary_library_assoc_pl_start, _binary_library_assoc_pl_end},
+     {"hashtable", _binary_library_hashtable_pl_start, _binary_library_hashtable_pl_end},
 #endif
      {0}
 };
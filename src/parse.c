@@ -15,10 +15,12 @@
 
 static const unsigned INITIAL_TOKEN_SIZE = 100;		// bytes
 static const unsigned INITIAL_POOL_SIZE = 64000;	// bytes
+static const unsigned INITIAL_SYMTAB_SIZE = 4096;	// atoms
 
 static const unsigned INITIAL_NBR_CELLS = 100;		// cells
 static const unsigned INITIAL_NBR_HEAP = 8000;		// cells
 static const unsigned INITIAL_NBR_QUEUE = 1000;		// cells
+static const unsigned INITIAL_NBR_QUEUES = 16;
 
 static const unsigned INITIAL_NBR_GOALS = 1000;
 static const unsigned INITIAL_NBR_SLOTS = 1000;
@@ -26,13 +28,17 @@ static const unsigned INITIAL_NBR_CHOICES = 1000;
 static const unsigned INITIAL_NBR_TRAILS = 1000;
 
 #define JUST_IN_TIME_COUNT 50
+#define INITIAL_INDEX_SIZE 64
+#define REF_CHUNK_SIZE 256
+#define JIT_SCAN_COUNT 3
+#define PURGE_DIRTY_COUNT 1000
 #define DUMP_ERRS 0
 
 stream g_streams[MAX_STREAMS] = {{0}};
 idx_t g_empty_s, g_pair_s, g_dot_s, g_cut_s, g_nil_s, g_true_s, g_fail_s;
 idx_t g_anon_s, g_clause_s, g_eof_s, g_lt_s, g_gt_s, g_eq_s, g_false_s;
-idx_t g_sys_elapsed_s, g_sys_queue_s, g_braces_s, g_call_s, g_braces_s;
-idx_t g_stream_property_s, g_unify_s, g_on_s, g_off_s, g_sys_var_s;
+idx_t g_sys_elapsed_s, g_sys_queue_s, g_sys_aggregate_s, g_braces_s, g_call_s, g_braces_s;
+idx_t g_unify_s, g_on_s, g_off_s, g_sys_var_s;
 idx_t g_plus_s, g_minus_s;
 unsigned g_cpu_count = 4;
 char *g_tpl_lib = NULL;
@@ -52,6 +58,7 @@ static const struct op_table g_ops[] =
 	{"->", OP_XFY, 1050},
 	{"*->", OP_XFY, 1050},
 	{",", OP_XFY, 1000},
+	{"table", OP_FX, 1150},
 
 	//{"op", OP_FX, 1150},
 	//{"public", OP_FX, 1150},
@@ -109,106 +116,240 @@ static const struct op_table g_ops[] =
 	{0,0,0}
 };
 
-static idx_t is_in_pool(__attribute__((unused)) prolog *pl, const char *name)
+// The symbol table is an open-addressed hash of pool offsets, with
+// the hash of each name kept in its pool header...
+
+static uint32_t pool_hash(const char *name, uint32_t *len)
 {
-	const void *val;
+	uint32_t h = 2166136261U;
+	const char *src = name;
 
-	if (sl_get(pl->symtab, name, &val))
-		return (idx_t)(unsigned long)val;
+	while (*src) {
+		h ^= (uint8_t)*src++;
+		h *= 16777619U;
+	}
+
+	*len = src - name;
+	return h;
+}
+
+static idx_t find_in_pool(const prolog *pl, const char *name, uint32_t hash, uint32_t len)
+{
+	idx_t mask = pl->symtab_size - 1;
+
+	for (idx_t i = hash & mask; pl->symtab[i]; i = (i + 1) & mask) {
+		idx_t offset = pl->symtab[i];
+		const pool_hdr *hdr = POOL_HDR(pl, offset);
+
+		if ((hdr->hash == hash) && (hdr->len == len)
+			&& !memcmp(pl->pool + offset, name, len))
+			return offset;
+	}
 
 	return ERR_IDX;
 }
 
-static idx_t add_to_pool(prolog *pl, const char *name)
+static bool grow_symtab(prolog *pl)
 {
-	if (!name) return ERR_IDX;
-	idx_t offset = pl->pool_offset;
-	size_t len = strlen(name);
+	FAULTINJECT(errno = ENOMEM; return false);
+	idx_t save_size = pl->symtab_size;
+	idx_t *save = pl->symtab;
+	idx_t size = save_size ? save_size * 2 : INITIAL_SYMTAB_SIZE;
+	idx_t *tab = calloc(size, sizeof(idx_t));
+	if (!tab) return false;
+	idx_t mask = size - 1;
+
+	for (idx_t j = 0; j < save_size; j++) {
+		if (!save[j])
+			continue;
 
-	while ((offset+len+1+1) >= pl->pool_size) {
+		idx_t i = POOL_HDR(pl, save[j])->hash & mask;
+
+		while (tab[i])
+			i = (i + 1) & mask;
+
+		tab[i] = save[j];
+	}
+
+	free(save);
+	pl->symtab = tab;
+	pl->symtab_size = size;
+	return true;
+}
+
+static idx_t add_to_pool(prolog *pl, const char *name, uint32_t hash, uint32_t len)
+{
+	if (((pl->symtab_count + 1) * 4) >= (pl->symtab_size * 3)) {
+		if (!grow_symtab(pl))
+			return ERR_IDX;
+	}
+
+	idx_t hdr_offset = pl->pool_offset;
+	idx_t offset = hdr_offset + sizeof(pool_hdr);
+	size_t nbytes = (sizeof(pool_hdr) + len + 1 + sizeof(pool_hdr) - 1) & ~(sizeof(pool_hdr) - 1);
+
+	while ((hdr_offset+nbytes+1) >= pl->pool_size) {
 		FAULTINJECT(errno = ENOMEM; return ERR_IDX);
-		size_t nbytes = pl->pool_size * 2;
-		char *tmp = realloc(pl->pool, nbytes);
+		size_t size = pl->pool_size * 2;
+		char *tmp = realloc(pl->pool, size);
 		if (!tmp) return ERR_IDX;
 		pl->pool = tmp;
-		memset(pl->pool + pl->pool_size, 0, nbytes - pl->pool_size);
-		pl->pool_size = nbytes;
+		memset(pl->pool + pl->pool_size, 0, size - pl->pool_size);
+		pl->pool_size = size;
 	}
 
+	pool_hdr *hdr = (pool_hdr*)(pl->pool + hdr_offset);
+	hdr->hash = hash;
+	hdr->len = len;
 	memcpy(pl->pool + offset, name, len+1);
-	pl->pool_offset += len + 1;
-	const char *key = strdup(name);
-	sl_set(pl->symtab, key, (void*)(unsigned long)offset);
+	pl->pool_offset += nbytes;
+	idx_t mask = pl->symtab_size - 1;
+	idx_t i = hash & mask;
+
+	while (pl->symtab[i])
+		i = (i + 1) & mask;
+
+	pl->symtab[i] = offset;
+	pl->symtab_count++;
 	return offset;
 }
 
+idx_t is_in_pool(const prolog *pl, const char *name)
+{
+	if (!name || !pl->symtab_size) return ERR_IDX;
+	uint32_t len;
+	uint32_t hash = pool_hash(name, &len);
+	return find_in_pool(pl, name, hash, len);
+}
+
 idx_t index_from_pool(prolog *pl, const char *name)
 {
 	if (!name) return ERR_IDX;
-	idx_t offset = is_in_pool(pl, name);
+	uint32_t len;
+	uint32_t hash = pool_hash(name, &len);
+
+	if (pl->symtab_size) {
+		idx_t offset = find_in_pool(pl, name, hash, len);
 
-	if (offset != ERR_IDX)
-		return offset;
+		if (offset != ERR_IDX)
+			return offset;
+	}
 
-	return add_to_pool(pl, name);
+	return add_to_pool(pl, name, hash, len);
 }
 
-unsigned get_op(module *m, const char *name, unsigned *specifier, bool hint_prefix)
+static bool add_op_slot(module *m, const struct op_table *ptr)
 {
-	for (const struct op_table *ptr = m->ops; ptr->name; ptr++) {
-		if (!ptr->specifier)
-			continue;
+	idx_t val_off = index_from_pool(m->pl, ptr->name);
+	if (val_off == ERR_IDX) return false;
+	idx_t mask = m->op_index_size - 1;
+	idx_t i = POOL_HDR(m->pl, val_off)->hash & mask;
 
-		if (hint_prefix && !IS_PREFIX(ptr->specifier))
-			continue;
+	while (m->op_index[i].val_off && (m->op_index[i].val_off != val_off))
+		i = (i + 1) & mask;
+
+	op_slot *slot = &m->op_index[i];
+	slot->val_off = val_off;
 
-		if (!strcmp(ptr->name, name)) {
-			if (specifier) *specifier = ptr->specifier;
-			return ptr->priority;
+	for (unsigned j = 0; j < MAX_OP_VARIANTS; j++) {
+		if (!slot->ops[j]) {
+			slot->ops[j] = ptr;
+			break;
 		}
 	}
 
-	for (const struct op_table *ptr = m->def_ops; ptr->name; ptr++) {
-		if (!ptr->specifier)
-			continue;
+	return true;
+}
 
-		if (hint_prefix && !IS_PREFIX(ptr->specifier))
-			continue;
+static bool rebuild_op_index(module *m)
+{
+	unsigned cnt = 0;
 
-		if (!strcmp(ptr->name, name)) {
-			if (specifier) *specifier = ptr->specifier;
-			return ptr->priority;
-		}
+	for (const struct op_table *ptr = m->ops; ptr->name; ptr++)
+		cnt += ptr->specifier ? 1 : 0;
+
+	for (const struct op_table *ptr = m->def_ops; ptr->name; ptr++)
+		cnt += ptr->specifier ? 1 : 0;
+
+	unsigned size = 64;
+
+	while (size < (cnt * 2))
+		size *= 2;
+
+	op_slot *tab = calloc(size, sizeof(op_slot));
+	if (!tab) return false;
+	free(m->op_index);
+	m->op_index = tab;
+	m->op_index_size = size;
+
+	for (const struct op_table *ptr = m->ops; ptr->name; ptr++) {
+		if (ptr->specifier && !add_op_slot(m, ptr))
+			return false;
 	}
 
-	if (hint_prefix)
-		return get_op(m, name, specifier, false);
+	for (const struct op_table *ptr = m->def_ops; ptr->name; ptr++) {
+		if (ptr->specifier && !add_op_slot(m, ptr))
+			return false;
+	}
 
-	return 0;
+	return true;
 }
 
-unsigned get_op2(module *m, const char *name, unsigned specifier)
+static const op_slot *find_op_slot(const module *m, const char *name)
 {
-	for (const struct op_table *ptr = m->ops; ptr->name; ptr++) {
-		if (!ptr->specifier)
-			continue;
+	if (!m->op_index_size)
+		return NULL;
 
-		if (!strcmp(ptr->name, name)) {
-			if (specifier == ptr->specifier)
-				return ptr->priority;
-		}
+	idx_t val_off = is_in_pool(m->pl, name);
+
+	if (val_off == ERR_IDX)
+		return NULL;
+
+	idx_t mask = m->op_index_size - 1;
+
+	for (idx_t i = POOL_HDR(m->pl, val_off)->hash & mask; m->op_index[i].val_off; i = (i + 1) & mask) {
+		if (m->op_index[i].val_off == val_off)
+			return &m->op_index[i];
 	}
 
-	for (const struct op_table *ptr = m->def_ops; ptr->name; ptr++) {
-		if (!ptr->specifier)
-			continue;
+	return NULL;
+}
 
-		if (!strcmp(ptr->name, name)) {
-			if (specifier == ptr->specifier)
-				return ptr->priority;
+unsigned get_op(module *m, const char *name, unsigned *specifier, bool hint_prefix)
+{
+	const op_slot *slot = find_op_slot(m, name);
+
+	if (!slot)
+		return 0;
+
+	const struct op_table *ptr = NULL;
+
+	for (unsigned j = 0; hint_prefix && (j < MAX_OP_VARIANTS) && slot->ops[j]; j++) {
+		if (IS_PREFIX(slot->ops[j]->specifier)) {
+			ptr = slot->ops[j];
+			break;
 		}
 	}
 
+	if (!ptr)
+		ptr = slot->ops[0];
+
+	if (specifier) *specifier = ptr->specifier;
+	return ptr->priority;
+}
+
+unsigned get_op2(module *m, const char *name, unsigned specifier)
+{
+	const op_slot *slot = find_op_slot(m, name);
+
+	if (!slot)
+		return 0;
+
+	for (unsigned j = 0; (j < MAX_OP_VARIANTS) && slot->ops[j]; j++) {
+		if (slot->ops[j]->specifier == specifier)
+			return slot->ops[j]->priority;
+	}
+
 	return 0;
 }
 
@@ -239,14 +380,12 @@ bool set_op(module *m, const char *name, unsigned specifier, unsigned priority)
 			ptr->name = strdup("");
 			ptr->specifier = 0;
 			ptr->priority = 0;
-			m->loaded_ops = false;
-			return true;
+			return rebuild_op_index(m);
 		}
 
 		ptr->specifier = specifier;
 		ptr->priority = priority;
-		m->loaded_ops = false;
-		return true;
+		return rebuild_op_index(m);
 	}
 
 	ptr = m->ops;
@@ -266,14 +405,12 @@ bool set_op(module *m, const char *name, unsigned specifier, unsigned priority)
 			ptr->name = strdup("");
 			ptr->specifier = 0;
 			ptr->priority = 0;
-			m->loaded_ops = false;
-			return true;
+			return rebuild_op_index(m);
 		}
 
 		ptr->specifier = specifier;
 		ptr->priority = priority;
-		m->loaded_ops = false;
-		return true;
+		return rebuild_op_index(m);
 	}
 
 	if (!priority)
@@ -298,8 +435,7 @@ bool set_op(module *m, const char *name, unsigned specifier, unsigned priority)
 	ptr->name = strdup(name);
 	ptr->specifier = specifier;
 	ptr->priority = priority;
-	m->loaded_ops = false;
-	return true;
+	return rebuild_op_index(m);
 }
 
 static const char *get_filename(const char *path)
@@ -493,14 +629,48 @@ static predicate *find_matching_predicate_internal(module *m, cell *c, __attribu
 	return NULL;
 }
 
+void invalidate_pred_cache(prolog *pl)
+{
+	pl->pred_gen++;
+}
+
+static pred_cache_entry *get_pred_cache(module *m, const cell *c)
+{
+	uint64_t k = ((uint64_t)(uintptr_t)m >> 4) ^ ((uint64_t)c->val_off << 8) ^ c->arity;
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdULL;
+	k ^= k >> 33;
+	return &m->pl->pred_cache[k & (PRED_CACHE_SIZE - 1)];
+}
+
+static predicate *find_matching_predicate_cached(module *m, cell *c, bool quiet)
+{
+	if (!is_literal(c))
+		return find_matching_predicate_internal(m, c, quiet);
+
+	pred_cache_entry *e = get_pred_cache(m, c);
+
+	if ((e->gen == m->pl->pred_gen) && (e->m == m)
+		&& (e->val_off == c->val_off) && (e->arity == c->arity))
+		return e->h;
+
+	predicate *h = find_matching_predicate_internal(m, c, quiet);
+	e->m = m;
+	e->h = h;
+	e->gen = m->pl->pred_gen;
+	e->val_off = c->val_off;
+	e->arity = c->arity;
+	return h;
+}
+
 predicate *find_matching_predicate(module *m, cell *c)
 {
-	return find_matching_predicate_internal(m, c, false);
+	return find_matching_predicate_cached(m, c, false);
 }
 
 predicate *find_matching_predicate_quiet(module *m, cell *c)
 {
-	return find_matching_predicate_internal(m, c, true);
+	return find_matching_predicate_cached(m, c, true);
 }
 
 predicate *find_functor(module *m, const char *name, unsigned arity)
@@ -512,22 +682,6 @@ predicate *find_functor(module *m, const char *name, unsigned arity)
 	return find_predicate(m, &tmp);
 }
 
-static void push_property(module *m, const char *name, unsigned arity, const char *type)
-{
-	if (name[0] == '$')
-		return;
-
-	size_t buflen = 1024;
-	char *tmpbuf = malloc(buflen);
-	format_property(&tmpbuf, &buflen, tmpbuf, name, arity, type);
-	parser *p = create_parser(m);
-	p->srcptr = tmpbuf;
-	p->consulting = true;
-	parser_tokenize(p, false, false);
-	destroy_parser(p);
-	free(tmpbuf);
-}
-
 static predicate *create_predicate(module *m, cell *c)
 {
 	FAULTINJECT(errno = ENOMEM; return NULL);
@@ -545,6 +699,7 @@ static predicate *create_predicate(module *m, cell *c)
 		h->key.val_off = index_from_pool(m->pl, MODULE_GET_STR(c));
 
 	sl_app(m->index, &h->key, h);
+	invalidate_pred_cache(m->pl);
 	return h;
 }
 
@@ -559,7 +714,6 @@ static void set_multifile_in_db(module *m, const char *name, idx_t arity)
 	if (!h) h = create_predicate(m, &tmp);
 
 	if (h) {
-		push_property(m, name, arity, "multifile");
 		h->is_multifile = true;
 	} else
 		m->error = true;
@@ -647,6 +801,71 @@ static int compkey(const void *param, const void *ptr1, const void *ptr2)
 	return 0;
 }
 
+// Clause references (uuids) are hashed to their clause, chained
+// through 'ref_next', so that erase/1, instance/2 and clause/3 don't
+// have to search the whole database...
+
+static idx_t uuid_hash(const uuid *u)
+{
+	uint64_t k = u->u1 ^ (u->u2 * 0x9e3779b97f4a7c15ULL);
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdULL;
+	k ^= k >> 33;
+	return (idx_t)k;
+}
+
+static void add_to_refs(module *m, clause *r)
+{
+	if (m->ref_count >= m->ref_size) {
+		idx_t save_size = m->ref_size;
+		clause **save = m->refs;
+		m->ref_size = save_size ? save_size * 2 : INITIAL_INDEX_SIZE;
+		m->refs = calloc(m->ref_size, sizeof(clause*));
+		ensure(m->refs);
+
+		for (idx_t i = 0; i < save_size; i++) {
+			for (clause *r2 = save[i]; r2;) {
+				clause *next = r2->ref_next;
+				idx_t j = uuid_hash(&r2->u) & (m->ref_size - 1);
+				r2->ref_next = m->refs[j];
+				m->refs[j] = r2;
+				r2 = next;
+			}
+		}
+
+		free(save);
+	}
+
+	idx_t i = uuid_hash(&r->u) & (m->ref_size - 1);
+	r->ref_next = m->refs[i];
+	m->refs[i] = r;
+	m->ref_count++;
+}
+
+static void remove_from_refs(module *m, clause *r)
+{
+	if (!m->ref_size)
+		return;
+
+	clause **prev = &m->refs[uuid_hash(&r->u) & (m->ref_size - 1)];
+
+	for (; *prev; prev = &(*prev)->ref_next) {
+		if (*prev == r) {
+			*prev = r->ref_next;
+			r->ref_next = NULL;
+			m->ref_count--;
+			return;
+		}
+	}
+}
+
+void set_uuid_in_db(module *m, clause *r, const uuid *u)
+{
+	remove_from_refs(m, r);
+	r->u = *u;
+	add_to_refs(m, r);
+}
+
 static clause* assert_begin(module *m, term *t, bool consulting)
 {
 	cell *c = t->cells;
@@ -670,6 +889,17 @@ static clause* assert_begin(module *m, term *t, bool consulting)
 
 	predicate *h = find_predicate(m, c);
 
+	// Clauses of a tabled predicate are stored under an internal name
+	// and reached through the wrapper added by the table directive...
+
+	if (h && h->is_tabled && consulting) {
+		char tmpbuf[1024];
+		snprintf(tmpbuf, sizeof(tmpbuf), "$tabled_%s", MODULE_GET_STR(c));
+		c->val_off = index_from_pool(m->pl, tmpbuf);
+		if (c->val_off == ERR_IDX) return NULL;
+		h = find_predicate(m, c);
+	}
+
 	if (h && !consulting && !h->is_dynamic) {
 		fprintf(stdout, "Error: not dynamic '%s'/%u\n", MODULE_GET_STR(c), c->arity);
 		return NULL;
@@ -682,23 +912,11 @@ static clause* assert_begin(module *m, term *t, bool consulting)
 		if (check_directive(t->cells))
 			h->check_directive = true;
 
-		if (!consulting) {
-			push_property(m, MODULE_GET_STR(c), c->arity, "dynamic");
+		if (!consulting)
 			h->is_dynamic = true;
-		} else {
-			if (m->prebuilt) {
-				push_property(m, MODULE_GET_STR(c), c->arity, "built_in");
-				push_property(m, MODULE_GET_STR(c), c->arity, "private");
-			}
-
-			push_property(m, MODULE_GET_STR(c), c->arity, "static");
-		}
 
-		if (consulting && m->make_public) {
-			push_property(m, MODULE_GET_STR(c), c->arity, "public");
+		if (consulting && m->make_public)
 			h->is_public = true;
-		}
-
 	}
 
 	if (m->prebuilt)
@@ -708,6 +926,7 @@ static clause* assert_begin(module *m, term *t, bool consulting)
 	clause *r = calloc(sizeof(clause)+(sizeof(cell)*nbr_cells), 1);
 	if (!r) {
 		h->is_abolished = true;
+		invalidate_pred_cache(m->pl);
 		return NULL;
 	}
 
@@ -716,50 +935,310 @@ static clause* assert_begin(module *m, term *t, bool consulting)
 	r->t.nbr_cells = copy_cells(r->t.cells, t->cells, nbr_cells);
 	r->t.ugen_created = ++m->pl->ugen;
 	r->m = m;
+	uuid_gen(m->pl, &r->u);
+	add_to_refs(m, r);
 	return r;
 }
 
-static void reindex_predicate(module *m, predicate *h)
+struct ref_chunk_ {
+	ref_chunk *next;
+	idx_t nbr;
+	clause_ref refs[REF_CHUNK_SIZE];
+};
+
+// Atoms, small integers and compounds (by name/arity) are keys...
+
+bool is_index_key(const cell *c)
+{
+	return is_literal(c) || is_integer(c);
+}
+
+static int_t index_val(const cell *c)
 {
-	h->index = sl_create1(compkey, m);
-	ensure(h->index);
+	return is_literal(c) ? (int_t)c->val_off : c->val_num;
+}
 
-	for (clause *r = h->head; r; r = r->next) {
-		cell *c = get_head(r->t.cells);
+static uint64_t index_hash(uint8_t val_type, uint8_t arity, int_t val_key)
+{
+	uint64_t k = ((uint64_t)val_key << 1) | (val_type == TYPE_LITERAL);
+	k ^= (uint64_t)arity << 56;
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdULL;
+	k ^= k >> 33;
+	return k;
+}
+
+static bool is_bucket(const db_bucket *b, const cell *c, int_t val_key)
+{
+	return (b->val_type == c->val_type) && (b->arity == c->arity)
+		&& (b->val_key == val_key);
+}
+
+static db_bucket *find_bucket(const db_index *idx, const cell *c)
+{
+	int_t val_key = index_val(c);
+	idx_t mask = idx->size - 1;
+
+	for (idx_t i = index_hash(c->val_type, c->arity, val_key) & mask; idx->buckets[i].val_type; i = (i + 1) & mask) {
+		db_bucket *b = &idx->buckets[i];
+
+		if (is_bucket(b, c, val_key))
+			return b;
+	}
+
+	return NULL;
+}
+
+clause_ref *find_in_index(const db_index *idx, const cell *c)
+{
+	const db_bucket *b = find_bucket(idx, c);
+	return b ? b->head : NULL;
+}
+
+static void grow_index(db_index *idx)
+{
+	db_bucket *save = idx->buckets;
+	idx_t save_size = idx->size;
+	idx->size *= 2;
+	idx->buckets = calloc(idx->size, sizeof(db_bucket));
+	ensure(idx->buckets);
+	idx_t mask = idx->size - 1;
+
+	for (idx_t j = 0; j < save_size; j++) {
+		if (!save[j].val_type)
+			continue;
+
+		idx_t i = index_hash(save[j].val_type, save[j].arity, save[j].val_key) & mask;
+
+		while (idx->buckets[i].val_type)
+			i = (i + 1) & mask;
+
+		idx->buckets[i] = save[j];
+	}
+
+	free(save);
+}
+
+static db_bucket *get_bucket(db_index *idx, const cell *c)
+{
+	if (((idx->count + 1) * 4) >= (idx->size * 3))
+		grow_index(idx);
+
+	int_t val_key = index_val(c);
+	idx_t mask = idx->size - 1;
+	idx_t i = index_hash(c->val_type, c->arity, val_key) & mask;
+
+	for (; idx->buckets[i].val_type; i = (i + 1) & mask) {
+		db_bucket *b = &idx->buckets[i];
+
+		if (is_bucket(b, c, val_key))
+			return b;
+	}
 
+	db_bucket *b = &idx->buckets[i];
+	b->val_type = c->val_type;
+	b->arity = c->arity;
+	b->val_key = val_key;
+	idx->count++;
+	return b;
+}
+
+static cell *index_arg(const db_index *idx, clause *r)
+{
+	cell *c = get_head(r->t.cells) + 1;
+
+	for (unsigned i = 0; i < idx->arg; i++)
+		c += c->nbr_cells;
+
+	return c;
+}
+
+static void add_to_index(db_index *idx, clause *r, bool append)
+{
+	if (!idx->chunks || (idx->chunks->nbr == REF_CHUNK_SIZE)) {
+		ref_chunk *ch = malloc(sizeof(ref_chunk));
+		ensure(ch);
+		ch->next = idx->chunks;
+		ch->nbr = 0;
+		idx->chunks = ch;
+	}
+
+	clause_ref *ref = &idx->chunks->refs[idx->chunks->nbr++];
+	ref->r = r;
+	ref->next = NULL;
+	ref->seq = append ? idx->hi_seq++ : --idx->lo_seq;
+	cell *c = index_arg(idx, r);
+	clause_ref **head, **tail;
+
+	if (is_index_key(c)) {
+		db_bucket *b = get_bucket(idx, c);
+		head = &b->head;
+		tail = &b->tail;
+	} else {
+		head = &idx->vars;
+		tail = &idx->vars_tail;
+	}
+
+	if (append) {
+		if (*tail)
+			(*tail)->next = ref;
+		else
+			*head = ref;
+
+		*tail = ref;
+	} else {
+		ref->next = *head;
+		*head = ref;
+
+		if (!*tail)
+			*tail = ref;
+	}
+}
+
+static void destroy_index(db_index *idx)
+{
+	while (idx) {
+		db_index *save = idx->next;
+
+		for (unsigned i = 0; i < MAX_JIT_ARGS; i++)
+			destroy_index(idx->jit[i]);
+
+		for (ref_chunk *ch = idx->chunks; ch;) {
+			ref_chunk *next = ch->next;
+			free(ch);
+			ch = next;
+		}
+
+		free(idx->buckets);
+		free(idx);
+		idx = save;
+	}
+}
+
+// An unlinked clause is taken out of its list. The node itself is
+// left pointing on, as a choice point may be resting on it...
+
+static void remove_from_index(db_index *idx, clause *r)
+{
+	cell *c = index_arg(idx, r);
+	clause_ref **head, **tail;
+
+	if (is_index_key(c)) {
+		db_bucket *b = find_bucket(idx, c);
+		if (!b) return;
+		head = &b->head;
+		tail = &b->tail;
+	} else {
+		head = &idx->vars;
+		tail = &idx->vars_tail;
+	}
+
+	for (clause_ref *ref = *head, *prev = NULL; ref; prev = ref, ref = ref->next) {
+		if (ref->r != r)
+			continue;
+
+		if (prev)
+			prev->next = ref->next;
+		else
+			*head = ref->next;
+
+		if (*tail == ref)
+			*tail = prev;
+
+		idx->dead++;
+		return;
+	}
+}
+
+// Executing queries may still hold references into an index,
+// so it is only retired here. It is freed once no choice point
+// older than the retirement is left, or with the predicate...
+
+void drop_index(module *m, predicate *h)
+{
+	if (!h->index)
+		return;
+
+	h->index->ugen = m->pl->ugen;
+	h->index->next = h->index_save;
+	h->index_save = h->index;
+	h->index = NULL;
+}
+
+static void purge_index_save(predicate *h, uint64_t oldest)
+{
+	db_index **prev = &h->index_save;
+
+	while (*prev) {
+		db_index *idx = *prev;
+
+		if (idx->ugen >= oldest) {
+			prev = &idx->next;
+			continue;
+		}
+
+		*prev = idx->next;
+		idx->next = NULL;
+		destroy_index(idx);
+	}
+}
+
+static db_index *create_index(predicate *h, unsigned arg)
+{
+	db_index *idx = calloc(1, sizeof(db_index));
+	ensure(idx);
+	idx->arg = arg;
+	idx->size = INITIAL_INDEX_SIZE;
+	idx->buckets = calloc(idx->size, sizeof(db_bucket));
+	ensure(idx->buckets);
+
+	for (clause *r = h->head; r; r = r->next) {
 		if (!r->t.ugen_erased)
-			sl_app(h->index, c, r);
+			add_to_index(idx, r, true);
 	}
+
+	return idx;
 }
 
-static void assert_commit(module *m, term *t, clause *r, predicate *h, bool append)
+// Calls that leave the first argument unbound but bind a later one
+// would otherwise scan every clause. Once that has happened a few
+// times an index is built on the later argument and then kept up
+// to date with the first-argument index...
+
+db_index *get_jit_index(predicate *h, unsigned arg)
 {
-	cell *c = get_head(r->t.cells);
-	cell *p1 = c + 1;
+	db_index *idx = h->index;
+
+	if (!idx || !arg || (arg > MAX_JIT_ARGS) || (arg >= h->key.arity))
+		return NULL;
+
+	if (!idx->jit[arg-1] && (++idx->scans[arg-1] >= JIT_SCAN_COUNT))
+		idx->jit[arg-1] = create_index(h, arg);
+
+	return idx->jit[arg-1];
+}
+
+static void index_clause(db_index *idx, clause *r, bool append)
+{
+	add_to_index(idx, r, append);
+
+	for (unsigned i = 0; i < MAX_JIT_ARGS; i++) {
+		if (idx->jit[i])
+			add_to_index(idx->jit[i], r, append);
+	}
+}
 
+static void assert_commit(module *m, term *t, clause *r, predicate *h, bool append)
+{
 	if (h->is_persist)
 		r->t.persist = true;
 
 	if (h->key.arity) {
-		if (!h->index && is_structure(p1))
-			h->is_noindex = true;
-
-		if (h->index && is_structure(p1)) {
-			h->is_noindex = true;
-			h->index_save = h->index;
-			h->index = NULL;
-		}
-
 		if (!h->index && (h->cnt > JUST_IN_TIME_COUNT)
 			&& !m->pl->noindex && !h->is_noindex)
-			reindex_predicate(m, h);
-
-		if (h->index) {
-			if (!append)
-				sl_set(h->index, c, r);
-			else
-				sl_app(h->index, c, r);
-		}
+			h->index = create_index(h, 0);
+		else if (h->index)
+			index_clause(h->index, r, append);
 	}
 
 	t->cidx = 0;
@@ -812,6 +1291,7 @@ static bool retract_from_db(module *m, clause *r)
 
 	r->owner->cnt--;
 	r->t.ugen_erased = ++m->pl->ugen;
+	remove_from_refs(r->m, r);
 	return true;
 }
 
@@ -822,29 +1302,60 @@ void add_to_dirty_list(query *q, clause *r)
 
 	r->dirty = q->dirty_list;
 	q->dirty_list = r;
+
+	if (++q->nbr_dirty >= PURGE_DIRTY_COUNT)
+		q->purge_pending = true;
 }
 
-static void query_purge_dirty_list(query *q)
+// Take a retracted clause out of its predicate's list and indexes.
+// Its memory must stay until nothing can still reach it, so it
+// waits on the module's dirty list. An index with as many dead
+// nodes as live clauses is rebuilt...
+
+static void unlink_clause(clause *r)
 {
-	while (q->dirty_list) {
-		clause *r = q->dirty_list;
-		q->dirty_list = r->dirty;
+	predicate *h = r->owner;
+
+	if (r->prev)
+		r->prev->next = r->next;
+
+	if (r->next)
+		r->next->prev = r->prev;
 
-		if (r->prev)
-			r->prev->next = r->next;
+	if (h->head == r)
+		h->head = r->next;
 
-		if (r->next)
-			r->next->prev = r->prev;
+	if (h->tail == r)
+		h->tail = r->prev;
 
-		if (r->owner->head == r)
-			r->owner->head = r->next;
+	if (h->index) {
+		remove_from_index(h->index, r);
 
-		if (r->owner->tail == r)
-			r->owner->tail = r->prev;
+		for (unsigned i = 0; i < MAX_JIT_ARGS; i++) {
+			if (h->index->jit[i])
+				remove_from_index(h->index->jit[i], r);
+		}
+
+		if (h->index->dead > (h->cnt + JUST_IN_TIME_COUNT)) {
+			drop_index(r->m, h);
+			h->index = create_index(h, 0);
+		}
+	}
+
+	r->ugen_unlinked = r->m->pl->ugen;
+	r->dirty = r->m->dirty_list;
+	r->m->dirty_list = r;
+}
 
-		r->dirty = q->m->dirty_list;
-		q->m->dirty_list = r;
+static void query_purge_dirty_list(query *q)
+{
+	while (q->dirty_list) {
+		clause *r = q->dirty_list;
+		q->dirty_list = r->dirty;
+		unlink_clause(r);
 	}
+
+	q->nbr_dirty = 0;
 }
 
 static void module_purge_dirty_list(module *m)
@@ -852,48 +1363,91 @@ static void module_purge_dirty_list(module *m)
 	while (m->dirty_list) {
 		clause *r = m->dirty_list;
 		m->dirty_list = r->dirty;
+		purge_index_save(r->owner, UINT64_MAX);
 		//clear_term(&r->t);
 		free(r);
 	}
 }
 
-clause *find_in_db(module *m, uuid *ref)
+// Reclaim retracted clauses while a query is still running. A choice
+// point iterating a predicate sees the database as of its 'ugen', so
+// a clause erased no later than the oldest such view can be unlinked,
+// and one unlinked before it was made can be freed. Clauses that a
+// live frame is executing or holds bindings into are kept. Nested
+// queries and tasks share the database, so they don't do this...
+
+void purge_dirty_list(query *q)
 {
-	for (predicate *h = m->head; h; h = h->next) {
-		for (clause *r = h->head ; r; r = r->next) {
-			if (r->t.ugen_erased)
+	prolog *pl = q->m->pl;
+	q->purge_pending = false;
+	q->nbr_dirty = 0;
+
+	if ((pl->nbr_running > 1) || q->m->tasks)
+		return;
+
+	uint64_t oldest = pl->ugen + 1;
+
+	for (idx_t i = 0; i < q->cp; i++) {
+		const choice *ch = GET_CHOICE(i);
+
+		if (ch->is_iter && (ch->ugen < oldest))
+			oldest = ch->ugen;
+	}
+
+	for (clause **prev = &q->dirty_list; *prev;) {
+		clause *r = *prev;
+
+		if (r->t.ugen_erased > oldest) {
+			prev = &r->dirty;
+			continue;
+		}
+
+		*prev = r->dirty;
+		unlink_clause(r);
+	}
+
+	for (idx_t i = 0; i < q->st.fp; i++) {
+		const frame *g = GET_FRAME(i);
+
+		if (g->r && g->r->t.ugen_erased)
+			g->r->is_pinned = true;
+	}
+
+	for (module *m = pl->modules; m; m = m->next) {
+		for (clause **prev = &m->dirty_list; *prev;) {
+			clause *r = *prev;
+
+			if (r->is_pinned || (r->ugen_unlinked >= oldest)) {
+				prev = &r->dirty;
 				continue;
+			}
 
-			if (!memcmp(&r->u, ref, sizeof(uuid)))
-				return r;
+			*prev = r->dirty;
+			purge_index_save(r->owner, oldest);
+			//clear_term(&r->t);
+			free(r);
 		}
 	}
 
-	return NULL;
-}
+	for (idx_t i = 0; i < q->st.fp; i++) {
+		const frame *g = GET_FRAME(i);
 
-clause *erase_from_db(module *m, uuid *ref)
-{
-	clause *r = find_in_db(m, ref);
-	if (!r) return 0;
-	r->t.ugen_erased = ++m->pl->ugen;
-	return r;
+		if (g->r)
+			g->r->is_pinned = false;
+	}
 }
 
-static void set_noindex_in_db(module *m, const char *name, unsigned arity)
+clause *find_in_db(module *m, uuid *ref)
 {
-	cell tmp = (cell){0};
-	tmp.val_type = TYPE_LITERAL;
-	tmp.val_off = index_from_pool(m->pl, name);
-	ensure(tmp.val_off != ERR_IDX);
-	tmp.arity = arity;
-	predicate *h = find_predicate(m, &tmp);
-	if (!h) h = create_predicate(m, &tmp);
+	if (!m->ref_size)
+		return NULL;
 
-	if (h)
-		h->is_noindex = true;
-	else
-		m->error = true;
+	for (clause *r = m->refs[uuid_hash(ref) & (m->ref_size - 1)]; r; r = r->ref_next) {
+		if (!memcmp(&r->u, ref, sizeof(uuid)))
+			return r;
+	}
+
+	return NULL;
 }
 
 void set_discontiguous_in_db(module *m, const char *name, unsigned arity)
@@ -907,7 +1461,6 @@ void set_discontiguous_in_db(module *m, const char *name, unsigned arity)
 	if (!h) h = create_predicate(m, &tmp);
 
 	if (h) {
-		push_property(m, name, arity, "discontiguous");
 		h->is_discontiguous = true;
 	} else
 		m->error = true;
@@ -924,7 +1477,6 @@ static void set_dynamic_in_db(module *m, const char *name, unsigned arity)
 	if (!h) h = create_predicate(m, &tmp);
 
 	if (h) {
-		push_property(m, name, arity, "dynamic");
 		h->is_dynamic = true;
 	} else
 		m->error = true;
@@ -943,29 +1495,93 @@ static void set_meta_predicate_in_db(module *m, cell *c)
 	if (!h) h = create_predicate(m, &tmp);
 
 	if (h) {
-		query q = (query){0};
-		q.m = m;
-		char *dst = print_term_to_strbuf(&q, c, 0, 0);
-		push_property(m, name, arity, dst);
-		free(dst);
+		free(h->meta_spec);
+		h->meta_spec = malloc(sizeof(cell)*c->nbr_cells);
+		ensure(h->meta_spec);
+		copy_cells(h->meta_spec, c, c->nbr_cells);
+
+		// Quoted atoms in the spec are strings owned by the directive,
+		// so intern them to keep the copy self-contained...
+
+		for (idx_t i = 0; i < c->nbr_cells; i++) {
+			cell *c2 = h->meta_spec + i;
+
+			if (is_cstring(c2)) {
+				c2->val_off = index_from_pool(m->pl, MODULE_GET_STR(c + i));
+				ensure(c2->val_off != ERR_IDX);
+				c2->val_type = TYPE_LITERAL;
+				c2->flags = 0;
+			}
+		}
+
 		h->is_meta_predicate = true;
 	} else
 		m->error = true;
 }
 
+static void set_table_in_db(module *m, const char *name, unsigned arity)
+{
+	cell tmp = (cell){0};
+	tmp.val_type = TYPE_LITERAL;
+	tmp.val_off = index_from_pool(m->pl, name);
+	ensure(tmp.val_off != ERR_IDX);
+	tmp.arity = arity;
+	predicate *h = find_predicate(m, &tmp);
+	if (!h) h = create_predicate(m, &tmp);
+
+	if (!h) {
+		m->error = true;
+		return;
+	}
+
+	if (h->is_tabled)
+		return;
+
+	// Add the wrapper: 'p'(_0,...) :- '$tbl_call'('p'(_0,...), '$tabled_p'(_0,...)).
+
+	size_t len = formatted(NULL, 0, name, strlen(name), false);
+	char *qname = malloc(len+1);
+	ensure(qname);
+	formatted(qname, len+1, name, strlen(name), false);
+	qname[len] = '\0';
+	size_t buflen = (arity * 16) + 8;
+	char *args = malloc(buflen), *dst = args;
+	ensure(args);
+	*dst = '\0';
+
+	for (unsigned i = 0; i < arity; i++)
+		dst += sprintf(dst, "%s_%u", i ? ",_" : "(_", i);
+
+	if (arity)
+		strcat(dst, ")");
+
+	buflen = (len + strlen(args)) * 3 + 256;
+	char *src = malloc(buflen);
+	ensure(src);
+	snprintf(src, buflen, "'%s'%s :- '$tbl_call'('%s'%s, '$tabled_%s'%s).",
+		qname, args, qname, args, qname, args);
+	parser *p = create_parser(m);
+	p->srcptr = src;
+	p->consulting = true;
+	parser_tokenize(p, false, false);
+	destroy_parser(p);
+	h->is_tabled = true;
+	free(src);
+	free(args);
+	free(qname);
+}
+
 static void set_persist_in_db(module *m, const char *name, unsigned arity)
 {
 	cell tmp = (cell){0};
 	tmp.val_type = TYPE_LITERAL;
 	tmp.val_off = index_from_pool(m->pl, name);
-	ensure(tmp.val_off == ERR_IDX);
+	ensure(tmp.val_off != ERR_IDX);
 	tmp.arity = arity;
 	predicate *h = find_predicate(m, &tmp);
 	if (!h) h = create_predicate(m, &tmp);
 
 	if (h) {
-		push_property(m, name, arity, "dynamic");
-		push_property(m, name, arity, "persist");
 		h->is_dynamic = true;
 		h->is_persist = true;
 		m->use_persist = true;
@@ -1046,12 +1662,6 @@ parser *create_parser(module *m)
 
 void destroy_query(query *q)
 {
-	while (q->st.qnbr > 0) {
-		free(q->tmpq[q->st.qnbr]);
-		q->tmpq[q->st.qnbr] = NULL;
-		q->st.qnbr--;
-	}
-
 	for (arena *a = q->arenas; a;) {
 		for (idx_t i = 0; i < a->hp; i++) {
 			cell *c = a->heap + i;
@@ -1064,13 +1674,16 @@ void destroy_query(query *q)
 		free(save);
 	}
 
-	for (int i = 0; i < MAX_QUEUES; i++) {
-		for (idx_t j = 0; j < q->qp[i]; j++) {
-			cell *c = q->queue[i]+j;
+	for (idx_t i = 0; q->queues && (i < q->queues_size); i++) {
+		collector *qu = q->queues + i;
+
+		for (idx_t j = 0; j < qu->qp; j++) {
+			cell *c = qu->queue + j;
 			DECR_REF(c);
 		}
 
-		free(q->queue[i]);
+		free(qu->queue);
+		free(qu->tmpq);
 	}
 
 	slot *e = q->slots;
@@ -1078,6 +1691,8 @@ void destroy_query(query *q)
 	for (idx_t i = 0; i < q->st.sp; i++, e++)
 		DECR_REF(&e->c);
 
+	free_undos(q);
+	free(q->queues);
 	free(q->trails);
 	free(q->choices);
 	free(q->slots);
@@ -1103,20 +1718,22 @@ query *create_query(module *m, bool is_task)
 	q->slots_size = is_task ? INITIAL_NBR_SLOTS/10 : INITIAL_NBR_SLOTS;
 	q->choices_size = is_task ? INITIAL_NBR_CHOICES/10 : INITIAL_NBR_CHOICES;
 	q->trails_size = is_task ? INITIAL_NBR_TRAILS/10 : INITIAL_NBR_TRAILS;
+	q->queues_size = INITIAL_NBR_QUEUES;
 
 	bool error = false;
 	CHECK_SENTINEL(q->frames = calloc(q->frames_size, sizeof(frame)), NULL);
 	CHECK_SENTINEL(q->slots = calloc(q->slots_size, sizeof(slot)), NULL);
 	CHECK_SENTINEL(q->choices = calloc(q->choices_size, sizeof(choice)), NULL);
 	CHECK_SENTINEL(q->trails = calloc(q->trails_size, sizeof(trail)), NULL);
+	CHECK_SENTINEL(q->queues = calloc(q->queues_size, sizeof(collector)), NULL);
 
 	// Allocate these later as needed...
 
 	q->h_size = is_task ? INITIAL_NBR_HEAP/10 : INITIAL_NBR_HEAP;
 	q->tmph_size = is_task ? INITIAL_NBR_CELLS/10 : INITIAL_NBR_CELLS;
+	q->gc_threshold = q->h_size * GC_MIN_ARENAS;
 
-	for (int i = 0; i < MAX_QUEUES; i++)
-		q->q_size[i] = is_task ? INITIAL_NBR_QUEUE/10 : INITIAL_NBR_QUEUE;
+	q->q_size = is_task ? INITIAL_NBR_QUEUE/10 : INITIAL_NBR_QUEUE;
 
 	if (error) {
 		destroy_query (q);
@@ -1439,6 +2056,11 @@ static void directives(parser *p, term *t)
 				p->m->flag.character_escapes = true;
 			else if (!strcmp(PARSER_GET_STR(p2), "false") || !strcmp(PARSER_GET_STR(p2), "off"))
 				p->m->flag.character_escapes = false;
+		} else if (!strcmp(PARSER_GET_STR(p1), "atom_gc")) {
+			if (!strcmp(PARSER_GET_STR(p2), "true") || !strcmp(PARSER_GET_STR(p2), "on"))
+				p->m->flag.atom_gc = true;
+			else if (!strcmp(PARSER_GET_STR(p2), "false") || !strcmp(PARSER_GET_STR(p2), "off"))
+				p->m->flag.atom_gc = false;
 		} else if (!strcmp(PARSER_GET_STR(p1), "prefer_rationals")) {
 			if (!strcmp(PARSER_GET_STR(p2), "true") || !strcmp(PARSER_GET_STR(p2), "on"))
 				p->m->flag.prefer_rationals = true;
@@ -1562,6 +2184,8 @@ static void directives(parser *p, term *t)
 				}
 			} else if (!strcmp(dirname, "discontiguous")) {
 				set_discontiguous_in_db(p->m, PARSER_GET_STR(c_name), arity);
+			} else if (!strcmp(dirname, "table")) {
+				set_table_in_db(p->m, PARSER_GET_STR(c_name), arity);
 			}
 		}
 
@@ -1609,6 +2233,8 @@ static void directives(parser *p, term *t)
 				}
 			} else if (!strcmp(dirname, "discontiguous")) {
 				set_discontiguous_in_db(p->m, PARSER_GET_STR(c_name), arity);
+			} else if (!strcmp(dirname, "table")) {
+				set_table_in_db(p->m, PARSER_GET_STR(c_name), arity);
 			}
 
 			p1 += p1->nbr_cells;
@@ -1641,7 +2267,7 @@ static void parser_xref_cell(parser *p, term *t, cell *c, predicate *parent)
 
 	bool found = false;
 
-	if ((c->fn = get_builtin(p->m->pl, functor, c->arity, &found)) != NULL) {
+	if ((c->fn = get_builtin_term(p->m->pl, c, c->arity, &found)) != NULL) {
 		c->flags |= FLAG_BUILTIN;
 		return;
 	}
@@ -3082,6 +3708,16 @@ void fix_list(cell *c)
 	}
 }
 
+// With the atom_gc flag set, atoms first seen by read_term/2 and
+// friends are kept as reference-counted strings rather than being
+// interned, so they are freed along with the terms that hold them...
+
+static bool is_transient_atom(const parser *p)
+{
+	return p->do_read_term && p->m->flag.atom_gc
+		&& (is_in_pool(p->m->pl, p->token) == ERR_IDX);
+}
+
 unsigned parser_tokenize(parser *p, bool args, bool consing)
 {
 	idx_t begin_idx = p->t->cidx, arg_idx = p->t->cidx, save_idx = 0;
@@ -3432,7 +4068,7 @@ unsigned parser_tokenize(parser *p, bool args, bool consing)
 		}
 		else if (p->v.val_type == TYPE_FLOAT) {
 			c->val_flt = p->v.val_flt;
-		} else if ((!p->is_quoted || func || p->is_op || p->is_variable ||
+		} else if (((!p->is_quoted && !is_transient_atom(p)) || func || p->is_op || p->is_variable ||
 			(get_builtin(p->m->pl, p->token, 0, &found), found) ||
 			!strcmp(p->token, "[]")) && !p->string) {
 
@@ -3450,6 +4086,9 @@ unsigned parser_tokenize(parser *p, bool args, bool consing)
 		} else {
 			c->val_type = TYPE_CSTRING;
 
+			if (!p->is_quoted)
+				p->toklen = strlen(p->token);
+
 			if ((p->toklen < MAX_SMALL_STRING) && !p->string)
 				memcpy(c->val_chr, p->token, p->toklen+1);
 			else {
@@ -3516,16 +4155,19 @@ static bool parser_run(parser *p, const char *src, int dump)
 
 	if (!p->m->pl->quiet && !p->directive && dump && q->m->pl->stats) {
 		fprintf(stdout,
-			"Goals %llu, Matches %llu, Max frames %u, Max choices %u, Max trails: %u, Backtracks %llu, TCOs:%llu\n",
+			"Goals %llu, Matches %llu, Max frames %u, Max choices %u, Max trails: %u, Backtracks %llu, TCOs:%llu, GCs:%llu\n",
 			(unsigned long long)q->tot_goals, (unsigned long long)q->tot_matches,
 			q->max_frames, q->max_choices, q->max_trails,
-			(unsigned long long)q->tot_retries, (unsigned long long)q->tot_tcos);
+			(unsigned long long)q->tot_retries, (unsigned long long)q->tot_tcos,
+			(unsigned long long)q->tot_gcs);
 	}
 
 	query_purge_dirty_list(q);
 
-	if (dump)
-		module_purge_dirty_list(q->m);
+	if (dump) {
+		for (module *m = q->m->pl->modules; m; m = m->next)
+			module_purge_dirty_list(m);
+	}
 
 	bool ok = !q->error;
 	p->m = q->m;
@@ -3756,6 +4398,8 @@ void destroy_module(module *m)
 	}
 
 	sl_destroy(m->index);
+	free(m->refs);
+	invalidate_pred_cache(m->pl);
 
 	for (predicate *h = m->head; h;) {
 		predicate *save = h->next;
@@ -3767,8 +4411,9 @@ void destroy_module(module *m)
 			r = save;
 		}
 
-		sl_destroy(h->index);
-		sl_destroy(h->index_save);
+		destroy_index(h->index);
+		destroy_index(h->index_save);
+		free(h->meta_spec);
 		free(h);
 		h = save;
 	}
@@ -3793,6 +4438,7 @@ void destroy_module(module *m)
 	for (struct op_table *ptr = m->ops; ptr->name; ptr++)
 		free(ptr->name);
 
+	free(m->op_index);
 	destroy_parser(m->p);
 	free(m->filename);
 	free(m->name);
@@ -3821,6 +4467,7 @@ module *create_module(prolog *pl, const char *name)
 		ptr2->priority = ptr->priority;
 	}
 
+	ensure(rebuild_op_index(m));
 	m->index = sl_create1(compkey, m);
 	ensure(m->index);
 	m->p = create_parser(m);
@@ -3842,6 +4489,7 @@ module *create_module(prolog *pl, const char *name)
 
 	m->next = pl->modules;
 	pl->modules = m;
+	invalidate_pred_cache(pl);
 	return m;
 }
 
@@ -3930,19 +4578,17 @@ static void g_destroy(prolog *pl)
 		destroy_module(pl->modules);
 
 	free(g_tpl_lib);
-	sl_destroy(pl->funtab);
-	sl_destroy(pl->symtab);
+	free(pl->funtab);
+	pl->funtab = NULL;
+	pl->funtab_size = 0;
+	free(pl->symtab);
 	pl->symtab = NULL;
+	pl->symtab_size = pl->symtab_count = 0;
 	free(pl->pool);
 	pl->pool_offset = 0;
 	pl->pool = NULL;
 }
 
-static int my_strcmp(__attribute__((unused)) const void *p, const void *k1, const void *k2)
-{
-	return strcmp(k1, k2);
-}
-
 static bool g_init(prolog *pl)
 {
 	FAULTINJECT(errno = ENOMEM; return NULL);
@@ -3950,7 +4596,8 @@ static bool g_init(prolog *pl)
 	if (pl->pool) {
 		bool error = false;
 
-		CHECK_SENTINEL(pl->symtab = sl_create2((void*)my_strcmp, free), NULL);
+		if (!grow_symtab(pl))
+			error = true;
 
 		if (!error) {
 			CHECK_SENTINEL(g_false_s = index_from_pool(pl, "false"), ERR_IDX);
@@ -3974,11 +4621,11 @@ static bool g_init(prolog *pl)
 			CHECK_SENTINEL(g_clause_s = index_from_pool(pl, ":-"), ERR_IDX);
 			CHECK_SENTINEL(g_sys_elapsed_s = index_from_pool(pl, "$elapsed"), ERR_IDX);
 			CHECK_SENTINEL(g_sys_queue_s = index_from_pool(pl, "$queue"), ERR_IDX);
+			CHECK_SENTINEL(g_sys_aggregate_s = index_from_pool(pl, "$aggregate"), ERR_IDX);
 			CHECK_SENTINEL(g_eof_s = index_from_pool(pl, "end_of_file"), ERR_IDX);
 			CHECK_SENTINEL(g_lt_s = index_from_pool(pl, "<"), ERR_IDX);
 			CHECK_SENTINEL(g_gt_s = index_from_pool(pl, ">"), ERR_IDX);
 			CHECK_SENTINEL(g_eq_s = index_from_pool(pl, "="), ERR_IDX);
-			CHECK_SENTINEL(g_stream_property_s = index_from_pool(pl, "$stream_property"), ERR_IDX);
 
 			g_streams[0].fp = stdin;
 			CHECK_SENTINEL(g_streams[0].filename = strdup("stdin"), NULL);
@@ -4011,6 +4658,8 @@ void pl_destroy(prolog *pl)
 {
 	if (!pl) return;
 
+	destroy_tables(pl);
+	destroy_globals(pl);
 	destroy_module(pl->m);
 
 	if (!--g_tpl_count)
@@ -4052,10 +4701,7 @@ prolog *pl_create()
 			g_tpl_lib = strdup("../library");
 	}
 
-	pl->funtab = sl_create2((void*)my_strcmp, NULL);
-
-	if (pl->funtab)
-		load_builtins(pl);
+	load_builtins(pl);
 
 	//printf("Library: %s\n", g_tpl_lib);
 
@@ -4070,12 +4716,7 @@ prolog *pl_create()
 		pl->current_error = 2;		// STDERR
 
 		set_multifile_in_db(pl->m, "term_expansion", 2);
-		set_noindex_in_db(pl->m, "$stream_property", 2);
-		set_noindex_in_db(pl->m, "$current_op", 3);
 
-		set_dynamic_in_db(pl->m, "$current_op", 3);
-		set_dynamic_in_db(pl->m, "$predicate_property", 2);
-		set_dynamic_in_db(pl->m, "$stream_property", 2);
 		set_dynamic_in_db(pl->m, "term_expansion", 2);
 		set_dynamic_in_db(pl->m, "initialization", 1);
 		set_dynamic_in_db(pl->m, ":-", 1);
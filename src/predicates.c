@@ -176,38 +176,60 @@ static void make_small(cell *tmp, const char *s)
 #if 0
 static void init_queue(query* q)
 {
-	free(q->queue[0]);
-	q->queue[0] = NULL;
-	q->qp[0] = 0;
+	free(q->queues[0].queue);
+	q->queues[0].queue = NULL;
+	q->queues[0].qp = 0;
 }
 #endif
 
-static idx_t queue_used(const query *q) { return q->qp[0]; }
-static cell *get_queue(query *q) { return q->queue[0]; }
+static idx_t queue_used(const query *q) { return q->queues[0].qp; }
+static cell *get_queue(query *q) { return q->queues[0].queue; }
 
 static cell *pop_queue(query *q)
 {
-	if (!q->qp[0])
+	if (!q->queues[0].qp)
 		return NULL;
 
-	cell *c = q->queue[0] + q->popp;
+	cell *c = q->queues[0].queue + q->popp;
 	q->popp += c->nbr_cells;
 
-	if (q->popp == q->qp[0])
-		q->popp = q->qp[0] = 0;
+	if (q->popp == q->queues[0].qp)
+		q->popp = q->queues[0].qp = 0;
 
 	return c;
 }
 
 static void init_queuen(query* q)
 {
-	free(q->queue[q->st.qnbr]);
-	q->queue[q->st.qnbr] = NULL;
-	q->qp[q->st.qnbr] = 0;
+	collector *qu = q->queues + q->st.qnbr;
+	free(qu->queue);
+	qu->queue = NULL;
+	qu->qp = qu->nbr_vars = 0;
 }
 
-static idx_t queuen_used(const query *q) { return q->qp[q->st.qnbr]; }
-static cell *get_queuen(query *q) { return q->queue[q->st.qnbr]; }
+static idx_t queuen_used(const query *q) { return q->queues[q->st.qnbr].qp; }
+static cell *get_queuen(query *q) { return q->queues[q->st.qnbr].queue; }
+
+// Each findall/bagof in progress collects into its own queue, the
+// stack of these grows as calls nest...
+
+static USE_RESULT pl_status push_queuen(query *q)
+{
+	if ((q->st.qnbr+1) >= q->queues_size) {
+		idx_t nbr = q->queues_size * 2;
+		collector *queues = realloc(q->queues, sizeof(collector)*nbr);
+		may_ptr_error(queues);
+		memset(queues+q->queues_size, 0, sizeof(collector)*(nbr-q->queues_size));
+		q->queues = queues;
+		q->queues_size = nbr;
+	}
+
+	q->st.qnbr++;
+	init_queuen(q);
+	free(q->queues[q->st.qnbr].tmpq);
+	q->queues[q->st.qnbr].tmpq = NULL;
+	return pl_success;
+}
 
 // Defer check until end_list()
 
@@ -1478,7 +1500,7 @@ static void compare_and_zero(uint64_t v1, uint64_t *v2, uint64_t *v)
 
 #define MASK_FINAL 0x0000FFFFFFFFFFFF // Final 48 bits
 
-static void uuid_gen(prolog *pl, uuid *u)
+void uuid_gen(prolog *pl, uuid *u)
 {
 #ifdef NDEBUG
 	if (!pl->seed)
@@ -1580,8 +1602,8 @@ static USE_RESULT pl_status do_retract(query *q, cell *p1, idx_t p1_ctx, int is_
 		return match;
 
 	clause *r = q->st.curr_clause2;
-	bool last_match = !q->st.curr_clause2->next && (is_retract == DO_RETRACT);
-	stash_me(q, &r->t, last_match);
+	bool last_match = !has_next_key(q, r) && (is_retract == DO_RETRACT);
+	stash_me(q, r, last_match);
 	add_to_dirty_list(q, r);
 
 	if (!q->m->loading && r->t.persist)
@@ -1590,259 +1612,115 @@ static USE_RESULT pl_status do_retract(query *q, cell *p1, idx_t p1_ctx, int is_
 	return pl_success;
 }
 
-static void add_stream_properties(query *q, int n)
-{
-	stream *str = &g_streams[n];
-	char tmpbuf[1024*8];
-	char *dst = tmpbuf;
-	*dst = '\0';
-	off_t pos = ftello(str->fp);
-	bool at_end_of_file = false;
-
-	if (!str->at_end_of_file && (n > 2)) {
-		if (str->p) {
-			if (str->p->srcptr && *str->p->srcptr) {
-				int ch = get_char_utf8((const char**)&str->p->srcptr);
-				str->ungetch = ch;
-			}
-		}
+static const char *s_properties[] = {
+	"alias", "file_name", "mode", "encoding", "type", "line_count",
+	"position", "reposition", "end_of_stream", "eof_action",
+	"input", "output", "newline", NULL
+};
 
-		int ch = str->ungetch ? str->ungetch : net_getc(str);
+// Peeking at a socket would block, so only files are looked ahead...
 
-		if (str->ungetch)
-			;
-		else if (feof(str->fp) || ferror(str->fp)) {
-			clearerr(str->fp);
+static bool is_at_end_of_file(stream *str, int n)
+{
+	if (str->at_end_of_file || (n <= 2) || str->socket)
+		return false;
 
-			if (str->eof_action != eof_action_reset)
-				at_end_of_file = true;
-		} else
+	if (str->p) {
+		if (str->p->srcptr && *str->p->srcptr) {
+			int ch = get_char_utf8((const char**)&str->p->srcptr);
 			str->ungetch = ch;
+		}
 	}
 
-	dst += snprintf(dst, sizeof(tmpbuf)-strlen(tmpbuf), "'$stream_property'(%d, alias('%s')).\n", n, str->name);
-	dst += snprintf(dst, sizeof(tmpbuf)-strlen(tmpbuf), "'$stream_property'(%d, file_name('%s')).\n", n, str->filename);
-	dst += snprintf(dst, sizeof(tmpbuf)-strlen(tmpbuf), "'$stream_property'(%d, mode(%s)).\n", n, str->mode);
-	dst += snprintf(dst, sizeof(tmpbuf)-strlen(tmpbuf), "'$stream_property'(%d, encoding(%s)).\n", n, "utf8");
-	dst += snprintf(dst, sizeof(tmpbuf)-strlen(tmpbuf), "'$stream_property'(%d, type(%s)).\n", n, str->binary ? "binary" : "text");
-	dst += snprintf(dst, sizeof(tmpbuf)-strlen(tmpbuf), "'$stream_property'(%d, line_count(%i)).\n", n, str->p ? str->p->line_nbr : 1);
-	dst += snprintf(dst, sizeof(tmpbuf)-strlen(tmpbuf), "'$stream_property'(%d, position(%llu)).\n", n, (unsigned long long)(pos != -1 ? pos : 0));
-	dst += snprintf(dst, sizeof(tmpbuf)-strlen(tmpbuf), "'$stream_property'(%d, reposition(%s)).\n", n, (n < 3) || str->socket ? "false" : "true");
-	dst += snprintf(dst, sizeof(tmpbuf)-strlen(tmpbuf), "'$stream_property'(%d, end_of_stream(%s)).\n", n, str->at_end_of_file ? "past" : at_end_of_file ? "at" : "not");
-	dst += snprintf(dst, sizeof(tmpbuf)-strlen(tmpbuf), "'$stream_property'(%d, eof_action(%s)).\n", n, str->eof_action == eof_action_eof_code ? "eof_code" : str->eof_action == eof_action_error ? "error" : str->eof_action == eof_action_reset ? "reset" : "none");
+	int ch = str->ungetch ? str->ungetch : net_getc(str);
 
-	if (!strcmp(str->mode, "read"))
-		dst += snprintf(dst, sizeof(tmpbuf)-strlen(tmpbuf), "'$stream_property'(%d, input).\n", n);
-	else
-		dst += snprintf(dst, sizeof(tmpbuf)-strlen(tmpbuf), "'$stream_property'(%d, output).\n", n);
+	if (str->ungetch)
+		;
+	else if (feof(str->fp) || ferror(str->fp)) {
+		clearerr(str->fp);
 
-#ifdef _WIN32
-	dst += snprintf(dst, sizeof(tmpbuf)-strlen(tmpbuf), "'$stream_property'(%d, newline(dos)).\n", n);
-#else
-	dst += snprintf(dst, sizeof(tmpbuf)-strlen(tmpbuf), "'$stream_property'(%d, newline(posix)).\n", n);
-#endif
+		if (str->eof_action != eof_action_reset)
+			return true;
+	} else
+		str->ungetch = ch;
 
-	parser *p = create_parser(q->m);
-	p->srcptr = tmpbuf;
-	p->consulting = true;
-	parser_tokenize(p, false, false);
-	destroy_parser(p);
+	return false;
 }
 
-static void del_stream_properties(query *q, int n)
+static bool has_stream_property(const stream *str, const char *name)
 {
-	cell *tmp = alloc_on_heap(q, 3);
-	make_literal(tmp+0, g_stream_property_s);
-	make_int(tmp+1, n);
-	make_variable(tmp+2, g_anon_s);
-	tmp[2].var_nbr = create_vars(q, 1);
-	tmp->nbr_cells = 3;
-	tmp->arity = 2;
-	q->retry = QUERY_OK;
+	if (!strcmp(name, "alias"))
+		return str->name;
 
-	predicate *h = find_matching_predicate(q->m, tmp);
+	if (!strcmp(name, "file_name"))
+		return str->filename;
 
-	if (!h) {
-		DISCARD_RESULT throw_error(q, tmp, "existence_error", "procedure");
-		return;
-	}
-
-	while (do_retract(q, tmp, q->st.curr_frame, DO_STREAM_RETRACT)) {
-		if (q->did_throw)
-			return;
+	if (!strcmp(name, "input"))
+		return !strcmp(str->mode, "read");
 
-		q->retry = QUERY_RETRY;
-		retry_choice(q);
-	}
+	if (!strcmp(name, "output"))
+		return strcmp(str->mode, "read");
 
-	q->retry = QUERY_OK;
+	return true;
 }
 
-static USE_RESULT pl_status do_stream_property(query *q)
+static cell *make_stream_property(query *q, int n, const char *name)
 {
-	GET_FIRST_ARG(pstr,any);
-	GET_NEXT_ARG(p1,any);
-	int n = get_stream(q, pstr);
 	stream *str = &g_streams[n];
-	cell *c = p1 + 1;
-	c = deref(q, c, p1_ctx);
-
-	if (!strcmp(GET_STR(p1), "file_name")) {
-		cell tmp;
-		may_error(make_cstring(&tmp, str->filename));
-		pl_status ok = unify(q, c, q->latest_ctx, &tmp, q->st.curr_frame);
-		DECR_REF(&tmp);
-		return ok;
-	}
-
-	if (!strcmp(GET_STR(p1), "alias")) {
-		cell tmp;
-		may_error(make_cstring(&tmp, str->name));
-		pl_status ok = unify(q, c, q->latest_ctx, &tmp, q->st.curr_frame);
-		DECR_REF(&tmp);
-		return ok;
-	}
-
-	if (!strcmp(GET_STR(p1), "mode")) {
-		cell tmp;
-		may_error(make_cstring(&tmp, str->mode));
-		pl_status ok = unify(q, c, q->latest_ctx, &tmp, q->st.curr_frame);
-		DECR_REF(&tmp);
-		return ok;
-	}
-
-	if (!strcmp(GET_STR(p1), "type")) {
-		cell tmp;
-		may_error(make_cstring(&tmp, str->binary ? "binary" : "text"));
-		pl_status ok = unify(q, c, q->latest_ctx, &tmp, q->st.curr_frame);
-		DECR_REF(&tmp);
-		return ok;
-	}
+	bool is_flag = !strcmp(name, "input") || !strcmp(name, "output");
+	cell *tmp = alloc_on_heap(q, is_flag ? 1 : 2);
+	if (!tmp) return NULL;
+	make_literal(tmp, index_from_pool(q->m->pl, name));
 
-	if (!strcmp(GET_STR(p1), "reposition")) {
-		cell tmp;
-		may_error(make_cstring(&tmp, str->socket || (n <= 2) ? "false" : "true"));
-		pl_status ok = unify(q, c, q->latest_ctx, &tmp, q->st.curr_frame);
-		DECR_REF(&tmp);
-		return ok;
-	}
+	if (is_flag)
+		return tmp;
 
-	if (!strcmp(GET_STR(p1), "encoding")) {
-		cell tmp;
-		may_error(make_cstring(&tmp, "utf8"));
-		pl_status ok = unify(q, c, q->latest_ctx, &tmp, q->st.curr_frame);
-		DECR_REF(&tmp);
-		return ok;
-	}
+	tmp->arity = 1;
+	tmp->nbr_cells = 2;
+	cell *c = tmp + 1;
+	const char *val = NULL;
 
-	if (!strcmp(GET_STR(p1), "newline")) {
-		cell tmp;
+	if (!strcmp(name, "alias")) {
+		if (make_cstring(c, str->name) != pl_success)
+			return NULL;
+	} else if (!strcmp(name, "file_name")) {
+		if (make_cstring(c, str->filename) != pl_success)
+			return NULL;
+	} else if (!strcmp(name, "mode")) {
+		if (make_cstring(c, str->mode) != pl_success)
+			return NULL;
+	} else if (!strcmp(name, "line_count"))
+		make_int(c, str->p ? str->p->line_nbr : 1);
+	else if (!strcmp(name, "position")) {
+		off_t pos = ftello(str->fp);
+		make_int(c, pos != -1 ? pos : 0);
+	} else if (!strcmp(name, "encoding"))
+		val = "utf8";
+	else if (!strcmp(name, "type"))
+		val = str->binary ? "binary" : "text";
+	else if (!strcmp(name, "reposition"))
+		val = (n <= 2) || str->socket ? "false" : "true";
+	else if (!strcmp(name, "end_of_stream"))
+		val = str->at_end_of_file ? "past" : is_at_end_of_file(str, n) ? "at" : "not";
+	else if (!strcmp(name, "eof_action"))
+		val = str->eof_action == eof_action_eof_code ? "eof_code"
+			: str->eof_action == eof_action_error ? "error"
+			: str->eof_action == eof_action_reset ? "reset" : "none";
+	else if (!strcmp(name, "newline"))
 #ifdef _WIN32
-		may_error(make_cstring(&tmp, "dos"));
+		val = "dos";
 #else
-		may_error(make_cstring(&tmp, "unix"));
+		val = "posix";
 #endif
-		pl_status ok = unify(q, c, q->latest_ctx, &tmp, q->st.curr_frame);
-		DECR_REF(&tmp);
-		return ok;
-	}
-
-	if (!strcmp(GET_STR(p1), "input"))
-		return !strcmp(str->mode, "read");
-
-	if (!strcmp(GET_STR(p1), "output"))
-		return strcmp(str->mode, "read");
-
-	if (!strcmp(GET_STR(p1), "eof_action") && is_stream(pstr)) {
-		cell tmp;
-
-		if (str->eof_action == eof_action_eof_code)
-			make_literal(&tmp, index_from_pool(q->m->pl, "eof_code"));
-		else if (str->eof_action == eof_action_error)
-			make_literal(&tmp, index_from_pool(q->m->pl, "error"));
-		else if (str->eof_action == eof_action_reset)
-			make_literal(&tmp, index_from_pool(q->m->pl, "reset"));
-		else
-			make_literal(&tmp, index_from_pool(q->m->pl, "none"));
-
-		return unify(q, c, q->latest_ctx, &tmp, q->st.curr_frame);
-	}
-
-	if (!strcmp(GET_STR(p1), "end_of_stream") && is_stream(pstr)) {
-		bool at_end_of_file = false;
-
-		if (!str->at_end_of_file && (n > 2)) {
-			if (str->p) {
-				if (str->p->srcptr && *str->p->srcptr) {
-					int ch = get_char_utf8((const char**)&str->p->srcptr);
-					str->ungetch = ch;
-				}
-			}
-
-			int ch = str->ungetch ? str->ungetch : net_getc(str);
-
-			if (str->ungetch)
-				;
-			else if (feof(str->fp) || ferror(str->fp)) {
-				clearerr(str->fp);
-
-				if (str->eof_action != eof_action_reset)
-					at_end_of_file = true;
-			} else
-				str->ungetch = ch;
-		}
-
-		cell tmp;
-
-		if (str->at_end_of_file)
-			make_literal(&tmp, index_from_pool(q->m->pl, "past"));
-		else if (at_end_of_file)
-			make_literal(&tmp, index_from_pool(q->m->pl, "at"));
-		else
-			make_literal(&tmp, index_from_pool(q->m->pl, "not"));
-
-		return unify(q, c, q->latest_ctx, &tmp, q->st.curr_frame);
-	}
-
-	if (!strcmp(GET_STR(p1), "position") && !is_variable(pstr)) {
-		cell tmp;
-		make_int(&tmp, ftello(str->fp));
-		return unify(q, c, q->latest_ctx, &tmp, q->st.curr_frame);
-	}
-
-	if (!strcmp(GET_STR(p1), "line_count") && !is_variable(pstr)) {
-		cell tmp;
-		make_int(&tmp, str->p?str->p->line_nbr:1);
-		return unify(q, c, q->latest_ctx, &tmp, q->st.curr_frame);
-	}
-
-	return pl_failure;
-}
-
-static void clear_streams_properties(query *q)
-{
-	cell tmp;
-	make_literal(&tmp, g_stream_property_s);
-	tmp.nbr_cells = 1;
-	tmp.arity = 2;
-
-	predicate *h = find_matching_predicate(q->m, &tmp);
 
-	if (h) {
-		for (clause *r = h->head; r;) {
-			clause *save = r->next;
-			add_to_dirty_list(q, r);
-			r = save;
-		}
+	if (val)
+		make_literal(c, index_from_pool(q->m->pl, val));
 
-		h->cnt = 0;
-	}
+	return tmp;
 }
 
-static const char *s_properties =
-	"alias,file_name,mode,encoding,type,line_count,"			\
-	"position,reposition,end_of_stream,eof_action,"				\
-	"input,output,newline";
+// Properties are enumerated natively: the outer choice holds the
+// (stream, property) cursor and each answer gets its own choice...
 
 static USE_RESULT pl_status fn_iso_stream_property_2(query *q)
 {
@@ -1862,43 +1740,77 @@ static USE_RESULT pl_status fn_iso_stream_property_2(query *q)
 	if (!is_variable(p1) && !is_callable(p1))
 		return throw_error(q, p1, "domain_error", "stream_property");
 
-	if (!is_variable(pstr) && !is_variable(p1))
-		return do_stream_property(q);
+	if (is_callable(p1)) {
+		unsigned j = 0;
 
-	if (!q->retry) {
-		clear_streams_properties(q);
+		while (s_properties[j] && strcmp(s_properties[j], GET_STR(p1)))
+			j++;
 
-		for (int i = 0; i < MAX_STREAMS; i++) {
-			if (!g_streams[i].fp)
-				continue;
+		if (!s_properties[j])
+			return throw_error(q, p1, "domain_error", "stream_property");
+	}
 
-			stream *str = &g_streams[i];
+	if (!is_variable(pstr) && !is_variable(p1)) {
+		int n = get_stream(q, pstr);
 
-			if (!str->socket)
-				add_stream_properties(q, i);
-		}
+		if (!has_stream_property(&g_streams[n], GET_STR(p1)))
+			return pl_failure;
+
+		cell *c = make_stream_property(q, n, GET_STR(p1));
+		may_ptr_error(c);
+		return unify(q, p1, p1_ctx, c, q->st.curr_frame);
 	}
 
-	cell *tmp = deep_clone_to_tmp(q, q->st.curr_cell, q->st.curr_frame);
-	tmp->val_off = g_stream_property_s;
+	int n = is_variable(pstr) ? -1 : get_stream(q, pstr);
+	idx_t i = n < 0 ? 0 : n, j = 0;
+
+	if (!q->retry)
+		may_error(make_choice(q));
+	else
+		get_params(q, &i, &j);
+
+	for (; (i < MAX_STREAMS) && ((n < 0) || (i == (idx_t)n)); i++, j = 0) {
+		stream *str = &g_streams[i];
 
-	if (!match_clause(q, tmp, q->st.curr_frame, DO_CLAUSE)) {
-		clear_streams_properties(q);
+		if (!str->fp || ((n < 0) && str->socket))
+			continue;
 
-		if (is_callable(p1) && !strstr(s_properties, GET_STR(p1)))
-			return throw_error(q, p1, "domain_error", "stream_property");
+		for (; s_properties[j]; j++) {
+			const char *name = s_properties[j];
 
-		return pl_failure;
-	}
+			if (is_callable(p1) && strcmp(GET_STR(p1), name))
+				continue;
 
-	term *t = &q->st.curr_clause2->t;
-	GET_FIRST_ARG(pstrx,any);
+			if (!has_stream_property(str, name))
+				continue;
 
-	if (is_integer(pstrx))
-		pstrx->flags |= FLAG_STREAM | FLAG_HEX;
+			set_params(q, i, j+1);
+			may_error(make_choice(q));
+			cell *c = make_stream_property(q, i, name);
+			may_ptr_error(c);
 
-	stash_me(q, t, false);
-	return pl_success;
+			if (!unify(q, p1, p1_ctx, c, q->st.curr_frame)) {
+				retry_choice(q);
+				continue;
+			}
+
+			if (n < 0) {
+				cell tmp;
+				make_int(&tmp, i);
+				tmp.flags |= FLAG_STREAM | FLAG_HEX;
+
+				if (!unify(q, pstr, pstr_ctx, &tmp, q->st.curr_frame)) {
+					retry_choice(q);
+					continue;
+				}
+			}
+
+			return pl_success;
+		}
+	}
+
+	drop_choice(q);
+	return pl_failure;
 }
 
 static USE_RESULT pl_status fn_iso_open_3(query *q)
@@ -2149,9 +2061,6 @@ static USE_RESULT pl_status fn_iso_close_1(query *q)
 	if (str->p)
 		destroy_parser(str->p);
 
-	if (!str->socket)
-		del_stream_properties(q, n);
-
 	net_close(str);
 	free(str->filename);
 	free(str->mode);
@@ -4137,7 +4046,7 @@ static USE_RESULT pl_status fn_iso_univ_2(query *q)
 		bool found = false;
 
 		if (is_callable(tmp)) {
-			if ((tmp->fn = get_builtin(q->m->pl, GET_STR(tmp), tmp->arity, &found)), found)
+			if ((tmp->fn = get_builtin_term(q->m->pl, tmp, tmp->arity, &found)), found)
 				tmp->flags |= FLAG_BUILTIN;
 			else {
 				tmp->match = find_matching_predicate_quiet(q->m, tmp);
@@ -4423,8 +4332,8 @@ static USE_RESULT pl_status fn_iso_clause_2(query *q)
 		}
 
 		if (ok) {
-			bool last_match = !q->st.curr_clause2->next;
-			stash_me(q, t, last_match);
+			bool last_match = !has_next_key(q, q->st.curr_clause2);
+			stash_me(q, q->st.curr_clause2, last_match);
 			return pl_success;
 		}
 
@@ -4450,7 +4359,7 @@ static USE_RESULT pl_status do_retractall(query *q, cell *p1, idx_t p1_ctx)
 		cell *head = get_head(p1);
 		bool found = false;
 
-		if (get_builtin(q->m->pl, GET_STR(head), head->arity, &found), found)
+		if (get_builtin_term(q->m->pl, head, head->arity, &found), found)
 			return throw_error(q, head, "permission_error", "modify,static_procedure");
 
 		return pl_success;
@@ -4488,11 +4397,12 @@ static USE_RESULT pl_status do_abolish(query *q, cell *c_orig, cell *c, bool har
 		add_to_dirty_list(q, r);
 	}
 
-	if (hard)
+	if (hard) {
 		h->is_abolished = true;
+		invalidate_pred_cache(q->m->pl);
+	}
 
-	sl_destroy(h->index);
-	h->index = NULL;
+	drop_index(q->m, h);
 	h->cnt = 0;
 	return pl_success;
 }
@@ -4532,7 +4442,7 @@ static USE_RESULT pl_status fn_iso_abolish_1(query *q)
 
 	bool found = false;
 
-	if (get_builtin(q->m->pl, GET_STR(p1_name), p1_arity->val_num, &found), found)
+	if (get_builtin_term(q->m->pl, p1_name, p1_arity->val_num, &found), found)
 		return throw_error(q, p1, "permission_error", "modify,static_procedure");
 
 	cell tmp;
@@ -4604,7 +4514,7 @@ static USE_RESULT pl_status fn_iso_asserta_1(query *q)
 
 	bool found = false;
 
-	if (get_builtin(q->m->pl, GET_STR(head), head->arity, &found), found)
+	if (get_builtin_term(q->m->pl, head, head->arity, &found), found)
 		return throw_error(q, head, "permission_error", "modify,static_procedure");
 
 	cell *tmp2, *body = get_body(p1);
@@ -4646,7 +4556,6 @@ static USE_RESULT pl_status fn_iso_asserta_1(query *q)
 
 	clause *r = asserta_to_db(q->m, p->t, 0);
 	may_ptr_error(r);
-	uuid_gen(q->m->pl, &r->u);
 
 	if (!q->m->loading && r->t.persist)
 		db_log(q, r, LOG_ASSERTA);
@@ -4664,7 +4573,7 @@ static USE_RESULT pl_status fn_iso_assertz_1(query *q)
 
 	bool found = false;
 
-	if (get_builtin(q->m->pl, GET_STR(head), head->arity, &found), found)
+	if (get_builtin_term(q->m->pl, head, head->arity, &found), found)
 		return throw_error(q, head, "permission_error", "modify,static_procedure");
 
 	cell *tmp2, *body = get_body(p1);
@@ -4706,7 +4615,6 @@ static USE_RESULT pl_status fn_iso_assertz_1(query *q)
 
 	clause *r = assertz_to_db(q->m, p->t, 0);
 	may_ptr_error(r);
-	uuid_gen(q->m->pl, &r->u);
 
 	if (!q->m->loading && r->t.persist)
 		db_log(q, r, LOG_ASSERTZ);
@@ -4801,7 +4709,7 @@ static USE_RESULT pl_status fn_sys_call_n(query *q)
 
 	bool found = false;
 
-	if ((tmp2->fn = get_builtin(q->m->pl, GET_STR(tmp2), arity, &found)), found) {
+	if ((tmp2->fn = get_builtin_term(q->m->pl, tmp2, arity, &found)), found) {
 		tmp2->flags |= FLAG_BUILTIN;
 		unsigned specifier;
 
@@ -5099,6 +5007,28 @@ static USE_RESULT pl_status fn_iso_throw_1(query *q)
 	return fn_iso_catch_3(q);
 }
 
+// A '$' helper is reported as the predicate it implements, if there
+// is one of that name and arity...
+
+static bool is_public_name(query *q, const char *name, unsigned arity)
+{
+	idx_t off = is_in_pool(q->m->pl, name);
+
+	if (!*name || (off == ERR_IDX))
+		return false;
+
+	bool found = false;
+
+	if (get_builtin(q->m->pl, name, arity, &found), found)
+		return true;
+
+	cell tmp = (cell){0};
+	tmp.val_type = TYPE_LITERAL;
+	tmp.val_off = off;
+	tmp.arity = arity;
+	return find_predicate(q->m, &tmp) != NULL;
+}
+
 pl_status throw_error(query *q, cell *c, const char *err_type, const char *expected)
 {
 	q->did_throw = true;
@@ -5132,13 +5062,20 @@ pl_status throw_error(query *q, cell *c, const char *err_type, const char *expec
 
 	expected = tmpbuf;
 	char functor[1024];
+	const char *name = GET_STR(q->st.curr_cell);
+	size_t name_len = LEN_STR(q->st.curr_cell);
+
+	if ((name[0] == '$') && is_public_name(q, name+1, q->st.curr_cell->arity)) {
+		name++;
+		name_len--;
+	}
 
-	if (needs_quoting(q->m, GET_STR(q->st.curr_cell), LEN_STR(q->st.curr_cell))) {
+	if (needs_quoting(q->m, name, name_len)) {
 		char tmpbuf[1024-3];
-		formatted(tmpbuf, sizeof(tmpbuf), GET_STR(q->st.curr_cell), LEN_STR(q->st.curr_cell), false);
+		formatted(tmpbuf, sizeof(tmpbuf), name, name_len, false);
 		snprintf(functor, sizeof(functor), "'%s'", tmpbuf);
 	} else
-		snprintf(functor, sizeof(functor), "%s", GET_STR(q->st.curr_cell));
+		snprintf(functor, sizeof(functor), "%s", name);
 
 	if (is_variable(c)) {
 		err_type = "instantiation_error";
@@ -5174,14 +5111,7 @@ pl_status throw_error(query *q, cell *c, const char *err_type, const char *expec
 		snprintf(dst2, len2+1, "error(%s(%s,(%s)),(%s)/%u).", err_type, expected, dst, GET_STR(q->st.curr_cell), q->st.curr_cell->arity);
 
 	} else {
-		if (!strcmp(GET_STR(q->st.curr_cell), "$call"))
-			snprintf(dst2, len2+1, "error(%s(%s,(%s)),%s/%u).", err_type, expected, dst, "call", q->st.curr_cell->arity);
-		else if (!strcmp(GET_STR(q->st.curr_cell), "$catch"))
-			snprintf(dst2, len2+1, "error(%s(%s,(%s)),%s/%u).", err_type, expected, dst, "catch", q->st.curr_cell->arity);
-		else if (!strcmp(GET_STR(q->st.curr_cell), "$bagof"))
-			snprintf(dst2, len2+1, "error(%s(%s,(%s)),(%s)/%u).", err_type, expected, dst, "bagof", q->st.curr_cell->arity);
-		else
-			snprintf(dst2, len2+1, "error(%s(%s,(%s)),(%s)/%u).", err_type, expected, dst, functor, q->st.curr_cell->arity);
+		snprintf(dst2, len2+1, "error(%s(%s,(%s)),(%s)/%u).", err_type, expected, dst, functor, q->st.curr_cell->arity);
 	}
 
 	//printf("*** %s\n", dst2);
@@ -5468,6 +5398,15 @@ static USE_RESULT pl_status fn_iso_current_prolog_flag_2(query *q)
 		else
 			make_literal(&tmp, g_off_s);
 
+		return unify(q, p2, p2_ctx, &tmp, q->st.curr_frame);
+	} else if (!strcmp(GET_STR(p1), "atom_gc")) {
+		cell tmp;
+
+		if (q->m->flag.atom_gc)
+			make_literal(&tmp, g_true_s);
+		else
+			make_literal(&tmp, g_false_s);
+
 		return unify(q, p2, p2_ctx, &tmp, q->st.curr_frame);
 	} else if (!strcmp(GET_STR(p1), "character_escapes")) {
 		cell tmp;
@@ -5675,6 +5614,18 @@ static USE_RESULT pl_status fn_iso_set_prolog_flag_2(query *q)
 			tmp[2] = *p2; tmp[2].nbr_cells = 1;
 			return throw_error(q, tmp, "domain_error", "flag_value");
 		}
+	} else if (!strcmp(GET_STR(p1), "atom_gc")) {
+		if (!strcmp(GET_STR(p2), "true") || !strcmp(GET_STR(p2), "on"))
+			q->m->flag.atom_gc = true;
+		else if (!strcmp(GET_STR(p2), "false") || !strcmp(GET_STR(p2), "off"))
+			q->m->flag.atom_gc = false;
+		else {
+			cell *tmp = alloc_on_heap(q, 3);
+			make_structure(tmp, g_plus_s, fn_iso_add_2, 2, 2);
+			tmp[1] = *p1; tmp[1].nbr_cells = 1;
+			tmp[2] = *p2; tmp[2].nbr_cells = 1;
+			return throw_error(q, tmp, "domain_error", "flag_value");
+		}
 	} else if (!strcmp(GET_STR(p1), "debug")) {
 		if (!strcmp(GET_STR(p2), "true") || !strcmp(GET_STR(p2), "on"))
 			q->m->flag.debug = true;
@@ -5785,161 +5736,569 @@ static USE_RESULT pl_status fn_sys_queuen_2(query *q)
 {
 	GET_FIRST_ARG(p1,integer);
 	GET_NEXT_ARG(p2,any);
-	cell *tmp = deep_clone_to_tmp(q, p2, p2_ctx);
+	cell *tmp = deep_raw_copy_to_tmp(q, p2, p2_ctx);
 	may_ptr_error(tmp);
 
 	if (tmp == ERR_CYCLE_CELL)
 		return throw_error(q, p1, "resource_error", "cyclic_term");
 
 	alloc_on_queuen(q, p1->val_num, tmp);
+	q->queues[p1->val_num].nbr_vars += q->m->pl->varno;
 	return pl_success;
 }
 
-static int collect_local_vars(cell *p1, idx_t nbr_cells, cell **slots)
+// Sorting copies the list elements into an array, does a stable
+// merge sort on it with compare() and builds the result in one go.
+// Elements are referenced in place where their cells can be read in
+// the current frame (atomic, ground as stored, or already local)...
+
+typedef struct {
+	cell *c, *key;
+	idx_t c_ctx, key_ctx;
+	cell tmp;
+} sort_entry;
+
+static int sort_compare(query *q, const sort_entry *e1, const sort_entry *e2, bool ascending)
 {
-	int cnt = 0;
+	int res = compare(q, e1->key, e1->key_ctx, e2->key, e2->key_ctx, 0);
+	return ascending ? res : -res;
+}
 
-	for (idx_t i = 0; i < nbr_cells; i++, p1++) {
-		if (is_variable(p1)) {
-			assert(p1->var_nbr < MAX_ARITY);
+static sort_entry **merge_sort(query *q, sort_entry **base, sort_entry **work, size_t cnt, bool ascending)
+{
+	for (size_t width = 1; width < cnt; width *= 2) {
+		for (size_t lo = 0; lo < cnt; lo += width * 2) {
+			size_t mid = lo + width < cnt ? lo + width : cnt;
+			size_t hi = lo + width * 2 < cnt ? lo + width * 2 : cnt;
+			size_t i = lo, j = mid, k = lo;
 
-			if (!slots[p1->var_nbr]) {
-				slots[p1->var_nbr] = p1;
-				cnt++;
+			while ((i < mid) && (j < hi)) {
+				if (sort_compare(q, base[i], base[j], ascending) <= 0)
+					work[k++] = base[i++];
+				else
+					work[k++] = base[j++];
 			}
+
+			while (i < mid)
+				work[k++] = base[i++];
+
+			while (j < hi)
+				work[k++] = base[j++];
 		}
+
+		sort_entry **tmp = base;
+		base = work;
+		work = tmp;
 	}
 
-	return cnt;
+	return base;
 }
 
-static uint64_t get_vars(cell *p, __attribute__((unused)) idx_t p_ctx)
+static bool has_var_cells(const cell *c)
 {
-	cell *slots[MAX_ARITY] = {0};
-	int cnt = collect_local_vars(p, p->nbr_cells, slots);
-	uint64_t mask = 0;
-
-	if (cnt) {
-		for (unsigned i = 0; i < MAX_ARITY; i++) {
-			if (slots[i])
-				mask |= 1ULL << i;
-		}
+	for (idx_t i = 0; i < c->nbr_cells; i++) {
+		if (is_variable(c+i))
+			return true;
 	}
 
-	return mask;
+	return false;
 }
 
-static cell *skip_existentials(query *q, cell *p2, uint64_t *xs)
+// Make each sorted element readable in the current frame: clone
+// terms that are ground only through bindings and point a fresh
+// local variable at anything else. If that would take the frame
+// past MAX_VARS nothing is done and too_many is set instead...
+
+static pl_status localize_entries(query *q, sort_entry **base, size_t cnt, bool *too_many)
 {
-	while (is_structure(p2) && !strcmp(GET_STR(p2), "^")) {
-		cell *c = ++p2;
-		assert(c->var_nbr < 64);
+	unsigned nbr = 0;
 
-		if (is_variable(c))
-			*xs |= 1ULL << c->var_nbr;
+	for (size_t i = 0; i < cnt; i++) {
+		sort_entry *e = base[i];
 
-		p2 += c->nbr_cells;
-	}
+		if (!is_structure(e->c) && !is_variable(e->c))
+			continue;
 
-	return p2;
-}
+		if (e->c_ctx == q->st.curr_frame)
+			continue;
 
-static void pin_vars(query *q, uint64_t mask)
-{
-	choice *ch = GET_CURR_CHOICE();
-	ch->pins = mask;
-}
+		if (is_variable(e->c) || has_vars(q, e->c, e->c_ctx, 0)) {
+			e->key = NULL;
+			nbr++;
+		}
+	}
 
-static void unpin_vars(query *q)
-{
-	choice *ch = GET_CURR_CHOICE();
 	frame *g = GET_CURR_FRAME();
-	uint64_t mask = 1;
 
-	for (unsigned i = 0; i < g->nbr_vars; i++, mask <<= 1) {
-		if (!(ch->pins & mask))
+	if (nbr && ((g->nbr_vars + nbr) >= MAX_VARS)) {
+		*too_many = true;
+		return pl_success;
+	}
+
+	for (size_t i = 0; i < cnt; i++) {
+		sort_entry *e = base[i];
+
+		if (!e->key || !is_structure(e->c))
+			continue;
+
+		if ((e->c_ctx == q->st.curr_frame) || !has_var_cells(e->c))
 			continue;
 
-		slot *e = GET_SLOT(g, i);
-		e->c.val_type = TYPE_EMPTY;
-		e->c.attrs = NULL;
+		cell *tmp = deep_clone_to_heap(q, e->c, e->c_ctx);
+		may_ptr_error(tmp);
+		if (tmp == ERR_CYCLE_CELL) {
+			q->latest_ctx = e->c_ctx;
+			return throw_error(q, e->c, "resource_error", "cyclic_term");
+		}
+
+		e->c = tmp;
+		e->c_ctx = q->st.curr_frame;
 	}
 
-	ch->pins = 0;
-}
+	if (!nbr)
+		return pl_success;
 
-static USE_RESULT pl_status fn_sys_findall_3(query *q)
-{
-	GET_FIRST_ARG(p1,any);
-	GET_NEXT_ARG(p2,callable);
-	GET_NEXT_ARG(p3,list_or_nil_or_var);
+	unsigned var_nbr = create_vars(q, nbr);
 
-	if (is_list(p3) && !is_valid_list(q, p3, p3_ctx, true))
-		return throw_error(q, p3, "type_error", "list");
+	if (q->error)
+		return pl_error;
 
-	if (!q->retry) {
-		q->st.qnbr++;
-		assert(q->st.qnbr < MAX_QUEUES);
-		cell *tmp = clone_to_heap(q, true, p2, 2+p1->nbr_cells+1);
-		idx_t nbr_cells = 1 + p2->nbr_cells;
-		make_structure(tmp+nbr_cells++, g_sys_queue_s, fn_sys_queuen_2, 2, 1+p1->nbr_cells);
-		make_int(tmp+nbr_cells++, q->st.qnbr);
-		nbr_cells += safe_copy_cells(tmp+nbr_cells, p1, p1->nbr_cells);
-		make_structure(tmp+nbr_cells, g_fail_s, fn_iso_fail_0, 0, 0);
-		init_queuen(q);
-		free(q->tmpq[q->st.qnbr]);
-		q->tmpq[q->st.qnbr] = NULL;
-		may_error(make_barrier(q));
-		q->st.curr_cell = tmp;
+	for (size_t i = 0; i < cnt; i++) {
+		sort_entry *e = base[i];
+
+		if (e->key)
+			continue;
+
+		cell tmp;
+		tmp.val_type = TYPE_VARIABLE;
+		tmp.nbr_cells = 1;
+		tmp.flags = FLAG2_FRESH;
+		tmp.val_off = g_anon_s;
+		tmp.var_nbr = var_nbr++;
+		tmp.arity = 0;
+		set_var(q, &tmp, q->st.curr_frame, e->c, e->c_ctx);
+		e->tmp = tmp;
+		e->c = &e->tmp;
+		e->c_ctx = q->st.curr_frame;
+	}
+
+	return pl_success;
+}
+
+static pl_status check_sorted(query *q, cell *p2, idx_t p2_ctx, bool keyed_pairs)
+{
+	if (is_variable(p2))
 		return pl_success;
+
+	if (!is_valid_list(q, p2, p2_ctx, true)) {
+		q->latest_ctx = p2_ctx;
+		return throw_error(q, p2, "type_error", "list");
 	}
 
-	if (!queuen_used(q)) {
-		q->st.qnbr--;
+	LIST_HANDLER(p2);
+
+	while (keyed_pairs && is_list(p2)) {
+		cell *h = LIST_HEAD(p2);
+		h = deref(q, h, p2_ctx);
+
+		if (!is_variable(h) && (!is_literal(h) || (h->arity != 2) || (h->val_off != g_minus_s)))
+			return throw_error(q, h, "type_error", "pair");
+
+		p2 = LIST_TAIL(p2);
+		p2 = deref(q, p2, p2_ctx);
+		p2_ctx = q->latest_ctx;
+	}
+
+	return pl_success;
+}
+
+// Elements that are neither ground nor local each need a variable in
+// the current frame. When there are too many of those the call is
+// redone as '$sort'(Key, Order, List, Sorted), a merge sort in Prolog
+// that leaves every element in its own frame...
+
+static pl_status sort_in_prolog(query *q, unsigned key, bool ascending, bool dedup)
+{
+	cell *c = q->st.curr_cell;
+	cell *p1 = c + 1;
+
+	if (c->arity == 4) {
+		p1 += p1->nbr_cells;
+		p1 += p1->nbr_cells;
+	}
+
+	cell *p2 = p1 + p1->nbr_cells;
+	const char *order = ascending ? (dedup ? "@<" : "@=<") : (dedup ? "@>" : "@>=");
+	idx_t nbr_cells = 1 + 1 + 1 + p1->nbr_cells + p2->nbr_cells;
+	cell *tmp = alloc_on_heap(q, 1+nbr_cells+1);
+	may_ptr_error(tmp);
+
+	// Needed for follow() to work
+	*tmp = (cell){0};
+	tmp->val_type = TYPE_EMPTY;
+	tmp->nbr_cells = 1;
+	tmp->flags = FLAG_BUILTIN;
+
+	make_literal(tmp+1, index_from_pool(q->m->pl, "$sort"));
+	tmp[1].arity = 4;
+	tmp[1].nbr_cells = nbr_cells;
+	tmp[1].match = NULL;
+	make_int(tmp+2, key);
+	make_literal(tmp+3, index_from_pool(q->m->pl, order));
+	idx_t n = 4;
+	n += safe_copy_cells(tmp+n, p1, p1->nbr_cells);
+	n += safe_copy_cells(tmp+n, p2, p2->nbr_cells);
+	make_call(q, tmp+n);
+	q->st.curr_cell = tmp;
+	return pl_success;
+}
+
+// With key 0 elements compare as a whole, otherwise on that argument.
+// Keyed pairs (keysort) compare on the key of Key-Value...
+
+static pl_status do_sort(query *q, cell *p1, idx_t p1_ctx, cell *p2, idx_t p2_ctx, unsigned key, bool ascending, bool dedup, bool keyed_pairs)
+{
+	if (is_variable(p1))
+		return throw_error(q, p1, "instantiation_error", "not_sufficiently_instantiated");
+
+	bool partial = is_valid_list(q, p1, p1_ctx, true) && !is_valid_list(q, p1, p1_ctx, false);
+	q->latest_ctx = p1_ctx;
+
+	if (partial)
+		return throw_error(q, p1, "instantiation_error", "tail_is_a_variable");
+
+	if (!is_valid_list(q, p1, p1_ctx, false)) {
+		q->latest_ctx = p1_ctx;
+		return throw_error(q, p1, "type_error", "list");
+	}
+
+	pl_status ok = check_sorted(q, p2, p2_ctx, keyed_pairs);
+
+	if (!ok || q->did_throw)
+		return ok;
+
+	size_t cnt = 0;
+	cell *l = p1;
+	idx_t l_ctx = p1_ctx;
+	LIST_HANDLER(l);
+
+	while (is_list(l)) {
+		LIST_HEAD(l);
+		l = LIST_TAIL(l);
+		l = deref(q, l, l_ctx);
+		l_ctx = q->latest_ctx;
+		cnt++;
+	}
+
+	if (!cnt) {
 		cell tmp;
 		make_literal(&tmp, g_nil_s);
-		return unify(q, p3, p3_ctx, &tmp, q->st.curr_frame);
+		return unify(q, p2, p2_ctx, &tmp, q->st.curr_frame);
 	}
 
-	// Retry takes a copy
+	sort_entry *entries = malloc(sizeof(sort_entry)*cnt);
+	may_ptr_error(entries);
+	sort_entry **base = malloc(sizeof(sort_entry*)*cnt*2);
+	may_ptr_error(base, free(entries));
+	l = p1;
+	l_ctx = p1_ctx;
 
-	idx_t nbr_cells = queuen_used(q);
-	q->tmpq[q->st.qnbr] = malloc(sizeof(cell)*nbr_cells);
-	ensure(q->tmpq[q->st.qnbr]);
-	copy_cells(q->tmpq[q->st.qnbr], get_queuen(q), nbr_cells);
-	q->tmpq_size[q->st.qnbr] = nbr_cells;
+	for (size_t i = 0; i < cnt; i++) {
+		sort_entry *e = &entries[i];
+		cell *h = LIST_HEAD(l);
+		h = deref(q, h, l_ctx);
+		e->c_ctx = q->latest_ctx;
 
-	// Now grab matching solutions
+		if (is_structure(h)) {
+			e->c = h;
+		} else {
+			e->tmp = *h;
+			e->c = &e->tmp;
+		}
 
-	init_queuen(q);
-	may_error(make_choice(q));
-	nbr_cells = q->tmpq_size[q->st.qnbr];
-	frame *g = GET_FRAME(q->st.curr_frame);
+		e->key = e->c;
+		e->key_ctx = e->c_ctx;
+		base[i] = e;
 
-	for (cell *c = q->tmpq[q->st.qnbr]; nbr_cells;
-		nbr_cells -= c->nbr_cells, c += c->nbr_cells) {
-		try_me(q, g->nbr_vars*2);
+		if (keyed_pairs && is_variable(h)) {
+			free(base);
+			free(entries);
+			return throw_error(q, h, "instantiation_error", "not_sufficiently_instantiated");
+		}
 
-		if (unify(q, p1, p1_ctx, c, q->st.fp)) {
-			cell *tmp = deep_copy_to_tmp(q, p1, p1_ctx, false, false);
-			may_ptr_error(tmp);
-			alloc_on_queuen(q, q->st.qnbr, tmp);
+		if (keyed_pairs && (!is_literal(h) || (h->arity != 2) || (h->val_off != g_minus_s))) {
+			free(base);
+			free(entries);
+			return throw_error(q, h, "type_error", "pair");
 		}
 
-		undo_me(q);
+		if (key && (!is_structure(h) || (h->arity < key))) {
+			free(base);
+			free(entries);
+			return throw_error(q, h, "type_error", "compound");
+		}
+
+		if (key) {
+			cell *c = h + 1;
+
+			for (unsigned j = 1; j < key; j++)
+				c += c->nbr_cells;
+
+			e->key = deref(q, c, e->c_ctx);
+			e->key_ctx = q->latest_ctx;
+		}
+
+		l = LIST_TAIL(l);
+		l = deref(q, l, l_ctx);
+		l_ctx = q->latest_ctx;
 	}
 
-	// Return matching solutions
+	sort_entry **sorted = merge_sort(q, base, base+cnt, cnt, ascending);
+	size_t nbr = 1;
 
-	drop_choice(q);
-	free(q->tmpq[q->st.qnbr]);
-	q->tmpq[q->st.qnbr] = NULL;
-	cell *l = convert_to_list(q, get_queuen(q), queuen_used(q));
-	q->st.qnbr--;
-	return unify(q, p3, p3_ctx, l, q->st.curr_frame);
+	for (size_t i = 1; i < cnt; i++) {
+		if (dedup && !sort_compare(q, sorted[nbr-1], sorted[i], ascending))
+			continue;
+
+		sorted[nbr++] = sorted[i];
+	}
+
+	bool too_many = false;
+	ok = localize_entries(q, sorted, nbr, &too_many);
+
+	if (!ok || q->did_throw || too_many) {
+		free(base);
+		free(entries);
+		return too_many ? sort_in_prolog(q, key, ascending, dedup) : ok;
+	}
+
+	allocate_list(q, sorted[0]->c);
+
+	for (size_t i = 1; i < nbr; i++)
+		append_list(q, sorted[i]->c);
+
+	free(base);
+	free(entries);
+	cell *tmp = end_list(q);
+	may_ptr_error(tmp);
+	return unify(q, p2, p2_ctx, tmp, q->st.curr_frame);
 }
 
-static USE_RESULT pl_status fn_sys_bagof_3(query *q)
+static cell *skip_existentials(query *q, cell *p2)
+{
+	while (is_structure(p2) && !strcmp(GET_STR(p2), "^")) {
+		p2++;
+		p2 += p2->nbr_cells;
+	}
+
+	return p2;
+}
+
+static bool has_var_nbr(const cell *c, idx_t nbr_cells, idx_t var_nbr)
+{
+	for (idx_t i = 0; i < nbr_cells; i++, c++) {
+		if (is_variable(c) && (c->var_nbr == var_nbr))
+			return true;
+	}
+
+	return false;
+}
+
+// The witness is the list of free variables of the goal, those not
+// in the template or an existential prefix. Solutions are queued as
+// Witness-Template pairs...
+
+static cell *make_bag_pair(query *q, cell *p1, cell *p2, cell *goal)
+{
+	unsigned nbr = 0;
+
+	for (cell *c = goal; c < (goal + goal->nbr_cells); c++) {
+		if (!is_variable(c) || has_var_nbr(goal, c - goal, c->var_nbr))
+			continue;
+
+		if (has_var_nbr(p1, p1->nbr_cells, c->var_nbr)
+			|| has_var_nbr(p2, goal - p2, c->var_nbr))
+			continue;
+
+		nbr++;
+	}
+
+	idx_t nbr_cells = 1 + (nbr * 2 + 1) + p1->nbr_cells;
+	cell *tmp = alloc_on_heap(q, nbr_cells);
+	if (!tmp) return NULL;
+	make_literal(tmp, g_minus_s);
+	tmp->arity = 2;
+	tmp->nbr_cells = nbr_cells;
+	cell *w = tmp + 1;
+
+	for (cell *c = goal; c < (goal + goal->nbr_cells); c++) {
+		if (!is_variable(c) || has_var_nbr(goal, c - goal, c->var_nbr))
+			continue;
+
+		if (has_var_nbr(p1, p1->nbr_cells, c->var_nbr)
+			|| has_var_nbr(p2, goal - p2, c->var_nbr))
+			continue;
+
+		make_literal(w, g_dot_s);
+		w->arity = 2;
+		w->nbr_cells = nbr-- * 2 + 1;
+		w++;
+		*w++ = *c;
+	}
+
+	make_literal(w++, g_nil_s);
+	copy_cells(w, p1, p1->nbr_cells);
+	return tmp;
+}
+
+static bool is_variant(query *q, cell *p1, idx_t p1_ctx, cell *p2, idx_t p2_ctx, unsigned depth)
+{
+	if (depth > MAX_DEPTH)
+		return false;
+
+	p1 = deref(q, p1, p1_ctx);
+	p1_ctx = q->latest_ctx;
+	p2 = deref(q, p2, p2_ctx);
+	p2_ctx = q->latest_ctx;
+
+	if (is_variable(p1) && is_variable(p2)) {
+		prolog *pl = q->m->pl;
+		idx_t slot1 = GET_SLOT(GET_FRAME(p1_ctx), p1->var_nbr) - q->slots;
+		idx_t slot2 = GET_SLOT(GET_FRAME(p2_ctx), p2->var_nbr) - q->slots;
+
+		for (idx_t i = 0; i < pl->tab_idx; i++) {
+			if ((pl->tab1[i] == slot1) || (pl->tab2[i] == slot2))
+				return (pl->tab1[i] == slot1) && (pl->tab2[i] == slot2);
+		}
+
+		if (pl->tab_idx == (sizeof(pl->tab1)/sizeof(pl->tab1[0])))
+			return false;
+
+		pl->tab1[pl->tab_idx] = slot1;
+		pl->tab2[pl->tab_idx++] = slot2;
+		return true;
+	}
+
+	if (is_variable(p1) || is_variable(p2))
+		return false;
+
+	if (!is_structure(p1) || !is_structure(p2))
+		return !compare(q, p1, p1_ctx, p2, p2_ctx, 0);
+
+	if ((p1->arity != p2->arity) || (p1->val_off != p2->val_off))
+		return false;
+
+	unsigned arity = p1->arity;
+	p1++;
+	p2++;
+
+	while (arity--) {
+		if (!is_variant(q, p1, p1_ctx, p2, p2_ctx, depth+1))
+			return false;
+
+		p1 += p1->nbr_cells;
+		p2 += p2->nbr_cells;
+	}
+
+	return true;
+}
+
+// Queued solutions number their variables from zero. Give each one
+// its own run of variables in the current frame as it is read back...
+
+static unsigned renumber_vars(cell *c, unsigned var_nbr)
+{
+	unsigned nbr_vars = 0;
+
+	for (idx_t nbr_cells = c->nbr_cells; nbr_cells--; c++) {
+		if (!is_variable(c))
+			continue;
+
+		if (c->var_nbr >= nbr_vars)
+			nbr_vars = c->var_nbr + 1;
+
+		c->var_nbr += var_nbr;
+	}
+
+	return nbr_vars;
+}
+
+static pl_status create_queuen_vars(query *q, cell *p1, unsigned *var_nbr)
+{
+	frame *g = GET_CURR_FRAME();
+	idx_t nbr_vars = q->queues[q->st.qnbr].nbr_vars;
+	*var_nbr = g->nbr_vars;
+
+	if (!nbr_vars)
+		return pl_success;
+
+	if ((g->nbr_vars + nbr_vars) >= MAX_VARS) {
+		init_queuen(q);
+		q->st.qnbr--;
+		return throw_error(q, p1, "resource_error", "too_many_vars");
+	}
+
+	create_vars(q, nbr_vars);
+
+	if (q->error)
+		return pl_error;
+
+	return pl_success;
+}
+
+static pl_status fresh_queuen_vars(query *q, cell *p1)
+{
+	unsigned var_nbr;
+	pl_status ok = create_queuen_vars(q, p1, &var_nbr);
+
+	if (!ok || q->did_throw)
+		return ok;
+
+	idx_t nbr_cells = queuen_used(q);
+
+	for (cell *c = get_queuen(q); nbr_cells;
+		nbr_cells -= c->nbr_cells, c += c->nbr_cells)
+		var_nbr += renumber_vars(c, var_nbr);
+
+	return pl_success;
+}
+
+// Build the list straight onto the heap from the queue, which is
+// then released. The queue holds the references so they are moved
+// rather than copied...
+
+static cell *queuen_to_list(query *q, unsigned var_nbr)
+{
+	idx_t nbr_cells = queuen_used(q), cnt = 0;
+
+	for (cell *c = get_queuen(q); nbr_cells;
+		nbr_cells -= c->nbr_cells, c += c->nbr_cells)
+		cnt++;
+
+	nbr_cells = queuen_used(q);
+	cell *l = alloc_on_heap(q, nbr_cells+cnt+1);
+	if (!l) return l;
+	cell *dst = l;
+
+	for (cell *c = get_queuen(q); nbr_cells;
+		nbr_cells -= c->nbr_cells, c += c->nbr_cells) {
+		dst->val_type = TYPE_LITERAL;
+		dst->nbr_cells = nbr_cells + cnt-- + 1;
+		dst->val_off = g_dot_s;
+		dst->arity = 2;
+		dst->flags = 0;
+		dst++;
+		copy_cells(dst, c, c->nbr_cells);
+		var_nbr += renumber_vars(dst, var_nbr);
+		dst += c->nbr_cells;
+	}
+
+	make_literal(dst, g_nil_s);
+	init_queuen(q);
+	return l;
+}
+
+static USE_RESULT pl_status fn_sys_findall_3(query *q)
 {
 	GET_FIRST_ARG(p1,any);
 	GET_NEXT_ARG(p2,callable);
@@ -5948,624 +6307,2946 @@ static USE_RESULT pl_status fn_sys_bagof_3(query *q)
 	if (is_list(p3) && !is_valid_list(q, p3, p3_ctx, true))
 		return throw_error(q, p3, "type_error", "list");
 
-	uint64_t xs_vars = 0;
-	p2 = skip_existentials(q, p2, &xs_vars);
-
-	// First time thru generate all solutions
-
 	if (!q->retry) {
-		q->st.qnbr++;
-		assert(q->st.qnbr < MAX_QUEUES);
-		cell *tmp = clone_to_heap(q, true, p2, 2+p2->nbr_cells+1);
+		may_error(push_queuen(q));
+		cell *tmp = clone_to_heap(q, true, p2, 2+p1->nbr_cells+1);
 		idx_t nbr_cells = 1 + p2->nbr_cells;
-		make_structure(tmp+nbr_cells++, g_sys_queue_s, fn_sys_queuen_2, 2, 1+p2->nbr_cells);
+		make_structure(tmp+nbr_cells++, g_sys_queue_s, fn_sys_queuen_2, 2, 1+p1->nbr_cells);
 		make_int(tmp+nbr_cells++, q->st.qnbr);
-		nbr_cells += safe_copy_cells(tmp+nbr_cells, p2, p2->nbr_cells);
+		nbr_cells += safe_copy_cells(tmp+nbr_cells, p1, p1->nbr_cells);
 		make_structure(tmp+nbr_cells, g_fail_s, fn_iso_fail_0, 0, 0);
-		init_queuen(q);
-		free(q->tmpq[q->st.qnbr]);
-		q->tmpq[q->st.qnbr] = NULL;
 		may_error(make_barrier(q));
 		q->st.curr_cell = tmp;
 		return pl_success;
 	}
 
-	if (!queuen_used(q) && !q->tmpq[q->st.qnbr])
-		return pl_failure;
-
-	// First retry takes a copy
-
-	if (!q->tmpq[q->st.qnbr]) {
-		idx_t nbr_cells = queuen_used(q);
-		q->tmpq[q->st.qnbr] = malloc(sizeof(cell)*nbr_cells);
-		ensure(q->tmpq[q->st.qnbr]);
-		copy_cells(q->tmpq[q->st.qnbr], get_queuen(q), nbr_cells);
-		q->tmpq_size[q->st.qnbr] = nbr_cells;
+	if (!queuen_used(q)) {
+		q->st.qnbr--;
+		cell tmp;
+		make_literal(&tmp, g_nil_s);
+		return unify(q, p3, p3_ctx, &tmp, q->st.curr_frame);
 	}
 
-	// Now grab matching solutions
-
-	init_queuen(q);
-	may_error(make_choice(q));
-	uint64_t p1_vars = get_vars(p1, p1_ctx);
-	uint64_t p2_vars = get_vars(p2, p2_ctx);
-	uint64_t mask = p1_vars ^ p2_vars ^ xs_vars;
-	pin_vars(q, mask);
-	idx_t nbr_cells = q->tmpq_size[q->st.qnbr];
-	bool unmatched = false;
-	frame *g = GET_FRAME(q->st.curr_frame);
+	unsigned var_nbr;
+	pl_status ok = create_queuen_vars(q, p1, &var_nbr);
 
-	for (cell *c = q->tmpq[q->st.qnbr]; nbr_cells;
-		nbr_cells -= c->nbr_cells, c += c->nbr_cells) {
+	if (!ok || q->did_throw)
+		return ok;
 
-		if (c->flags & FLAG2_PROCESSED)
+	cell *l = queuen_to_list(q, var_nbr);
+	may_ptr_error(l);
+	q->st.qnbr--;
+	return unify(q, p3, p3_ctx, l, q->st.curr_frame);
+}
+
+// aggregate_all/3 folds each solution into the collector as it is
+// found: a count or running sum, or the best value so far with its
+// witness (if any) held in the queue...
+
+static bool is_aggregate_spec(query *q, cell *p1)
+{
+	if (is_atom(p1))
+		return !strcmp(GET_STR(p1), "count");
+
+	if (!is_structure(p1) || (p1->arity > 2))
+		return false;
+
+	const char *name = GET_STR(p1);
+
+	if ((p1->arity == 1) && !strcmp(name, "sum"))
+		return true;
+
+	return !strcmp(name, "max") || !strcmp(name, "min");
+}
+
+// Max and min compare numerically, as >/2 and </2 do, so that 2.5
+// lies between 2 and 3 rather than before both...
+
+static int compare_numbers(const cell *p1, const cell *p2)
+{
+	if (is_rational(p1) && is_rational(p2)) {
+		int_t n1 = p1->val_num * p2->val_den;
+		int_t n2 = p2->val_num * p1->val_den;
+		return n1 < n2 ? -1 : n1 > n2 ? 1 : 0;
+	}
+
+	double d1 = is_float(p1) ? p1->val_flt : (double)p1->val_num / p1->val_den;
+	double d2 = is_float(p2) ? p2->val_flt : (double)p2->val_num / p2->val_den;
+	return d1 < d2 ? -1 : d1 > d2 ? 1 : 0;
+}
+
+// The spec is evaluated inside the '$aggregate' helper, but an error
+// in it belongs to the aggregate_all/3 call...
+
+static pl_status throw_aggregate_error(query *q, cell *c, idx_t c_ctx, const char *err_type, const char *expected)
+{
+	cell *tmp = alloc_on_heap(q, 1);
+	may_ptr_error(tmp);
+	make_literal(tmp, index_from_pool(q->m->pl, "aggregate_all"));
+	tmp->arity = 3;
+	q->st.curr_cell = tmp;
+	q->latest_ctx = c_ctx;
+	return throw_error(q, c, err_type, expected);
+}
+
+static USE_RESULT pl_status fn_sys_aggregate_2(query *q)
+{
+	GET_FIRST_ARG(p1,integer);
+	GET_NEXT_ARG(p2,any);
+	collector *qu = q->queues + p1->val_num;
+
+	if (is_atom(p2)) {
+		qu->acc.val_num++;
+		return pl_success;
+	}
+
+	cell *p3 = deref(q, p2+1, p2_ctx);
+	idx_t p3_ctx = q->latest_ctx;
+	cell v = calc_(q, p3);
+	v.nbr_cells = 1;
+
+	if (q->did_throw)
+		return pl_success;
+
+	if (is_variable(p3))
+		return throw_aggregate_error(q, p3, p3_ctx, "instantiation_error", "number");
+
+	if (is_callable(p3) && !is_builtin(p3))
+		return throw_aggregate_error(q, p3, p3_ctx, "type_error", "evaluable");
+
+	if (!strcmp(GET_STR(p2), "sum")) {
+		cell tmp[3];
+		make_structure(tmp, g_plus_s, fn_iso_add_2, 2, 2);
+		tmp[1] = qu->acc;
+		tmp[2] = v;
+		do_calc_(q, tmp, q->st.curr_frame);
+
+		if (q->did_throw)
+			return pl_success;
+
+		qu->acc = q->accum;
+		qu->acc.nbr_cells = 1;
+		return pl_success;
+	}
+
+	if (!is_empty(&qu->acc)) {
+		int ok = compare_numbers(&v, &qu->acc);
+
+		if (!strcmp(GET_STR(p2), "max") ? (ok <= 0) : (ok >= 0))
+			return pl_success;
+	}
+
+	qu->acc = v;
+
+	if (p2->arity == 1)
+		return pl_success;
+
+	cell *p4 = p2 + 1;
+	p4 += p4->nbr_cells;
+	cell *tmp = deep_raw_copy_to_tmp(q, p4, p2_ctx);
+	may_ptr_error(tmp);
+
+	if (tmp == ERR_CYCLE_CELL)
+		return throw_error(q, p4, "resource_error", "cyclic_term");
+
+	for (idx_t i = 0; i < qu->qp; i++) {
+		cell *c = qu->queue + i;
+		DECR_REF(c);
+	}
+
+	qu->qp = 0;
+	alloc_on_queuen(q, p1->val_num, tmp);
+	qu->nbr_vars = q->m->pl->varno;
+	return pl_success;
+}
+
+static USE_RESULT pl_status fn_sys_aggregate_all_3(query *q)
+{
+	GET_FIRST_ARG(p1,any);
+	GET_NEXT_ARG(p2,callable);
+	GET_NEXT_ARG(p3,any);
+
+	if (!q->retry) {
+		if (is_variable(p1))
+			return throw_error(q, p1, "instantiation_error", "not_sufficiently_instantiated");
+
+		if (!is_aggregate_spec(q, p1))
+			return throw_error(q, p1, "domain_error", "aggregate_spec");
+
+		may_error(push_queuen(q));
+		collector *qu = q->queues + q->st.qnbr;
+
+		if (is_atom(p1) || !strcmp(GET_STR(p1), "sum"))
+			make_int(&qu->acc, 0);
+		else
+			qu->acc.val_type = TYPE_EMPTY;
+
+		cell *tmp = clone_to_heap(q, true, p2, 2+p1->nbr_cells+1);
+		idx_t nbr_cells = 1 + p2->nbr_cells;
+		make_structure(tmp+nbr_cells++, g_sys_aggregate_s, fn_sys_aggregate_2, 2, 1+p1->nbr_cells);
+		make_int(tmp+nbr_cells++, q->st.qnbr);
+		nbr_cells += safe_copy_cells(tmp+nbr_cells, p1, p1->nbr_cells);
+		make_structure(tmp+nbr_cells, g_fail_s, fn_iso_fail_0, 0, 0);
+		may_error(make_barrier(q));
+		q->st.curr_cell = tmp;
+		return pl_success;
+	}
+
+	collector *qu = q->queues + q->st.qnbr;
+	cell acc = qu->acc;
+
+	if (is_empty(&acc)) {
+		q->st.qnbr--;
+		return pl_failure;
+	}
+
+	if (!is_structure(p1) || (p1->arity == 1)) {
+		q->st.qnbr--;
+		return unify(q, p3, p3_ctx, &acc, q->st.curr_frame);
+	}
+
+	unsigned var_nbr;
+	pl_status ok = create_queuen_vars(q, p1, &var_nbr);
+
+	if (!ok || q->did_throw)
+		return ok;
+
+	cell *w = get_queuen(q);
+	renumber_vars(w, var_nbr);
+	cell *tmp = alloc_on_heap(q, 2+w->nbr_cells);
+	may_ptr_error(tmp);
+	tmp->val_type = TYPE_LITERAL;
+	tmp->nbr_cells = 2 + w->nbr_cells;
+	tmp->val_off = p1->val_off;
+	tmp->arity = 2;
+	tmp->flags = 0;
+	tmp[1] = acc;
+	copy_cells(tmp+2, w, w->nbr_cells);
+	init_queuen(q);
+	q->st.qnbr--;
+	return unify(q, p3, p3_ctx, tmp, q->st.curr_frame);
+}
+
+// The solutions are sorted once on their witness and kept in tmpq,
+// then each retry hands out the next group: the run of identical
+// witnesses plus, for a non-ground one, any variants further on...
+
+static pl_status sort_bag(query *q)
+{
+	idx_t nbr_cells = queuen_used(q);
+	size_t cnt = 0;
+
+	for (cell *c = get_queuen(q); nbr_cells; nbr_cells -= c->nbr_cells, c += c->nbr_cells)
+		cnt++;
+
+	sort_entry *entries = malloc(sizeof(sort_entry)*cnt);
+	may_ptr_error(entries);
+	sort_entry **base = malloc(sizeof(sort_entry*)*cnt*2);
+	may_ptr_error(base, free(entries));
+	cell *c = get_queuen(q);
+
+	for (size_t i = 0; i < cnt; i++, c += c->nbr_cells) {
+		sort_entry *e = &entries[i];
+		e->c = c;
+		e->key = c + 1;
+		e->c_ctx = e->key_ctx = q->st.curr_frame;
+		base[i] = e;
+	}
+
+	sort_entry **sorted = merge_sort(q, base, base+cnt, cnt, true);
+	nbr_cells = queuen_used(q);
+	cell *dst = q->queues[q->st.qnbr].tmpq = malloc(sizeof(cell)*nbr_cells);
+
+	if (!dst) {
+		free(base);
+		free(entries);
+		return pl_error;
+	}
+
+	for (size_t i = 0; i < cnt; i++)
+		dst += copy_cells(dst, sorted[i]->c, sorted[i]->c->nbr_cells);
+
+	q->queues[q->st.qnbr].tmpq_size = nbr_cells;
+	free(base);
+	free(entries);
+	init_queuen(q);
+	return pl_success;
+}
+
+static idx_t next_unprocessed(query *q, idx_t pos)
+{
+	cell *c = q->queues[q->st.qnbr].tmpq + pos;
+
+	while ((pos < q->queues[q->st.qnbr].tmpq_size) && (c->flags & FLAG2_PROCESSED)) {
+		pos += c->nbr_cells;
+		c += c->nbr_cells;
+	}
+
+	return pos;
+}
+
+static USE_RESULT pl_status fn_sys_bagof_3(query *q)
+{
+	GET_FIRST_ARG(p1,any);
+	GET_NEXT_ARG(p2,callable);
+	GET_NEXT_ARG(p3,list_or_nil_or_var);
+
+	if (is_list(p3) && !is_valid_list(q, p3, p3_ctx, true))
+		return throw_error(q, p3, "type_error", "list");
+
+	cell *goal = skip_existentials(q, p2);
+
+	// First time thru generate all solutions
+
+	if (!q->retry) {
+		cell *pair = make_bag_pair(q, p1, p2, goal);
+		may_ptr_error(pair);
+		may_error(push_queuen(q));
+		cell *tmp = clone_to_heap(q, true, goal, 2+pair->nbr_cells+1);
+		idx_t nbr_cells = 1 + goal->nbr_cells;
+		make_structure(tmp+nbr_cells++, g_sys_queue_s, fn_sys_queuen_2, 2, 1+pair->nbr_cells);
+		make_int(tmp+nbr_cells++, q->st.qnbr);
+		nbr_cells += safe_copy_cells(tmp+nbr_cells, pair, pair->nbr_cells);
+		make_structure(tmp+nbr_cells, g_fail_s, fn_iso_fail_0, 0, 0);
+		may_error(make_barrier(q));
+		q->st.curr_cell = tmp;
+		return pl_success;
+	}
+
+	idx_t pos = 0;
+
+	if (!q->queues[q->st.qnbr].tmpq) {
+		if (!queuen_used(q)) {
+			q->st.qnbr--;
+			return pl_failure;
+		}
+
+		pl_status ok = fresh_queuen_vars(q, p1);
+
+		if (!ok || q->did_throw)
+			return ok;
+
+		may_error(sort_bag(q));
+		may_error(make_choice(q));
+	} else
+		get_params(q, &pos, NULL);
+
+	// Take the next group, marking its members as processed
+
+	cell *base = q->queues[q->st.qnbr].tmpq;
+	idx_t size = q->queues[q->st.qnbr].tmpq_size;
+	cell *c = base + pos, *w0 = c + 1;
+	bool ground = !has_vars(q, w0, q->st.curr_frame, 0);
+	allocate_list(q, w0 + w0->nbr_cells);
+	c->flags |= FLAG2_PROCESSED;
+
+	for (pos += c->nbr_cells, c += c->nbr_cells; pos < size;
+		pos += c->nbr_cells, c += c->nbr_cells) {
+		if (compare(q, c+1, q->st.curr_frame, w0, q->st.curr_frame, 0))
+			break;
+
+		append_list(q, c+1+c[1].nbr_cells);
+		c->flags |= FLAG2_PROCESSED;
+	}
+
+	cell **variants = NULL;
+	size_t nbr_variants = 0;
+
+	for (cell *c2 = c; !ground && (c2 < (base + size)); c2 += c2->nbr_cells) {
+		if (c2->flags & FLAG2_PROCESSED)
+			continue;
+
+		q->m->pl->tab_idx = 0;
+
+		if (!is_variant(q, c2+1, q->st.curr_frame, w0, q->st.curr_frame, 0))
+			continue;
+
+		cell **tmp = realloc(variants, sizeof(cell*)*(nbr_variants+1));
+		may_ptr_error(tmp, free(variants));
+		variants = tmp;
+		variants[nbr_variants++] = c2 + 1;
+		append_list(q, c2+1+c2[1].nbr_cells);
+		c2->flags |= FLAG2_PROCESSED;
+	}
+
+	cell *l = end_list(q);
+	may_ptr_error(l, free(variants));
+	pos = next_unprocessed(q, pos);
+
+	if (pos < size) {
+		set_params(q, pos, 0);
+		may_error(make_choice(q), free(variants));
+	} else
+		drop_choice(q);
+
+	// Variant witnesses are bound to the first so that their
+	// templates share its variables...
+
+	for (size_t i = 0; i < nbr_variants; i++)
+		unify(q, variants[i], q->st.curr_frame, w0, q->st.curr_frame);
+
+	free(variants);
+	cell *w = alloc_on_heap(q, w0->nbr_cells);
+	may_ptr_error(w);
+	safe_copy_cells(w, w0, w0->nbr_cells);
+	cell *pair = make_bag_pair(q, p1, p2, goal);
+	may_ptr_error(pair);
+	bool ok = unify(q, pair+1, q->st.curr_frame, w, q->st.curr_frame);
+
+	if (pos >= size) {
+		free(q->queues[q->st.qnbr].tmpq);
+		q->queues[q->st.qnbr].tmpq = NULL;
+		q->st.qnbr--;
+	}
+
+	if (!ok)
+		return pl_failure;
+
+	return unify(q, p3, p3_ctx, l, q->st.curr_frame);
+}
+
+static pl_status do_op(query *q, cell *p3)
+{
+	GET_FIRST_ARG(p1,integer);
+	GET_NEXT_ARG(p2,atom);
+
+	if (!is_atom(p3))
+		return throw_error(q, p3, "type_error", "atom");
+
+	unsigned specifier;
+	const char *spec = GET_STR(p2);
+	unsigned pri = p1->val_num;
+
+	if (!strcmp(spec, "fx"))
+		specifier = OP_FX;
+	else if (!strcmp(spec, "fy"))
+		specifier = OP_FY;
+	else if (!strcmp(spec, "xf"))
+		specifier = OP_XF;
+	else if (!strcmp(spec, "xfx"))
+		specifier = OP_XFX;
+	else if (!strcmp(spec, "xfy"))
+		specifier = OP_XFY;
+	else if (!strcmp(spec, "yf"))
+		specifier = OP_YF;
+	else if (!strcmp(spec, "yfx"))
+		specifier = OP_YFX;
+	else
+		return throw_error(q, p2, "domain_error", "operator_specifier");
+
+	if (pri && !strcmp(GET_STR(p3), "|") && (!IS_INFIX(specifier) || (pri < 1001)))
+		return throw_error(q, p3, "permission_error", "create,operator");
+
+	if (!strcmp(GET_STR(p3), "[]"))
+		return throw_error(q, p3, "permission_error", "create,operator");
+
+	if (!strcmp(GET_STR(p3), "{}"))
+		return throw_error(q, p3, "permission_error", "create,operator");
+
+	if (!strcmp(GET_STR(p3), ","))
+		return throw_error(q, p3, "permission_error", "modify,operator");
+
+	unsigned tmp_optype = 0;
+	get_op(q->m, GET_STR(p3), &tmp_optype, false);
+
+	if (IS_INFIX(specifier) && IS_POSTFIX(tmp_optype))
+		return throw_error(q, p3, "permission_error", "create,operator");
+
+	unsigned tmp_pri = get_op2(q->m, GET_STR(p3), OP_FX);
+
+	if (IS_POSTFIX(specifier) && (IS_INFIX(tmp_optype) || tmp_pri))
+		return throw_error(q, p3, "permission_error", "create,operator");
+
+	tmp_pri = get_op2(q->m, GET_STR(p3), OP_FY);
+
+	if (IS_POSTFIX(specifier) && (IS_INFIX(tmp_optype) || tmp_pri))
+		return throw_error(q, p3, "permission_error", "create,operator");
+
+	if (!set_op(q->m, GET_STR(p3), specifier, pri))
+		return throw_error(q, p3, "resource_error", "too_many_ops");
+
+	return pl_success;
+}
+
+static USE_RESULT pl_status fn_iso_op_3(query *q)
+{
+	GET_FIRST_ARG(p1,integer);
+	GET_NEXT_ARG(p2,atom);
+	GET_NEXT_ARG(p3,list_or_atom);
+
+	if (is_integer(p1) && ((p1->val_num < 0) || (p1->val_num > 1200)))
+		return throw_error(q, p1, "domain_error", "operator_priority");
+
+	LIST_HANDLER(p3);
+
+	while (is_list(p3)) {
+		cell *h = LIST_HEAD(p3);
+		h = deref(q, h, p3_ctx);
+
+		pl_status ok = do_op(q, h);
+
+		if (ok != pl_success)
+			return ok;
+
+		p3 = LIST_TAIL(p3);
+		p3 = deref(q, p3, p3_ctx);
+		p3_ctx = q->latest_ctx;
+
+		if (is_variable(p3))
+			return throw_error(q, p3, "instantiation_error", "atom");
+
+		if (is_nil(p3))
+			return pl_success;
+	}
+
+	if (is_atom(p3))
+		return do_op(q, p3);
+
+	return pl_success;
+}
+
+static USE_RESULT pl_status fn_erase_1(query *q)
+{
+	GET_FIRST_ARG(p1,atom);
+	uuid u;
+	uuid_from_buf(GET_STR(p1), &u);
+	clause *r = find_in_db(q->m, &u);
+	may_ptr_error(r);
+	add_to_dirty_list(q, r);
+
+	if (!q->m->loading && r->t.persist)
+		db_log(q, r, LOG_ERASE);
+
+	return pl_success;
+}
+
+static USE_RESULT pl_status fn_instance_2(query *q)
+{
+	GET_FIRST_ARG(p1,atom);
+	GET_NEXT_ARG(p2,any);
+	uuid u;
+	uuid_from_buf(GET_STR(p1), &u);
+	clause *r = find_in_db(q->m, &u);
+	may_ptr_error(r);
+	return unify(q, p2, p2_ctx, r->t.cells, q->st.curr_frame);
+}
+
+static USE_RESULT pl_status fn_clause_3(query *q)
+{
+	GET_FIRST_ARG(p1,callable);
+	GET_NEXT_ARG(p2,callable_or_var);
+	GET_NEXT_ARG(p3,atom_or_var);
+
+	// A given reference names at most one clause, so the match is
+	// made in a frame of its own and no choice is left behind...
+
+	if (!is_variable(p3)) {
+		uuid u;
+		uuid_from_buf(GET_STR(p3), &u);
+		clause *r = find_in_db(q->m, &u);
+
+		if (!r)
+			return pl_failure;
+
+		// Making room for the clause's variables can move the slots
+		// the arguments may be in...
+
+		cell save_p1 = *p1, save_p2 = *p2;
+
+		if (!is_structure(p1))
+			p1 = &save_p1;
+
+		if (!is_structure(p2))
+			p2 = &save_p2;
+
+		may_error(check_slot(q, r->t.nbr_vars));
+		may_error(make_choice(q));
+		try_me(q, r->t.nbr_vars);
+		cell *body = get_body(r->t.cells);
+		pl_status ok = unify(q, p1, p1_ctx, get_head(r->t.cells), q->st.fp);
+
+		if (ok && body)
+			ok = unify(q, p2, p2_ctx, body, q->st.fp);
+		else if (ok) {
+			cell tmp;
+			make_literal(&tmp, g_true_s);
+			ok = unify(q, p2, p2_ctx, &tmp, q->st.curr_frame);
+		}
+
+		if (!ok) {
+			undo_me(q);
+			drop_choice(q);
+			return pl_failure;
+		}
+
+		stash_me(q, r, true);
+		return pl_success;
+	}
+
+	// A bound-to-var reference lives in the slots, which match_clause
+	// may reallocate...
+
+	cell p3_var = *p3;
+
+	for (;;) {
+		if (!match_clause(q, p1, p1_ctx, DO_CLAUSE))
+			break;
+
+		char tmpbuf[128];
+		uuid_to_buf(&q->st.curr_clause2->u, tmpbuf, sizeof(tmpbuf));
+		cell tmp;
+		may_error(make_cstring(&tmp, tmpbuf));
+		set_var(q, &p3_var, p3_ctx, &tmp, q->st.curr_frame);
+		DECR_REF(&tmp);
+		clause *r = q->st.curr_clause2;
+		cell *body = get_body(r->t.cells);
+		pl_status ok;
+
+		if (body)
+			ok = unify(q, p2, p2_ctx, body, q->st.fp);
+		else {
+			cell tmp;
+			make_literal(&tmp, g_true_s);
+			ok = unify(q, p2, p2_ctx, &tmp, q->st.curr_frame);
+		}
+
+		if (ok) {
+			bool last_match = !has_next_key(q, q->st.curr_clause2);
+			stash_me(q, r, last_match);
+			return pl_success;
+		}
+
+		undo_me(q);
+		drop_choice(q);
+		q->retry = QUERY_RETRY;
+	}
+
+	return pl_failure;
+}
+
+static USE_RESULT pl_status do_asserta_2(query *q)
+{
+	GET_FIRST_ARG(p1,any);
+	cell *head = get_head(p1);
+
+	if (is_variable(head))
+		return throw_error(q, head, "instantiation_error", "args _not_sufficiently_instantiated");
+
+	bool found = false;
+
+	if (get_builtin_term(q->m->pl, head, head->arity, &found), found)
+		return throw_error(q, head, "permission_error", "modify,static_procedure");
+
+	cell *body = get_body(p1);
+
+	if (body && !is_callable(body))
+		return throw_error(q, body, "type_error", "callable");
+
+	cell *tmp2;
+
+	if (body && ((tmp2 = check_body_callable(q->m->p, body)) != NULL))
+		return throw_error(q, tmp2, "type_error", "callable");
+
+	GET_NEXT_ARG(p2,atom_or_var);
+	cell *tmp = deep_copy_to_tmp(q, p1, p1_ctx, false, false);
+	may_ptr_error(tmp);
+	if (tmp == ERR_CYCLE_CELL)
+		return throw_error(q, p1, "resource_error", "cyclic_term");
+
+	idx_t nbr_cells = tmp->nbr_cells;
+	parser *p = q->m->p;
+
+	if (nbr_cells > p->t->nbr_cells) {
+		p->t = realloc(p->t, sizeof(term)+(sizeof(cell)*(nbr_cells+1)));
+		ensure(p->t);
+		p->t->nbr_cells = nbr_cells;
+	}
+
+	p->t->cidx = safe_copy_cells(p->t->cells, tmp, nbr_cells);
+	do_assign_vars(p, nbr_cells);
+	parser_term_to_body(p);
+	cell *h = get_head(p->t->cells);
+
+	if (is_cstring(h)) {
+		idx_t off = index_from_pool(q->m->pl, GET_STR(h));
+		ensure (off != ERR_IDX);
+		DECR_REF(h);
+		h->val_type = TYPE_LITERAL;
+		h->val_off = off;
+		h->flags = 0;
+	}
+
+	if (!is_literal(h))
+		return throw_error(q, h, "type_error", "callable");
+
+	clause *r = asserta_to_db(q->m, p->t, 0);
+	may_ptr_error(r);
+
+	if (!is_variable(p2)) {
+		uuid u;
+		uuid_from_buf(GET_STR(p2), &u);
+		set_uuid_in_db(q->m, r, &u);
+	} else {
+		char tmpbuf[128];
+		uuid_to_buf(&r->u, tmpbuf, sizeof(tmpbuf));
+		cell tmp2;
+		may_error(make_cstring(&tmp2, tmpbuf));
+		set_var(q, p2, p2_ctx, &tmp2, q->st.curr_frame);
+		DECR_REF(&tmp2);
+	}
+
+	if (!q->m->loading && r->t.persist)
+		db_log(q, r, LOG_ASSERTA);
+
+	return pl_success;
+}
+
+static USE_RESULT pl_status fn_asserta_2(query *q)
+{
+	GET_FIRST_ARG(p1,nonvar);
+	GET_NEXT_ARG(p2,variable);
+	return do_asserta_2(q);
+}
+
+static USE_RESULT pl_status fn_sys_asserta_2(query *q)
+{
+	GET_FIRST_ARG(p1,nonvar);
+	GET_NEXT_ARG(p2,atom);
+	return do_asserta_2(q);
+}
+
+static USE_RESULT pl_status do_assertz_2(query *q)
+{
+	GET_FIRST_ARG(p1,any);
+	cell *head = get_head(p1);
+
+	if (is_variable(head))
+		return throw_error(q, head, "instantiation_error", "args _not_sufficiently_instantiated");
+
+	bool found = false;
+
+	if (get_builtin_term(q->m->pl, head, head->arity, &found), found)
+		return throw_error(q, head, "permission_error", "modify,static_procedure");
+
+	cell *body = get_body(p1);
+
+	if (body && !is_callable(body))
+		return throw_error(q, body, "type_error", "callable");
+
+	cell *tmp2;
+
+	if (body && ((tmp2 = check_body_callable(q->m->p, body)) != NULL))
+		return throw_error(q, tmp2, "type_error", "callable");
+
+	GET_NEXT_ARG(p2,atom_or_var);
+	cell *tmp = deep_copy_to_tmp(q, p1, p1_ctx, false, false);
+	may_ptr_error(tmp);
+
+	if (tmp == ERR_CYCLE_CELL)
+		return throw_error(q, p1, "resource_error", "cyclic_term");
+
+	idx_t nbr_cells = tmp->nbr_cells;
+	parser *p = q->m->p;
+
+	if (nbr_cells > p->t->nbr_cells) {
+		p->t = realloc(p->t, sizeof(term)+(sizeof(cell)*(nbr_cells+1)));
+		ensure(p->t);
+		p->t->nbr_cells = nbr_cells;
+	}
+
+	p->t->cidx = safe_copy_cells(p->t->cells, tmp, nbr_cells);
+	do_assign_vars(p, nbr_cells);
+	parser_term_to_body(p);
+	cell *h = get_head(p->t->cells);
+
+	if (is_cstring(h)) {
+		idx_t off = index_from_pool(q->m->pl, GET_STR(h));
+		ensure (off != ERR_IDX);
+		DECR_REF(h);
+		h->val_type = TYPE_LITERAL;
+		h->val_off = off;
+		h->flags = 0;
+	}
+
+	if (!is_literal(h))
+		return throw_error(q, h, "type_error", "callable");
+
+	clause *r = assertz_to_db(q->m, p->t, 0);
+	may_ptr_error(r);
+
+	if (!is_variable(p2)) {
+		uuid u;
+		uuid_from_buf(GET_STR(p2), &u);
+		set_uuid_in_db(q->m, r, &u);
+	} else {
+		char tmpbuf[128];
+		uuid_to_buf(&r->u, tmpbuf, sizeof(tmpbuf));
+		cell tmp2;
+		may_error(make_cstring(&tmp2, tmpbuf));
+		set_var(q, p2, p2_ctx, &tmp2, q->st.curr_frame);
+		DECR_REF(&tmp2);
+	}
+
+	if (!q->m->loading && r->t.persist)
+		db_log(q, r, LOG_ASSERTZ);
+
+	return pl_success;
+}
+
+static USE_RESULT pl_status fn_assertz_2(query *q)
+{
+	GET_FIRST_ARG(p1,nonvar);
+	GET_NEXT_ARG(p2,variable);
+	return do_assertz_2(q);
+}
+
+static USE_RESULT pl_status fn_sys_assertz_2(query *q)
+{
+	GET_FIRST_ARG(p1,nonvar);
+	GET_NEXT_ARG(p2,atom);
+	return do_assertz_2(q);
+}
+
+static void save_db(FILE *fp, query *q, int logging)
+{
+	for (predicate *h = q->m->head; h; h = h->next) {
+		if (h->is_prebuilt)
+			continue;
+
+		if (logging && !h->is_persist)
+			continue;
+
+		const char *src = GET_STR(&h->key);
+
+		if (src[0] == '$')
+			continue;
+
+		for (clause *r = h->head; r; r = r->next) {
+			if (r->t.ugen_erased)
+				continue;
+
+			if (logging)
+				fprintf(fp, "z_(");
+
+			print_term(q, fp, r->t.cells, q->st.curr_frame, 0);
+
+			if (logging) {
+				char tmpbuf[256];
+				uuid_to_buf(&r->u, tmpbuf, sizeof(tmpbuf));
+				fprintf(fp, ",'%s')", tmpbuf);
+			}
+
+			fprintf(fp, ".\n");
+		}
+	}
+}
+
+static USE_RESULT pl_status fn_listing_0(query *q)
+{
+	save_db(stdout, q, 0);
+	return pl_success;
+}
+
+static void save_name(FILE *fp, query *q, idx_t name, unsigned arity)
+{
+	module *m = q->st.curr_clause ? q->st.curr_clause->m : q->m;
+
+	for (predicate *h = m->head; h; h = h->next) {
+		if (h->is_prebuilt)
+			continue;
+
+		if (name != h->key.val_off)
+			continue;
+
+		if ((arity != h->key.arity) && (arity != -1U))
+			continue;
+
+		for (clause *r = h->head; r; r = r->next) {
+			if (r->t.ugen_erased)
+				continue;
+
+			print_term(q, fp, r->t.cells, q->st.curr_frame, 0);
+			fprintf(fp, ".\n");
+		}
+	}
+}
+
+static USE_RESULT pl_status fn_listing_1(query *q)
+{
+	GET_FIRST_ARG(p1,any);
+	idx_t name = p1->val_off;
+	unsigned arity = -1;
+
+	if (p1->arity) {
+		if (strcmp(GET_STR(p1), "/") && strcmp(GET_STR(p1), "//"))
+			return throw_error(q, p1, "type_error", "predicate_indicator");
+
+		cell *p2 = p1 + 1;
+
+		if (!is_atom(p2))
+			return throw_error(q, p2, "type_error", "atom");
+
+		cell *p3 = p2 + p2->nbr_cells;
+
+		if (!is_integer(p3))
+			return throw_error(q, p3, "type_error", "integer");
+
+		name = index_from_pool(q->m->pl, GET_STR(p2));
+		arity = p3->val_num;
+
+		if (!strcmp(GET_STR(p1), "//"))
+			arity += 2;
+	}
+
+	save_name(stdout, q, name, arity);
+	return pl_success;
+}
+
+static USE_RESULT pl_status fn_sys_timer_0(query *q)
+{
+	q->time_started = get_time_in_usec();
+	return pl_success;
+}
+
+static USE_RESULT pl_status fn_sys_elapsed_0(query *q)
+{
+	uint64_t elapsed = get_time_in_usec();
+	elapsed -= q->time_started;
+	fprintf(stdout, "Time elapsed %.03g secs\n", (double)elapsed/1000/1000);
+	return pl_success;
+}
+
+static USE_RESULT pl_status fn_trace_0(query *q)
+{
+	q->trace = !q->trace;
+	return pl_success;
+}
+
+static USE_RESULT pl_status fn_time_1(query *q)
+{
+	GET_FIRST_ARG(p1,callable);
+	DISCARD_RESULT fn_sys_timer_0(q);
+	cell *tmp = clone_to_heap(q, true, p1, 2);
+	idx_t nbr_cells = 1 + p1->nbr_cells;
+	make_structure(tmp+nbr_cells++, g_sys_elapsed_s, fn_sys_elapsed_0, 0, 0);
+	make_call(q, tmp+nbr_cells);
+	q->st.curr_cell = tmp;
+	return pl_success;
+}
+
+static USE_RESULT pl_status fn_statistics_2(query *q)
+{
+	GET_FIRST_ARG(p1,atom);
+	GET_NEXT_ARG(p2,list_or_var);
+
+	if (!strcmp(GET_STR(p1), "cputime") && is_variable(p2)) {
+		uint64_t now = get_time_in_usec();
+		double elapsed = now - q->time_started;
+		cell tmp;
+		make_float(&tmp, elapsed/1000/1000);
+		set_var(q, p2, p2_ctx, &tmp, q->st.curr_frame);
+		return pl_success;
+	}
+
+	if (!strcmp(GET_STR(p1), "gctime") && is_variable(p2)) {
+		double elapsed = q->gc_time;
+		cell tmp;
+		make_float(&tmp, elapsed/1000/1000);
+		set_var(q, p2, p2_ctx, &tmp, q->st.curr_frame);
+		return pl_success;
+	}
+
+	if (!strcmp(GET_STR(p1), "atoms") && is_variable(p2)) {
+		cell tmp;
+		make_int(&tmp, q->m->pl->symtab_count);
+		set_var(q, p2, p2_ctx, &tmp, q->st.curr_frame);
+		return pl_success;
+	}
+
+	if (!strcmp(GET_STR(p1), "frames") && is_variable(p2)) {
+		cell tmp;
+		make_int(&tmp, q->st.fp);
+		set_var(q, p2, p2_ctx, &tmp, q->st.curr_frame);
+		return pl_success;
+	}
+
+	if (!strcmp(GET_STR(p1), "runtime")) {
+		uint64_t now = get_time_in_usec();
+		double elapsed = now - q->time_started;
+		cell tmp;
+		make_int(&tmp, elapsed/1000);
+		allocate_list(q, &tmp);
+		append_list(q, &tmp);
+		make_literal(&tmp, g_nil_s);
+		cell *l = end_list(q);
+		may_ptr_error(l);
+		return unify(q, p2, p2_ctx, l, q->st.curr_frame);
+	}
+
+	return pl_failure;
+}
+
+static USE_RESULT pl_status fn_garbage_collect_0(query *q)
+{
+	collect_heap(q);
+	return pl_success;
+}
+
+// Tabling. Calls to a tabled predicate are looked up in a trie keyed
+// by call variant and answer tables are filled by re-running the
+// clauses to a fixpoint (linear tabling). A call to a table that is
+// still being evaluated consumes the answers found so far. The leader
+// of a strongly connected component repeats its evaluation until no
+// table gains a new answer and then completes the whole component...
+
+enum { TBL_INCOMPLETE, TBL_EVALUATING, TBL_COMPLETE };
+
+typedef struct {
+	uint64_t val;
+	idx_t parent, child;
+	uint8_t val_type, arity;
+} trie_edge;
+
+typedef struct {
+	unsigned nbr_vars;
+	cell cells[];
+} tbl_answer;
+
+typedef struct {
+	tbl_answer **answers;
+	idx_t nbr_answers, max_answers, root, depth, low, scc_pos;
+	unsigned status;
+} tbl_table;
+
+struct tbl_store_ {
+	trie_edge *edges;
+	idx_t *node_table;
+	tbl_table *tables;
+	idx_t *stack, *scc;
+	idx_t nbr_edges, max_edges, nbr_nodes, max_nodes;
+	idx_t nbr_tables, max_tables, sp, max_stack, scc_sp, max_scc;
+	uint64_t changes, consumers;
+};
+
+static uint64_t trie_hash(idx_t parent, uint8_t val_type, uint8_t arity, uint64_t val)
+{
+	uint64_t k = val ^ ((uint64_t)parent << 24) ^ ((uint64_t)val_type << 8) ^ arity;
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdULL;
+	k ^= k >> 33;
+	return k;
+}
+
+static idx_t new_trie_node(tbl_store *s)
+{
+	if (s->nbr_nodes == s->max_nodes) {
+		s->max_nodes = s->max_nodes ? s->max_nodes * 2 : 1024;
+		s->node_table = realloc(s->node_table, sizeof(idx_t)*s->max_nodes);
+		ensure(s->node_table);
+	}
+
+	s->node_table[s->nbr_nodes] = ERR_IDX;
+	return s->nbr_nodes++;
+}
+
+static void grow_trie(tbl_store *s)
+{
+	trie_edge *save = s->edges;
+	idx_t save_max = s->max_edges;
+	s->max_edges = s->max_edges ? s->max_edges * 2 : 1024;
+	s->edges = calloc(s->max_edges, sizeof(trie_edge));
+	ensure(s->edges);
+	idx_t mask = s->max_edges - 1;
+
+	for (idx_t j = 0; j < save_max; j++) {
+		trie_edge *e = &save[j];
+
+		if (!e->child)
+			continue;
+
+		idx_t i = trie_hash(e->parent, e->val_type, e->arity, e->val) & mask;
+
+		while (s->edges[i].child)
+			i = (i + 1) & mask;
+
+		s->edges[i] = *e;
+	}
+
+	free(save);
+}
+
+// Node 0 is the root of the call trie so no edge leads to it and
+// a zero child marks an empty slot...
+
+static idx_t trie_step(tbl_store *s, idx_t parent, uint8_t val_type, uint8_t arity, uint64_t val, bool *created)
+{
+	if (((s->nbr_edges + 1) * 2) >= s->max_edges)
+		grow_trie(s);
+
+	idx_t mask = s->max_edges - 1;
+	idx_t i = trie_hash(parent, val_type, arity, val) & mask;
+
+	for (; s->edges[i].child; i = (i + 1) & mask) {
+		trie_edge *e = &s->edges[i];
+
+		if ((e->parent == parent) && (e->val_type == val_type)
+			&& (e->arity == arity) && (e->val == val)) {
+			*created = false;
+			return e->child;
+		}
+	}
+
+	trie_edge *e = &s->edges[i];
+	e->parent = parent;
+	e->val_type = val_type;
+	e->arity = arity;
+	e->val = val;
+	e->child = new_trie_node(s);
+	s->nbr_edges++;
+	*created = true;
+	return e->child;
+}
+
+// Atoms and strings are keyed by their length then their bytes eight
+// at a time, so an atom and a cstring of the same name share a path,
+// embedded NULs count and nothing is added to the atom table. Chunk
+// edges are typed TYPE_EMPTY, which no term has...
+
+static idx_t trie_text(tbl_store *s, idx_t node, uint8_t val_type, const char *src, size_t len, bool *created)
+{
+	node = trie_step(s, node, val_type, 0, len, created);
+
+	for (size_t i = 0; i < len; i += sizeof(uint64_t)) {
+		uint64_t val = 0;
+		size_t n = (len - i) < sizeof(val) ? (len - i) : sizeof(val);
+		memcpy(&val, src + i, n);
+		node = trie_step(s, node, TYPE_EMPTY, 0, val, created);
+	}
+
+	return node;
+}
+
+// Variables are numbered in order of first occurrence (in tab1) so
+// that all variants of a term follow the same path...
+
+static idx_t trie_term(query *q, tbl_store *s, idx_t node, cell *c, idx_t c_ctx, unsigned depth, bool *created)
+{
+	if (depth > MAX_DEPTH) {
+		q->cycle_error = true;
+		return ERR_IDX;
+	}
+
+	c = deref(q, c, c_ctx);
+	c_ctx = q->latest_ctx;
+	uint8_t val_type = c->val_type, arity = 0;
+	uint64_t val;
+
+	if (is_variable(c)) {
+		prolog *pl = q->m->pl;
+		frame *g = GET_FRAME(c_ctx);
+		idx_t slot_nbr = GET_SLOT(g, c->var_nbr) - q->slots;
+		idx_t i = 0;
+
+		while ((i < pl->tab_idx) && (pl->tab1[i] != slot_nbr))
+			i++;
+
+		if (i == pl->tab_idx) {
+			if (i == (sizeof(pl->tab1)/sizeof(pl->tab1[0])))
+				return ERR_IDX;
+
+			pl->tab1[pl->tab_idx++] = slot_nbr;
+		}
+
+		val = i;
+	} else if (is_literal(c) && c->arity) {
+		arity = c->arity;
+		val = c->val_off;
+	} else if (is_literal(c) || is_cstring(c)) {
+		return trie_text(s, node, is_string(c) ? TYPE_CSTRING : TYPE_LITERAL,
+			GET_STR(c), LEN_STR(c), created);
+	} else if (is_float(c)) {
+		memcpy(&val, &c->val_flt, sizeof(val));
+	} else {
+		val = (uint64_t)c->val_num;
+
+#if USE_INT128
+		node = trie_step(s, node, val_type, 1, (uint64_t)(c->val_num >> 64), created);
+		node = trie_step(s, node, val_type, 2, (uint64_t)(c->val_den >> 64), created);
+#endif
+
+		if (c->val_den != 1) {
+			node = trie_step(s, node, val_type, 3, val, created);
+			val = (uint64_t)c->val_den;
+			arity = 4;
+		}
+	}
+
+	node = trie_step(s, node, val_type, arity, val, created);
+
+	if (!is_literal(c))
+		return node;
+
+	arity = c->arity;
+
+	for (cell *arg = c + 1; arity--; arg += arg->nbr_cells) {
+		node = trie_term(q, s, node, arg, c_ctx, depth+1, created);
+
+		if (node == ERR_IDX)
+			return ERR_IDX;
+	}
+
+	return node;
+}
+
+static idx_t trie_insert(query *q, tbl_store *s, idx_t root, cell *c, idx_t c_ctx, bool *created)
+{
+	q->m->pl->tab_idx = 0;
+	q->cycle_error = false;
+	return trie_term(q, s, root, c, c_ctx, 0, created);
+}
+
+// An answer is stored with its variables renumbered from zero, in
+// the order given by the trie walk just done...
+
+static void copy_answer(query *q, cell **buf, idx_t *nbr, idx_t *max, cell *c, idx_t c_ctx)
+{
+	c = deref(q, c, c_ctx);
+	c_ctx = q->latest_ctx;
+
+	if (*nbr == *max) {
+		*max *= 2;
+		*buf = realloc(*buf, sizeof(cell)*(*max));
+		ensure(*buf);
+	}
+
+	idx_t save_nbr = (*nbr)++;
+	cell *dst = *buf + save_nbr;
+	*dst = *c;
+
+	if (is_variable(c)) {
+		prolog *pl = q->m->pl;
+		frame *g = GET_FRAME(c_ctx);
+		idx_t slot_nbr = GET_SLOT(g, c->var_nbr) - q->slots;
+		idx_t i = 0;
+
+		while (pl->tab1[i] != slot_nbr)
+			i++;
+
+		dst->var_nbr = i;
+		dst->flags = FLAG2_FRESH;
+		dst->attrs = NULL;
+		return;
+	}
+
+	INCR_REF(dst);
+
+	if (!is_literal(c) || !c->arity)
+		return;
+
+	unsigned arity = c->arity;
+
+	for (cell *arg = c + 1; arity--; arg += arg->nbr_cells)
+		copy_answer(q, buf, nbr, max, arg, c_ctx);
+
+	(*buf)[save_nbr].nbr_cells = *nbr - save_nbr;
+}
+
+static tbl_store *get_tables(prolog *pl)
+{
+	if (!pl->tables) {
+		pl->tables = calloc(1, sizeof(tbl_store));
+		ensure(pl->tables);
+		new_trie_node(pl->tables);
+	}
+
+	return pl->tables;
+}
+
+void destroy_tables(prolog *pl)
+{
+	tbl_store *s = pl->tables;
+
+	if (!s)
+		return;
+
+	for (idx_t i = 0; i < s->nbr_tables; i++) {
+		tbl_table *t = &s->tables[i];
+
+		for (idx_t j = 0; j < t->nbr_answers; j++) {
+			tbl_answer *a = t->answers[j];
+			idx_t nbr_cells = a->cells->nbr_cells;
+
+			for (cell *c = a->cells; nbr_cells--; c++) {
+				DECR_REF(c);
+			}
+
+			free(a);
+		}
+
+		free(t->answers);
+	}
+
+	free(s->edges);
+	free(s->node_table);
+	free(s->tables);
+	free(s->stack);
+	free(s->scc);
+	free(s);
+	pl->tables = NULL;
+}
+
+static tbl_table *get_table(query *q, cell *c)
+{
+	tbl_store *s = q->m->pl->tables;
+
+	if (!s || !is_integer(c) || (c->val_num < 0) || (c->val_num >= s->nbr_tables))
+		return NULL;
+
+	return &s->tables[c->val_num];
+}
+
+static USE_RESULT pl_status fn_sys_tbl_variant_3(query *q)
+{
+	GET_FIRST_ARG(p1,callable);
+	GET_NEXT_ARG(p2,variable);
+	GET_NEXT_ARG(p3,variable);
+	tbl_store *s = get_tables(q->m->pl);
+	bool created;
+	idx_t node = trie_insert(q, s, 0, p1, p1_ctx, &created);
+
+	if (node == ERR_IDX)
+		return throw_error(q, p1, "resource_error", q->cycle_error ? "cyclic_term" : "too_many_vars");
+
+	if (s->node_table[node] == ERR_IDX) {
+		if (s->nbr_tables == s->max_tables) {
+			s->max_tables = s->max_tables ? s->max_tables * 2 : 64;
+			s->tables = realloc(s->tables, sizeof(tbl_table)*s->max_tables);
+			ensure(s->tables);
+		}
+
+		tbl_table *t = &s->tables[s->nbr_tables];
+		memset(t, 0, sizeof(tbl_table));
+		t->root = new_trie_node(s);
+		t->status = TBL_INCOMPLETE;
+		s->node_table[node] = s->nbr_tables++;
+	}
+
+	idx_t n = s->node_table[node];
+	tbl_table *t = &s->tables[n];
+	const char *status = "incomplete";
+
+	if (t->status == TBL_COMPLETE)
+		status = "complete";
+	else if (t->status == TBL_EVALUATING) {
+		tbl_table *top = &s->tables[s->stack[s->sp-1]];
+
+		if (t->depth < top->low)
+			top->low = t->depth;
+
+		s->consumers++;
+		status = "evaluating";
+	}
+
+	cell tmp;
+	make_int(&tmp, n);
+	set_var(q, p2, p2_ctx, &tmp, q->st.curr_frame);
+	make_literal(&tmp, index_from_pool(q->m->pl, status));
+	set_var(q, p3, p3_ctx, &tmp, q->st.curr_frame);
+	return pl_success;
+}
+
+static USE_RESULT pl_status fn_sys_tbl_push_1(query *q)
+{
+	GET_FIRST_ARG(p1,integer);
+	tbl_table *t = get_table(q, p1);
+	if (!t) return pl_failure;
+	tbl_store *s = q->m->pl->tables;
+
+	if (s->sp == s->max_stack) {
+		s->max_stack = s->max_stack ? s->max_stack * 2 : 64;
+		s->stack = realloc(s->stack, sizeof(idx_t)*s->max_stack);
+		ensure(s->stack);
+	}
+
+	if (s->scc_sp == s->max_scc) {
+		s->max_scc = s->max_scc ? s->max_scc * 2 : 64;
+		s->scc = realloc(s->scc, sizeof(idx_t)*s->max_scc);
+		ensure(s->scc);
+	}
+
+	t->status = TBL_EVALUATING;
+	t->depth = t->low = s->sp;
+	t->scc_pos = s->scc_sp;
+	s->stack[s->sp++] = p1->val_num;
+	s->scc[s->scc_sp++] = p1->val_num;
+	return pl_success;
+}
+
+// A leader completes every table evaluated since it was pushed, any
+// other table stays incomplete and passes its dependency down...
+
+static USE_RESULT pl_status fn_sys_tbl_pop_1(query *q)
+{
+	GET_FIRST_ARG(p1,integer);
+	tbl_table *t = get_table(q, p1);
+	if (!t) return pl_failure;
+	tbl_store *s = q->m->pl->tables;
+
+	if (!s->sp || (s->stack[s->sp-1] != p1->val_num)) {
+		t->status = TBL_INCOMPLETE;
+		return pl_success;
+	}
+
+	s->sp--;
+
+	if (t->low == t->depth) {
+		for (idx_t i = t->scc_pos; i < s->scc_sp; i++)
+			s->tables[s->scc[i]].status = TBL_COMPLETE;
+
+		s->scc_sp = t->scc_pos;
+		return pl_success;
+	}
+
+	t->status = TBL_INCOMPLETE;
+	tbl_table *parent = &s->tables[s->stack[s->sp-1]];
+
+	if (t->low < parent->low)
+		parent->low = t->low;
+
+	return pl_success;
+}
+
+// After an exception the tables from this one up are left incomplete
+// and will be evaluated afresh when next called...
+
+static USE_RESULT pl_status fn_sys_tbl_abandon_1(query *q)
+{
+	GET_FIRST_ARG(p1,integer);
+	tbl_table *t = get_table(q, p1);
+	if (!t) return pl_failure;
+	tbl_store *s = q->m->pl->tables;
+
+	if ((t->status != TBL_EVALUATING) || (t->scc_pos > s->scc_sp))
+		return pl_success;
+
+	for (idx_t i = t->scc_pos; i < s->scc_sp; i++)
+		s->tables[s->scc[i]].status = TBL_INCOMPLETE;
+
+	s->sp = t->depth;
+	s->scc_sp = t->scc_pos;
+	return pl_success;
+}
+
+static USE_RESULT pl_status fn_sys_tbl_add_answer_2(query *q)
+{
+	GET_FIRST_ARG(p1,integer);
+	GET_NEXT_ARG(p2,callable);
+	tbl_table *t = get_table(q, p1);
+	if (!t) return pl_failure;
+	tbl_store *s = q->m->pl->tables;
+	bool created;
+
+	if (trie_insert(q, s, t->root, p2, p2_ctx, &created) == ERR_IDX)
+		return throw_error(q, p2, "resource_error", q->cycle_error ? "cyclic_term" : "too_many_vars");
+
+	if (!created)
+		return pl_success;
+
+	idx_t nbr = 0, max = 64;
+	cell *buf = malloc(sizeof(cell)*max);
+	ensure(buf);
+	copy_answer(q, &buf, &nbr, &max, p2, p2_ctx);
+	tbl_answer *a = malloc(sizeof(tbl_answer)+(sizeof(cell)*nbr));
+	ensure(a);
+	a->nbr_vars = q->m->pl->tab_idx;
+	memcpy(a->cells, buf, sizeof(cell)*nbr);
+	free(buf);
+
+	if (t->nbr_answers == t->max_answers) {
+		t->max_answers = t->max_answers ? t->max_answers * 2 : 16;
+		t->answers = realloc(t->answers, sizeof(tbl_answer*)*t->max_answers);
+		ensure(t->answers);
+	}
+
+	t->answers[t->nbr_answers++] = a;
+	s->changes++;
+	return pl_success;
+}
+
+// Fetch the nth answer, and whether there might be more to follow
+// (there might always be for an incomplete table)...
+
+static USE_RESULT pl_status fn_sys_tbl_answer_4(query *q)
+{
+	GET_FIRST_ARG(p1,integer);
+	GET_NEXT_ARG(p2,integer);
+	GET_NEXT_ARG(p3,any);
+	GET_NEXT_ARG(p4,variable);
+	tbl_table *t = get_table(q, p1);
+
+	if (!t || (p2->val_num < 0) || (p2->val_num >= t->nbr_answers))
+		return pl_failure;
+
+	bool more = (t->status != TBL_COMPLETE) || ((p2->val_num + 1) < t->nbr_answers);
+	cell tmp2;
+	make_literal(&tmp2, more ? g_true_s : g_false_s);
+	set_var(q, p4, p4_ctx, &tmp2, q->st.curr_frame);
+
+	tbl_answer *a = t->answers[p2->val_num];
+	idx_t nbr_cells = a->cells->nbr_cells;
+	cell *tmp = alloc_on_heap(q, nbr_cells);
+	may_ptr_error(tmp);
+	safe_copy_cells(tmp, a->cells, nbr_cells);
+
+	if (a->nbr_vars) {
+		unsigned var_nbr = create_vars(q, a->nbr_vars);
+
+		for (cell *c = tmp; nbr_cells--; c++) {
+			if (is_variable(c))
+				c->var_nbr += var_nbr;
+		}
+	}
+
+	return unify(q, p3, p3_ctx, tmp, q->st.curr_frame);
+}
+
+// Another pass is only needed if there were new answers and some
+// call in the last one read from a table still being evaluated...
+
+static USE_RESULT pl_status fn_sys_tbl_changes_2(query *q)
+{
+	GET_FIRST_ARG(p1,variable);
+	GET_NEXT_ARG(p2,variable);
+	tbl_store *s = get_tables(q->m->pl);
+	cell tmp;
+	make_int(&tmp, s->changes);
+	set_var(q, p1, p1_ctx, &tmp, q->st.curr_frame);
+	make_int(&tmp, s->consumers);
+	set_var(q, p2, p2_ctx, &tmp, q->st.curr_frame);
+	return pl_success;
+}
+
+static USE_RESULT pl_status fn_abolish_all_tables_0(query *q)
+{
+	tbl_store *s = q->m->pl->tables;
+
+	if (s && s->sp) {
+		cell tmp;
+		make_literal(&tmp, index_from_pool(q->m->pl, "abolish_all_tables"));
+		return throw_error(q, &tmp, "permission_error", "modify,table_space");
+	}
+
+	destroy_tables(q->m->pl);
+	return pl_success;
+}
+
+// Global variables are kept per prolog instance in a hash on the
+// key's atom. Each value is a flat copy with its variables numbered
+// from zero, given fresh ones each time it is read...
+
+static gvar_slot *find_gvar(prolog *pl, idx_t key)
+{
+	if (!pl->gvars_size)
+		return NULL;
+
+	idx_t mask = pl->gvars_size - 1;
+
+	for (idx_t i = POOL_HDR(pl, key)->hash & mask; pl->gvars[i].key; i = (i + 1) & mask) {
+		if (pl->gvars[i].key == key)
+			return &pl->gvars[i];
+	}
+
+	return NULL;
+}
+
+static gvar_slot *add_gvar(prolog *pl, idx_t key)
+{
+	gvar_slot *slot = find_gvar(pl, key);
+
+	if (slot)
+		return slot;
+
+	if (((pl->gvars_count + 1) * 2) > pl->gvars_size) {
+		idx_t size = pl->gvars_size ? pl->gvars_size * 2 : 64;
+		gvar_slot *tab = calloc(size, sizeof(gvar_slot));
+		if (!tab) return NULL;
+
+		for (idx_t i = 0; i < pl->gvars_size; i++) {
+			const gvar_slot *old = &pl->gvars[i];
+
+			if (!old->key)
+				continue;
+
+			idx_t j = POOL_HDR(pl, old->key)->hash & (size - 1);
+
+			while (tab[j].key)
+				j = (j + 1) & (size - 1);
+
+			tab[j] = *old;
+		}
+
+		free(pl->gvars);
+		pl->gvars = tab;
+		pl->gvars_size = size;
+	}
+
+	idx_t mask = pl->gvars_size - 1;
+	idx_t i = POOL_HDR(pl, key)->hash & mask;
+
+	while (pl->gvars[i].key)
+		i = (i + 1) & mask;
+
+	pl->gvars_count++;
+	slot = &pl->gvars[i];
+	slot->key = key;
+	slot->val = NULL;
+	return slot;
+}
+
+static gvar_value *make_gvar_value(query *q, const cell *tmp)
+{
+	gvar_value *v = malloc(sizeof(gvar_value)+(sizeof(cell)*tmp->nbr_cells));
+	if (!v) return NULL;
+	v->nbr_vars = q->m->pl->varno;
+	safe_copy_cells(v->cells, tmp, tmp->nbr_cells);
+	return v;
+}
+
+static gvar_value *dup_gvar_value(const gvar_value *v)
+{
+	gvar_value *v2 = malloc(sizeof(gvar_value)+(sizeof(cell)*v->cells->nbr_cells));
+	if (!v2) return NULL;
+	v2->nbr_vars = v->nbr_vars;
+	safe_copy_cells(v2->cells, v->cells, v->cells->nbr_cells);
+	return v2;
+}
+
+static void free_gvar_value(gvar_value *v)
+{
+	if (!v)
+		return;
+
+	idx_t nbr_cells = v->cells->nbr_cells;
+
+	for (cell *c = v->cells; nbr_cells--; c++) {
+		DECR_REF(c);
+	}
+
+	free(v);
+}
+
+static pl_status unify_gvar_value(query *q, cell *p1, cell *p2, idx_t p2_ctx, const gvar_value *v)
+{
+	idx_t nbr_cells = v->cells->nbr_cells;
+
+	if (!v->nbr_vars && (nbr_cells == 1))
+		return unify(q, p2, p2_ctx, (cell*)v->cells, q->st.curr_frame);
+
+	if (v->nbr_vars && ((GET_CURR_FRAME()->nbr_vars + v->nbr_vars) >= MAX_VARS))
+		return throw_error(q, p1, "resource_error", "too_many_vars");
+
+	cell *tmp = alloc_on_heap(q, nbr_cells);
+	may_ptr_error(tmp);
+	safe_copy_cells(tmp, v->cells, nbr_cells);
+
+	if (v->nbr_vars)
+		renumber_vars(tmp, create_vars(q, v->nbr_vars));
+
+	return unify(q, p2, p2_ctx, tmp, q->st.curr_frame);
+}
+
+// Hash tables are referenced by a '<$hashtable>'(Id) handle, with
+// the ids never reused. Keys must be ground and are found by their
+// structural hash then compare()...
+
+typedef struct {
+	uint64_t hash;
+	gvar_value *key, *val;
+} ht_entry;
+
+typedef struct {
+	ht_entry *entries;
+	idx_t size, count;
+} hashtable;
+
+static int ht_compkey(__attribute__((unused)) const void *p, const void *k1, const void *k2)
+{
+	size_t id1 = (size_t)k1, id2 = (size_t)k2;
+	return id1 < id2 ? -1 : id1 > id2 ? 1 : 0;
+}
+
+static void free_hashtable(hashtable *ht)
+{
+	for (idx_t i = 0; i < ht->size; i++) {
+		free_gvar_value(ht->entries[i].key);
+		free_gvar_value(ht->entries[i].val);
+	}
+
+	free(ht->entries);
+	free(ht);
+}
+
+static hashtable *find_hashtable(prolog *pl, uint64_t id)
+{
+	const void *ht;
+
+	if (!pl->hashtables || !sl_get(pl->hashtables, (void*)(size_t)id, &ht))
+		return NULL;
+
+	return (hashtable*)ht;
+}
+
+static void drop_hashtable(prolog *pl, uint64_t id)
+{
+	hashtable *ht = find_hashtable(pl, id);
+
+	if (!ht)
+		return;
+
+	sl_del(pl->hashtables, (void*)(size_t)id);
+	free_hashtable(ht);
+}
+
+static uint64_t ht_mix(uint64_t h, uint64_t v)
+{
+	h ^= v + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+	return h;
+}
+
+static uint64_t ht_text(const char *src, size_t len, unsigned arity)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	while (len--) {
+		h ^= (uint8_t)*src++;
+		h *= 0x100000001b3ULL;
+	}
+
+	return ht_mix(h, arity);
+}
+
+// Lists are folded left to right, with a string taken as the list
+// of its characters so that the two hash (and compare) the same...
+
+static uint64_t hash_term(query *q, cell *c, idx_t c_ctx, unsigned depth)
+{
+	if (depth > MAX_DEPTH) {
+		q->cycle_error = true;
+		return 0;
+	}
+
+	uint64_t h = 0, val;
+
+	for (;;) {
+		c = deref(q, c, c_ctx);
+		c_ctx = q->latest_ctx;
+
+		if (is_string(c)) {
+			const char *src = GET_STR(c), *end = src + LEN_STR(c);
+
+			while (src < end) {
+				size_t len = len_char_utf8(src);
+				h = ht_mix(h, ht_mix(0, ht_text(src, len, 0)));
+				src += len;
+			}
+
+			return ht_mix(h, ht_text("[]", 2, 0));
+		}
+
+		if (!is_literal(c) || (c->arity != 2) || (c->val_off != g_dot_s))
+			break;
+
+		h = ht_mix(h, hash_term(q, c+1, c_ctx, depth+1));
+		c += 1 + c[1].nbr_cells;
+	}
+
+	if (is_literal(c) || is_cstring(c)) {
+		val = ht_text(GET_STR(c), LEN_STR(c), c->arity);
+		unsigned arity = is_literal(c) ? c->arity : 0;
+
+		for (cell *arg = c + 1; arity--; arg += arg->nbr_cells)
+			val = ht_mix(val, hash_term(q, arg, c_ctx, depth+1));
+	} else if (is_float(c)) {
+		// -0.0 compares equal to 0.0 so must hash the same...
+
+		double d = c->val_flt == 0.0 ? 0.0 : c->val_flt;
+		memcpy(&val, &d, sizeof(val));
+		val = ht_mix(val, c->val_type);
+	} else {
+		cell tmp = *c;
+
+		if (is_rational(&tmp) && (tmp.val_den != 1))
+			do_reduce(&tmp);
+
+		val = ht_mix(ht_mix((uint64_t)tmp.val_num, (uint64_t)tmp.val_den), tmp.val_type);
+	}
+
+	return ht_mix(h, val);
+}
+
+// The combining above leaves the low bits of nearby integers close
+// together, so mix the result down before it picks a slot...
+
+static uint64_t term_hash(query *q, cell *c, idx_t c_ctx)
+{
+	uint64_t h = hash_term(q, c, c_ctx, 0);
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+static ht_entry *ht_find(query *q, hashtable *ht, cell *key, idx_t key_ctx, uint64_t hash)
+{
+	if (!ht->size)
+		return NULL;
+
+	idx_t mask = ht->size - 1;
+
+	for (idx_t i = hash & mask; ht->entries[i].key; i = (i + 1) & mask) {
+		ht_entry *e = &ht->entries[i];
+
+		if ((e->hash == hash) && !compare(q, e->key->cells, q->st.curr_frame, key, key_ctx, 0))
+			return e;
+	}
+
+	return NULL;
+}
+
+static ht_entry *ht_insert(hashtable *ht, uint64_t hash, gvar_value *key, gvar_value *val)
+{
+	if (((ht->count + 1) * 2) > ht->size) {
+		idx_t size = ht->size ? ht->size * 2 : 16;
+		ht_entry *tab = calloc(size, sizeof(ht_entry));
+		if (!tab) return NULL;
+
+		for (idx_t i = 0; i < ht->size; i++) {
+			const ht_entry *old = &ht->entries[i];
+
+			if (!old->key)
+				continue;
+
+			idx_t j = old->hash & (size - 1);
+
+			while (tab[j].key)
+				j = (j + 1) & (size - 1);
+
+			tab[j] = *old;
+		}
+
+		free(ht->entries);
+		ht->entries = tab;
+		ht->size = size;
+	}
+
+	idx_t mask = ht->size - 1;
+	idx_t i = hash & mask;
+
+	while (ht->entries[i].key)
+		i = (i + 1) & mask;
+
+	ht_entry *e = &ht->entries[i];
+	e->hash = hash;
+	e->key = key;
+	e->val = val;
+	ht->count++;
+	return e;
+}
+
+// Entries after the hole that would no longer be reachable from
+// their home slot are shifted back into it...
+
+static void ht_remove(hashtable *ht, ht_entry *e)
+{
+	idx_t mask = ht->size - 1, i = e - ht->entries, j = i;
+	memset(e, 0, sizeof(ht_entry));
+	ht->count--;
+
+	for (j = (j + 1) & mask; ht->entries[j].key; j = (j + 1) & mask) {
+		idx_t k = ht->entries[j].hash & mask;
+
+		if ((j > i) ? ((k > i) && (k <= j)) : ((k > i) || (k <= j)))
 			continue;
 
-		try_me(q, g->nbr_vars*2);
+		ht->entries[i] = ht->entries[j];
+		memset(&ht->entries[j], 0, sizeof(ht_entry));
+		i = j;
+	}
+}
+
+// Backtrackable updates push a record here along with a frameless
+// trail entry, and unwinding to that entry undoes the record. Any
+// record whose trail entry has since been discarded is stale...
+
+static void free_undo(undo_rec *u)
+{
+	free_gvar_value(u->key);
+	free_gvar_value(u->val);
+}
+
+static void drop_undos(query *q, idx_t tp)
+{
+	while (q->nbr_undos && (q->undos[q->nbr_undos-1].tp >= tp))
+		free_undo(&q->undos[--q->nbr_undos]);
+}
+
+static undo_rec *push_undo(query *q, enum undo_kind kind)
+{
+	drop_undos(q, q->st.tp);
+
+	if (q->nbr_undos == q->undos_size) {
+		idx_t size = q->undos_size ? q->undos_size * 2 : 16;
+		undo_rec *undos = realloc(q->undos, sizeof(undo_rec)*size);
+		if (!undos) return NULL;
+		q->undos = undos;
+		q->undos_size = size;
+	}
+
+	undo_rec *u = &q->undos[q->nbr_undos++];
+	memset(u, 0, sizeof(undo_rec));
+	u->kind = kind;
+	u->tp = q->st.tp;
+	return u;
+}
+
+static void undo_ht_set(query *q, undo_rec *u)
+{
+	hashtable *ht = find_hashtable(q->m->pl, u->ht);
+
+	if (!ht)
+		return;
+
+	q->cycle_error = false;
+	uint64_t hash = term_hash(q, u->key->cells, q->st.curr_frame);
+	ht_entry *e = ht_find(q, ht, u->key->cells, q->st.curr_frame, hash);
+
+	if (e && !u->val) {
+		free_gvar_value(e->key);
+		free_gvar_value(e->val);
+		ht_remove(ht, e);
+	} else if (e) {
+		free_gvar_value(e->val);
+		e->val = u->val;
+		u->val = NULL;
+	} else if (u->val && ht_insert(ht, hash, u->key, u->val))
+		u->key = u->val = NULL;
+}
+
+void undo_trailed(query *q, idx_t tp)
+{
+	drop_undos(q, tp+1);
+
+	if (!q->nbr_undos || (q->undos[q->nbr_undos-1].tp != tp))
+		return;
+
+	undo_rec *u = &q->undos[--q->nbr_undos];
+
+	if (u->kind == UNDO_GVAR) {
+		gvar_slot *slot = find_gvar(q->m->pl, u->atom);
+
+		if (slot) {
+			free_gvar_value(slot->val);
+			slot->val = u->val;
+			u->val = NULL;
+		}
+	} else if (u->kind == UNDO_HT_SET)
+		undo_ht_set(q, u);
+	else if (u->kind == UNDO_HT_NEW)
+		drop_hashtable(q->m->pl, u->ht);
+
+	free_undo(u);
+}
+
+void free_undos(query *q)
+{
+	drop_undos(q, 0);
+	free(q->undos);
+}
+
+void destroy_globals(prolog *pl)
+{
+	for (idx_t i = 0; i < pl->gvars_size; i++)
+		free_gvar_value(pl->gvars[i].val);
+
+	free(pl->gvars);
+	pl->gvars = NULL;
+	pl->gvars_size = pl->gvars_count = 0;
+
+	if (!pl->hashtables)
+		return;
+
+	sliter *iter = sl_first(pl->hashtables);
+	void *ht;
+
+	while (sl_next(iter, &ht))
+		free_hashtable(ht);
+
+	sl_destroy(pl->hashtables);
+	pl->hashtables = NULL;
+}
+
+static pl_status set_gvar(query *q, cell *p1, cell *p2, idx_t p2_ctx, bool backtrackable)
+{
+	idx_t key = index_from_pool(q->m->pl, GET_STR(p1));
+	may_idx_error(key);
+	cell *tmp = deep_raw_copy_to_tmp(q, p2, p2_ctx);
+	may_ptr_error(tmp);
+
+	if (tmp == ERR_CYCLE_CELL)
+		return throw_error(q, p2, "resource_error", "cyclic_term");
+
+	gvar_value *v = make_gvar_value(q, tmp);
+	may_ptr_error(v);
+	gvar_slot *slot = add_gvar(q->m->pl, key);
+	may_ptr_error(slot, free_gvar_value(v));
+
+	if (!backtrackable || !q->cp) {
+		free_gvar_value(slot->val);
+		slot->val = v;
+		return pl_success;
+	}
+
+	undo_rec *u = push_undo(q, UNDO_GVAR);
+	may_ptr_error(u, free_gvar_value(v));
+	u->atom = key;
+	u->val = slot->val;
+	slot->val = v;
+	return trail_undo(q);
+}
+
+static USE_RESULT pl_status fn_nb_setval_2(query *q)
+{
+	GET_FIRST_ARG(p1,atom);
+	GET_NEXT_ARG(p2,any);
+	return set_gvar(q, p1, p2, p2_ctx, false);
+}
+
+static USE_RESULT pl_status fn_b_setval_2(query *q)
+{
+	GET_FIRST_ARG(p1,atom);
+	GET_NEXT_ARG(p2,any);
+	return set_gvar(q, p1, p2, p2_ctx, true);
+}
+
+static USE_RESULT pl_status fn_nb_getval_2(query *q)
+{
+	GET_FIRST_ARG(p1,atom);
+	GET_NEXT_ARG(p2,any);
+	idx_t key = is_in_pool(q->m->pl, GET_STR(p1));
+	const gvar_slot *slot = key != ERR_IDX ? find_gvar(q->m->pl, key) : NULL;
+
+	if (!slot || !slot->val)
+		return throw_error(q, p1, "existence_error", "variable");
+
+	return unify_gvar_value(q, p1, p2, p2_ctx, slot->val);
+}
+
+static pl_status get_hashtable(query *q, cell *p1, idx_t p1_ctx, hashtable **ht, uint64_t *id)
+{
+	if (is_variable(p1))
+		return throw_error(q, p1, "instantiation_error", "not_sufficiently_instantiated");
+
+	cell *c = is_structure(p1) && (p1->arity == 1) ? deref(q, p1+1, p1_ctx) : NULL;
+
+	if (!c || !is_integer(c) || strcmp(GET_STR(p1), "<$hashtable>"))
+		return throw_error(q, p1, "type_error", "hashtable");
+
+	*id = c->val_num;
+
+	if (!(*ht = find_hashtable(q->m->pl, *id)))
+		return throw_error(q, p1, "existence_error", "hashtable");
+
+	return pl_success;
+}
+
+static pl_status get_hashtable_key(query *q, cell *p1, idx_t p1_ctx, uint64_t *hash)
+{
+	q->cycle_error = false;
+
+	if (has_vars(q, p1, p1_ctx, 0))
+		return throw_error(q, p1, "instantiation_error", "not_sufficiently_instantiated");
+
+	*hash = term_hash(q, p1, p1_ctx);
+
+	if (q->cycle_error)
+		return throw_error(q, p1, "resource_error", "cyclic_term");
+
+	return pl_success;
+}
+
+static USE_RESULT pl_status fn_sys_ht_new_1(query *q)
+{
+	GET_FIRST_ARG(p1,variable);
+	prolog *pl = q->m->pl;
+
+	if (!pl->hashtables) {
+		pl->hashtables = sl_create(ht_compkey);
+		may_ptr_error(pl->hashtables);
+	}
+
+	hashtable *ht = calloc(1, sizeof(hashtable));
+	may_ptr_error(ht);
+	uint64_t id = ++pl->ht_seq;
+	sl_set(pl->hashtables, (void*)(size_t)id, ht);
+
+	if (q->cp) {
+		undo_rec *u = push_undo(q, UNDO_HT_NEW);
+		may_ptr_error(u);
+		u->ht = id;
+		may_error(trail_undo(q));
+	}
+
+	cell *tmp = alloc_on_heap(q, 2);
+	may_ptr_error(tmp);
+	tmp->val_type = TYPE_LITERAL;
+	tmp->nbr_cells = 2;
+	tmp->arity = 1;
+	tmp->flags = 0;
+	tmp->val_off = index_from_pool(pl, "<$hashtable>");
+	may_idx_error(tmp->val_off);
+	make_int(tmp+1, id);
+	set_var(q, p1, p1_ctx, tmp, q->st.curr_frame);
+	return pl_success;
+}
+
+static USE_RESULT pl_status fn_sys_ht_free_1(query *q)
+{
+	GET_FIRST_ARG(p1,any);
+	hashtable *ht;
+	uint64_t id;
+	pl_status ok = get_hashtable(q, p1, p1_ctx, &ht, &id);
+
+	if (!ok || q->did_throw)
+		return ok;
+
+	drop_hashtable(q->m->pl, id);
+	return pl_success;
+}
+
+static pl_status do_ht_put(query *q, bool backtrackable)
+{
+	GET_FIRST_ARG(p1,any);
+	GET_NEXT_ARG(p2,any);
+	GET_NEXT_ARG(p3,any);
+	hashtable *ht;
+	uint64_t id, hash = 0;
+	pl_status ok = get_hashtable(q, p1, p1_ctx, &ht, &id);
+
+	if (!ok || q->did_throw)
+		return ok;
+
+	ok = get_hashtable_key(q, p2, p2_ctx, &hash);
+
+	if (!ok || q->did_throw)
+		return ok;
+
+	cell *tmp = deep_raw_copy_to_tmp(q, p3, p3_ctx);
+	may_ptr_error(tmp);
 
-		if (unify(q, p2, p2_ctx, c, q->st.fp)) {
-			c->flags |= FLAG2_PROCESSED;
-			cell *tmp = deep_copy_to_tmp(q, p1, p1_ctx, true, false);
-			may_ptr_error(tmp);
-			alloc_on_queuen(q, q->st.qnbr, tmp);
-		} else
-			unmatched = true;
+	if (tmp == ERR_CYCLE_CELL)
+		return throw_error(q, p3, "resource_error", "cyclic_term");
 
-		undo_me(q);
-	}
+	gvar_value *val = make_gvar_value(q, tmp);
+	may_ptr_error(val);
+	ht_entry *e = ht_find(q, ht, p2, p2_ctx, hash);
+	gvar_value *old = NULL;
 
-	// No solution?
+	if (e) {
+		old = e->val;
+		e->val = val;
+	} else {
+		tmp = deep_raw_copy_to_tmp(q, p2, p2_ctx);
+		may_ptr_error(tmp, free_gvar_value(val));
+		gvar_value *key = make_gvar_value(q, tmp);
+		may_ptr_error(key, free_gvar_value(val));
 
-	if (!queuen_used(q)) {
-		init_queuen(q);
-		free(q->tmpq[q->st.qnbr]);
-		q->tmpq[q->st.qnbr] = NULL;
-		drop_choice(q);
-		return pl_failure;
+		if (!(e = ht_insert(ht, hash, key, val))) {
+			free_gvar_value(key);
+			free_gvar_value(val);
+			return pl_error;
+		}
 	}
 
-	// Return matching solutions
+	if (!backtrackable || !q->cp) {
+		free_gvar_value(old);
+		return pl_success;
+	}
 
-	cell *tmp = deep_copy_to_heap(q, p2, p2_ctx, true, false);
-	may_ptr_error(tmp);
-	unpin_vars(q);
-	unify(q, p2, p2_ctx, tmp, q->st.curr_frame);
-	cell *l = convert_to_list(q, get_queuen(q), queuen_used(q));
+	undo_rec *u = push_undo(q, UNDO_HT_SET);
+	may_ptr_error(u, free_gvar_value(old));
+	u->ht = id;
+	u->val = old;
+	u->key = dup_gvar_value(e->key);
+	may_ptr_error(u->key);
+	return trail_undo(q);
+}
 
-	if (!unmatched) {
-		init_queuen(q);
-		free(q->tmpq[q->st.qnbr]);
-		q->tmpq[q->st.qnbr] = NULL;
-		drop_choice(q);
-		q->st.qnbr--;
-	}
+static USE_RESULT pl_status fn_sys_ht_put_3(query *q)
+{
+	return do_ht_put(q, true);
+}
 
-	return unify(q, p3, p3_ctx, l, q->st.curr_frame);
+static USE_RESULT pl_status fn_sys_nb_ht_put_3(query *q)
+{
+	return do_ht_put(q, false);
 }
 
-static pl_status do_op(query *q, cell *p3)
+static USE_RESULT pl_status fn_sys_ht_get_3(query *q)
 {
-	GET_FIRST_ARG(p1,integer);
-	GET_NEXT_ARG(p2,atom);
+	GET_FIRST_ARG(p1,any);
+	GET_NEXT_ARG(p2,any);
+	GET_NEXT_ARG(p3,any);
+	hashtable *ht;
+	uint64_t id, hash = 0;
+	pl_status ok = get_hashtable(q, p1, p1_ctx, &ht, &id);
 
-	if (!is_atom(p3))
-		return throw_error(q, p3, "type_error", "atom");
+	if (!ok || q->did_throw)
+		return ok;
 
-	unsigned specifier;
-	const char *spec = GET_STR(p2);
-	unsigned pri = p1->val_num;
+	ok = get_hashtable_key(q, p2, p2_ctx, &hash);
 
-	if (!strcmp(spec, "fx"))
-		specifier = OP_FX;
-	else if (!strcmp(spec, "fy"))
-		specifier = OP_FY;
-	else if (!strcmp(spec, "xf"))
-		specifier = OP_XF;
-	else if (!strcmp(spec, "xfx"))
-		specifier = OP_XFX;
-	else if (!strcmp(spec, "xfy"))
-		specifier = OP_XFY;
-	else if (!strcmp(spec, "yf"))
-		specifier = OP_YF;
-	else if (!strcmp(spec, "yfx"))
-		specifier = OP_YFX;
-	else
-		return throw_error(q, p2, "domain_error", "operator_specifier");
+	if (!ok || q->did_throw)
+		return ok;
 
-	if (pri && !strcmp(GET_STR(p3), "|") && (!IS_INFIX(specifier) || (pri < 1001)))
-		return throw_error(q, p3, "permission_error", "create,operator");
+	const ht_entry *e = ht_find(q, ht, p2, p2_ctx, hash);
 
-	if (!strcmp(GET_STR(p3), "[]"))
-		return throw_error(q, p3, "permission_error", "create,operator");
+	if (!e)
+		return pl_failure;
 
-	if (!strcmp(GET_STR(p3), "{}"))
-		return throw_error(q, p3, "permission_error", "create,operator");
+	return unify_gvar_value(q, p1, p3, p3_ctx, e->val);
+}
 
-	if (!strcmp(GET_STR(p3), ","))
-		return throw_error(q, p3, "permission_error", "modify,operator");
+static pl_status do_ht_del(query *q, bool backtrackable)
+{
+	GET_FIRST_ARG(p1,any);
+	GET_NEXT_ARG(p2,any);
+	hashtable *ht;
+	uint64_t id, hash = 0;
+	pl_status ok = get_hashtable(q, p1, p1_ctx, &ht, &id);
 
-	unsigned tmp_optype = 0;
-	get_op(q->m, GET_STR(p3), &tmp_optype, false);
+	if (!ok || q->did_throw)
+		return ok;
 
-	if (IS_INFIX(specifier) && IS_POSTFIX(tmp_optype))
-		return throw_error(q, p3, "permission_error", "create,operator");
+	ok = get_hashtable_key(q, p2, p2_ctx, &hash);
 
-	unsigned tmp_pri = get_op2(q->m, GET_STR(p3), OP_FX);
+	if (!ok || q->did_throw)
+		return ok;
 
-	if (IS_POSTFIX(specifier) && (IS_INFIX(tmp_optype) || tmp_pri))
-		return throw_error(q, p3, "permission_error", "create,operator");
+	ht_entry *e = ht_find(q, ht, p2, p2_ctx, hash);
 
-	tmp_pri = get_op2(q->m, GET_STR(p3), OP_FY);
+	if (!e)
+		return pl_failure;
 
-	if (IS_POSTFIX(specifier) && (IS_INFIX(tmp_optype) || tmp_pri))
-		return throw_error(q, p3, "permission_error", "create,operator");
+	gvar_value *key = e->key, *val = e->val;
+	ht_remove(ht, e);
 
-	if (!set_op(q->m, GET_STR(p3), specifier, pri))
-		return throw_error(q, p3, "resource_error", "too_many_ops");
+	if (!backtrackable || !q->cp) {
+		free_gvar_value(key);
+		free_gvar_value(val);
+		return pl_success;
+	}
 
-	return pl_success;
+	undo_rec *u = push_undo(q, UNDO_HT_SET);
+	may_ptr_error(u, free_gvar_value(key), free_gvar_value(val));
+	u->ht = id;
+	u->key = key;
+	u->val = val;
+	return trail_undo(q);
 }
 
-static USE_RESULT pl_status fn_iso_op_3(query *q)
+static USE_RESULT pl_status fn_sys_ht_del_2(query *q)
 {
-	GET_FIRST_ARG(p1,integer);
-	GET_NEXT_ARG(p2,atom);
-	GET_NEXT_ARG(p3,list_or_atom);
+	return do_ht_del(q, true);
+}
 
-	if (is_integer(p1) && ((p1->val_num < 0) || (p1->val_num > 1200)))
-		return throw_error(q, p1, "domain_error", "operator_priority");
+static USE_RESULT pl_status fn_sys_nb_ht_del_2(query *q)
+{
+	return do_ht_del(q, false);
+}
 
-	LIST_HANDLER(p3);
+static USE_RESULT pl_status fn_sys_ht_size_2(query *q)
+{
+	GET_FIRST_ARG(p1,any);
+	GET_NEXT_ARG(p2,integer_or_var);
+	hashtable *ht;
+	uint64_t id;
+	pl_status ok = get_hashtable(q, p1, p1_ctx, &ht, &id);
 
-	while (is_list(p3)) {
-		cell *h = LIST_HEAD(p3);
-		h = deref(q, h, p3_ctx);
+	if (!ok || q->did_throw)
+		return ok;
 
-		pl_status ok = do_op(q, h);
+	cell tmp;
+	make_int(&tmp, ht->count);
+	return unify(q, p2, p2_ctx, &tmp, q->st.curr_frame);
+}
 
-		if (ok != pl_success)
-			return ok;
+static USE_RESULT pl_status fn_sys_ht_pairs_2(query *q)
+{
+	GET_FIRST_ARG(p1,any);
+	GET_NEXT_ARG(p2,list_or_nil_or_var);
+	hashtable *ht;
+	uint64_t id;
+	pl_status ok = get_hashtable(q, p1, p1_ctx, &ht, &id);
 
-		p3 = LIST_TAIL(p3);
-		p3 = deref(q, p3, p3_ctx);
-		p3_ctx = q->latest_ctx;
+	if (!ok || q->did_throw)
+		return ok;
 
-		if (is_variable(p3))
-			return throw_error(q, p3, "instantiation_error", "atom");
+	idx_t nbr_cells = 1, nbr_vars = 0;
 
-		if (is_nil(p3))
-			return pl_success;
+	for (idx_t i = 0; i < ht->size; i++) {
+		const ht_entry *e = &ht->entries[i];
+
+		if (!e->key)
+			continue;
+
+		nbr_cells += 2 + e->key->cells->nbr_cells + e->val->cells->nbr_cells;
+		nbr_vars += e->val->nbr_vars;
 	}
 
-	if (is_atom(p3))
-		return do_op(q, p3);
+	if (nbr_vars && ((GET_CURR_FRAME()->nbr_vars + nbr_vars) >= MAX_VARS))
+		return throw_error(q, p1, "resource_error", "too_many_vars");
 
-	return pl_success;
-}
+	unsigned var_nbr = nbr_vars ? create_vars(q, nbr_vars) : 0;
+	cell *l = alloc_on_heap(q, nbr_cells);
+	may_ptr_error(l);
+	cell *dst = l;
 
-static USE_RESULT pl_status fn_erase_1(query *q)
-{
-	GET_FIRST_ARG(p1,atom);
-	uuid u;
-	uuid_from_buf(GET_STR(p1), &u);
-	clause *r = erase_from_db(q->m, &u);
-	may_ptr_error(r);
+	for (idx_t i = 0; i < ht->size; i++) {
+		const ht_entry *e = &ht->entries[i];
 
-	if (!q->m->loading && r->t.persist)
-		db_log(q, r, LOG_ERASE);
+		if (!e->key)
+			continue;
 
-	return pl_success;
+		idx_t key_cells = e->key->cells->nbr_cells, val_cells = e->val->cells->nbr_cells;
+		dst->val_type = TYPE_LITERAL;
+		dst->nbr_cells = nbr_cells;
+		dst->val_off = g_dot_s;
+		dst->arity = 2;
+		dst->flags = 0;
+		dst++;
+		dst->val_type = TYPE_LITERAL;
+		dst->nbr_cells = 1 + key_cells + val_cells;
+		dst->val_off = g_minus_s;
+		dst->arity = 2;
+		dst->flags = 0;
+		SET_OP(dst, OP_YFX);
+		dst++;
+		dst += safe_copy_cells(dst, e->key->cells, key_cells);
+		safe_copy_cells(dst, e->val->cells, val_cells);
+		var_nbr += renumber_vars(dst, var_nbr);
+		dst += val_cells;
+		nbr_cells -= 2 + key_cells + val_cells;
+	}
+
+	make_literal(dst, g_nil_s);
+	return unify(q, p2, p2_ctx, l, q->st.curr_frame);
 }
 
-static USE_RESULT pl_status fn_instance_2(query *q)
+// Assoc trees are the AVL terms of library(assoc): t is the empty
+// tree and t(K,V,Balance,L,R) a node, Balance being the order of the
+// heights of L and R. An update opens the nodes on its path into
+// structs, rebalances those and writes just them out as new terms.
+// Keys, values and subtrees it did not touch are bound in through
+// fresh variables, so the old tree is shared rather than copied...
+
+typedef struct {
+	cell *c;
+	cell val;
+	idx_t ctx;
+	int node;
+} avl_ref;
+
+typedef struct {
+	avl_ref k, v, l, r;
+	int bal;
+} avl_node;
+
+typedef struct {
+	query *q;
+	avl_node *nodes;
+	unsigned nbr_nodes, size, nbr_vars, var_nbr;
+	idx_t t_s;
+	bool bad, missing;
+} avl_tree;
+
+static void avl_ref_from(avl_tree *t, cell *c, idx_t c_ctx, avl_ref *r)
+{
+	query *q = t->q;
+	c = deref(q, c, c_ctx);
+	r->ctx = q->latest_ctx;
+	r->node = -1;
+
+	if (is_structure(c))
+		r->c = c;
+	else {
+		r->c = NULL;
+		r->val = *c;
+	}
+}
+
+static avl_ref avl_node_ref(int node)
 {
-	GET_FIRST_ARG(p1,atom);
-	GET_NEXT_ARG(p2,any);
-	uuid u;
-	uuid_from_buf(GET_STR(p1), &u);
-	clause *r = find_in_db(q->m, &u);
-	may_ptr_error(r);
-	return unify(q, p2, p2_ctx, r->t.cells, q->st.curr_frame);
+	avl_ref r = {0};
+	r.node = node;
+	return r;
 }
 
-static USE_RESULT pl_status fn_clause_3(query *q)
+static cell *avl_cell(avl_ref *r)
 {
-	GET_FIRST_ARG(p1,callable);
-	GET_NEXT_ARG(p2,callable_or_var);
-	GET_NEXT_ARG(p3,atom_or_var);
+	return r->c ? r->c : &r->val;
+}
 
-	for (;;) {
-		term *t;
+static bool avl_is_empty(const avl_tree *t, const avl_ref *r)
+{
+	return (r->node < 0) && !r->c && is_literal(&r->val) && (r->val.val_off == t->t_s);
+}
 
-		if (!is_variable(p3)) {
-			uuid u;
-			uuid_from_buf(GET_STR(p3), &u);
-			clause *r = find_in_db(q->m, &u);
-			may_ptr_error(r);
-			t = &r->t;
-		} else {
-			if (!match_clause(q, p1, p1_ctx, DO_CLAUSE))
-				break;
+static int avl_alloc(avl_tree *t)
+{
+	if (t->nbr_nodes == t->size) {
+		unsigned size = t->size ? t->size * 2 : 64;
+		avl_node *nodes = realloc(t->nodes, sizeof(avl_node)*size);
 
-			char tmpbuf[128];
-			uuid_to_buf(&q->st.curr_clause2->u, tmpbuf, sizeof(tmpbuf));
-			cell tmp;
-			may_error(make_cstring(&tmp, tmpbuf));
-			set_var(q, p3, p3_ctx, &tmp, q->st.curr_frame);
-			DECR_REF(&tmp);
-			t = &q->st.curr_clause2->t;
+		if (!nodes) {
+			t->bad = true;
+			return -1;
 		}
 
-		cell *body = get_body(t->cells);
-		pl_status ok;
+		t->nodes = nodes;
+		t->size = size;
+	}
 
-		if (body)
-			ok = unify(q, p2, p2_ctx, body, q->st.fp);
-		else {
-			cell tmp;
-			make_literal(&tmp, g_true_s);
-			ok = unify(q, p2, p2_ctx, &tmp, q->st.curr_frame);
-		}
+	return t->nbr_nodes++;
+}
 
-		if (ok) {
-			bool last_match = !q->st.curr_clause2->next;
-			stash_me(q, t, last_match);
-			return pl_success;
-		}
+// Nodes come out of the array by index, as opening another may move
+// it, so the ref is taken by value...
 
-		undo_me(q);
-		drop_choice(q);
-		q->retry = QUERY_RETRY;
+static int avl_open(avl_tree *t, avl_ref r)
+{
+	if (r.node >= 0)
+		return r.node;
+
+	if (!r.c || (r.c->arity != 5) || (r.c->val_off != t->t_s)) {
+		t->bad = true;
+		return -1;
 	}
 
-	return pl_failure;
+	int n = avl_alloc(t);
+
+	if (n < 0)
+		return -1;
+
+	query *q = t->q;
+	avl_node *node = &t->nodes[n];
+	cell *c = r.c + 1;
+	avl_ref_from(t, c, r.ctx, &node->k);
+	c += c->nbr_cells;
+	avl_ref_from(t, c, r.ctx, &node->v);
+	c += c->nbr_cells;
+	cell *b = deref(q, c, r.ctx);
+	c += c->nbr_cells;
+	avl_ref_from(t, c, r.ctx, &node->l);
+	c += c->nbr_cells;
+	avl_ref_from(t, c, r.ctx, &node->r);
+
+	if (!is_literal(b) || b->arity)
+		t->bad = true;
+	else if (b->val_off == g_lt_s)
+		node->bal = -1;
+	else if (b->val_off == g_eq_s)
+		node->bal = 0;
+	else if (b->val_off == g_gt_s)
+		node->bal = 1;
+	else
+		t->bad = true;
+
+	return t->bad ? -1 : n;
 }
 
-static USE_RESULT pl_status do_asserta_2(query *q)
+// The left side of n is two higher than the right...
+
+static int avl_fix_left(avl_tree *t, int n, bool *shrunk)
 {
-	GET_FIRST_ARG(p1,any);
-	cell *head = get_head(p1);
+	int l = avl_open(t, t->nodes[n].l);
 
-	if (is_variable(head))
-		return throw_error(q, head, "instantiation_error", "args _not_sufficiently_instantiated");
+	if (l < 0)
+		return n;
 
-	bool found = false;
+	int bal = t->nodes[l].bal;
 
-	if (get_builtin(q->m->pl, GET_STR(head), head->arity, &found), found)
-		return throw_error(q, head, "permission_error", "modify,static_procedure");
+	if (bal >= 0) {
+		t->nodes[n].l = t->nodes[l].r;
+		t->nodes[n].bal = bal ? 0 : 1;
+		t->nodes[l].r = avl_node_ref(n);
+		t->nodes[l].bal = bal ? 0 : -1;
+		*shrunk = bal != 0;
+		return l;
+	}
 
-	cell *body = get_body(p1);
+	int m = avl_open(t, t->nodes[l].r);
 
-	if (body && !is_callable(body))
-		return throw_error(q, body, "type_error", "callable");
+	if (m < 0)
+		return n;
 
-	cell *tmp2;
+	bal = t->nodes[m].bal;
+	t->nodes[l].r = t->nodes[m].l;
+	t->nodes[n].l = t->nodes[m].r;
+	t->nodes[l].bal = bal < 0 ? 1 : 0;
+	t->nodes[n].bal = bal > 0 ? -1 : 0;
+	t->nodes[m].l = avl_node_ref(l);
+	t->nodes[m].r = avl_node_ref(n);
+	t->nodes[m].bal = 0;
+	*shrunk = true;
+	return m;
+}
 
-	if (body && ((tmp2 = check_body_callable(q->m->p, body)) != NULL))
-		return throw_error(q, tmp2, "type_error", "callable");
+// The right side of n is two higher than the left...
 
-	GET_NEXT_ARG(p2,atom_or_var);
-	cell *tmp = deep_copy_to_tmp(q, p1, p1_ctx, false, false);
-	may_ptr_error(tmp);
-	if (tmp == ERR_CYCLE_CELL)
-		return throw_error(q, p1, "resource_error", "cyclic_term");
+static int avl_fix_right(avl_tree *t, int n, bool *shrunk)
+{
+	int r = avl_open(t, t->nodes[n].r);
 
-	idx_t nbr_cells = tmp->nbr_cells;
-	parser *p = q->m->p;
+	if (r < 0)
+		return n;
 
-	if (nbr_cells > p->t->nbr_cells) {
-		p->t = realloc(p->t, sizeof(term)+(sizeof(cell)*(nbr_cells+1)));
-		ensure(p->t);
-		p->t->nbr_cells = nbr_cells;
+	int bal = t->nodes[r].bal;
+
+	if (bal <= 0) {
+		t->nodes[n].r = t->nodes[r].l;
+		t->nodes[n].bal = bal ? 0 : -1;
+		t->nodes[r].l = avl_node_ref(n);
+		t->nodes[r].bal = bal ? 0 : 1;
+		*shrunk = bal != 0;
+		return r;
 	}
 
-	p->t->cidx = safe_copy_cells(p->t->cells, tmp, nbr_cells);
-	do_assign_vars(p, nbr_cells);
-	parser_term_to_body(p);
-	cell *h = get_head(p->t->cells);
+	int m = avl_open(t, t->nodes[r].l);
 
-	if (is_cstring(h)) {
-		idx_t off = index_from_pool(q->m->pl, GET_STR(h));
-		ensure (off != ERR_IDX);
-		DECR_REF(h);
-		h->val_type = TYPE_LITERAL;
-		h->val_off = off;
-		h->flags = 0;
-	}
+	if (m < 0)
+		return n;
 
-	if (!is_literal(h))
-		return throw_error(q, h, "type_error", "callable");
+	bal = t->nodes[m].bal;
+	t->nodes[n].r = t->nodes[m].l;
+	t->nodes[r].l = t->nodes[m].r;
+	t->nodes[n].bal = bal < 0 ? 1 : 0;
+	t->nodes[r].bal = bal > 0 ? -1 : 0;
+	t->nodes[m].l = avl_node_ref(n);
+	t->nodes[m].r = avl_node_ref(r);
+	t->nodes[m].bal = 0;
+	*shrunk = true;
+	return m;
+}
 
-	clause *r = asserta_to_db(q->m, p->t, 0);
-	may_ptr_error(r);
+// One side of n got a level higher, side being 1 for the left and
+// -1 for the right...
 
-	if (!is_variable(p2)) {
-		uuid u;
-		uuid_from_buf(GET_STR(p2), &u);
-		r->u = u;
-	} else {
-		char tmpbuf[128];
-		uuid_to_buf(&r->u, tmpbuf, sizeof(tmpbuf));
-		cell tmp2;
-		may_error(make_cstring(&tmp2, tmpbuf));
-		set_var(q, p2, p2_ctx, &tmp2, q->st.curr_frame);
-		DECR_REF(&tmp2);
-	}
+static int avl_grown(avl_tree *t, int n, int side, bool *grew)
+{
+	int bal = t->nodes[n].bal + side;
+	bool shrunk;
 
-	if (!q->m->loading && r->t.persist)
-		db_log(q, r, LOG_ASSERTA);
+	if ((bal == 2) || (bal == -2)) {
+		*grew = false;
+		return side > 0 ? avl_fix_left(t, n, &shrunk) : avl_fix_right(t, n, &shrunk);
+	}
 
-	return pl_success;
+	t->nodes[n].bal = bal;
+	*grew = bal != 0;
+	return n;
 }
 
-static USE_RESULT pl_status fn_asserta_2(query *q)
+static int avl_shrunk(avl_tree *t, int n, int side, bool *shrunk)
 {
-	GET_FIRST_ARG(p1,nonvar);
-	GET_NEXT_ARG(p2,variable);
-	return do_asserta_2(q);
+	int bal = t->nodes[n].bal - side;
+
+	if ((bal == 2) || (bal == -2))
+		return side > 0 ? avl_fix_right(t, n, shrunk) : avl_fix_left(t, n, shrunk);
+
+	t->nodes[n].bal = bal;
+	*shrunk = bal == 0;
+	return n;
 }
 
-static USE_RESULT pl_status fn_sys_asserta_2(query *q)
+static avl_ref avl_insert(avl_tree *t, avl_ref r, avl_ref *key, const avl_ref *val, bool *grew, unsigned depth)
 {
-	GET_FIRST_ARG(p1,nonvar);
-	GET_NEXT_ARG(p2,atom);
-	return do_asserta_2(q);
+	if (avl_is_empty(t, &r)) {
+		int n = avl_alloc(t);
+
+		if (n < 0)
+			return r;
+
+		avl_node *node = &t->nodes[n];
+		node->k = *key;
+		node->v = *val;
+		node->l = node->r = r;
+		node->bal = 0;
+		*grew = true;
+		return avl_node_ref(n);
+	}
+
+	int n = depth < MAX_DEPTH ? avl_open(t, r) : -1;
+
+	if (n < 0) {
+		t->bad = true;
+		return r;
+	}
+
+	int cmp = compare(t->q, avl_cell(key), key->ctx, avl_cell(&t->nodes[n].k), t->nodes[n].k.ctx, 0);
+
+	if (!cmp || (cmp == ERR_CYCLE_CMP)) {
+		t->nodes[n].v = *val;
+		*grew = false;
+		return avl_node_ref(n);
+	}
+
+	int side = cmp < 0 ? 1 : -1;
+	avl_ref sub = avl_insert(t, side > 0 ? t->nodes[n].l : t->nodes[n].r, key, val, grew, depth+1);
+
+	if (t->bad)
+		return r;
+
+	if (side > 0)
+		t->nodes[n].l = sub;
+	else
+		t->nodes[n].r = sub;
+
+	if (*grew)
+		n = avl_grown(t, n, side, grew);
+
+	return avl_node_ref(n);
 }
 
-static USE_RESULT pl_status do_assertz_2(query *q)
+// Take out the leftmost (side 1) or rightmost (side -1) node...
+
+static avl_ref avl_delete_end(avl_tree *t, avl_ref r, int side, avl_ref *key, avl_ref *val, bool *shrunk, unsigned depth)
 {
-	GET_FIRST_ARG(p1,any);
-	cell *head = get_head(p1);
+	int n = depth < MAX_DEPTH ? avl_open(t, r) : -1;
 
-	if (is_variable(head))
-		return throw_error(q, head, "instantiation_error", "args _not_sufficiently_instantiated");
+	if (n < 0) {
+		t->bad = true;
+		return r;
+	}
 
-	bool found = false;
+	avl_ref next = side > 0 ? t->nodes[n].l : t->nodes[n].r;
 
-	if (get_builtin(q->m->pl, GET_STR(head), head->arity, &found), found)
-		return throw_error(q, head, "permission_error", "modify,static_procedure");
+	if (avl_is_empty(t, &next)) {
+		*key = t->nodes[n].k;
+		*val = t->nodes[n].v;
+		*shrunk = true;
+		return side > 0 ? t->nodes[n].r : t->nodes[n].l;
+	}
 
-	cell *body = get_body(p1);
+	avl_ref sub = avl_delete_end(t, next, side, key, val, shrunk, depth+1);
 
-	if (body && !is_callable(body))
-		return throw_error(q, body, "type_error", "callable");
+	if (t->bad)
+		return r;
 
-	cell *tmp2;
+	if (side > 0)
+		t->nodes[n].l = sub;
+	else
+		t->nodes[n].r = sub;
 
-	if (body && ((tmp2 = check_body_callable(q->m->p, body)) != NULL))
-		return throw_error(q, tmp2, "type_error", "callable");
+	if (*shrunk)
+		n = avl_shrunk(t, n, side, shrunk);
 
-	GET_NEXT_ARG(p2,atom_or_var);
-	cell *tmp = deep_copy_to_tmp(q, p1, p1_ctx, false, false);
-	may_ptr_error(tmp);
+	return avl_node_ref(n);
+}
 
-	if (tmp == ERR_CYCLE_CELL)
-		return throw_error(q, p1, "resource_error", "cyclic_term");
+static avl_ref avl_delete(avl_tree *t, avl_ref r, avl_ref *key, avl_ref *val, bool *shrunk, unsigned depth)
+{
+	if (avl_is_empty(t, &r)) {
+		t->missing = true;
+		return r;
+	}
 
-	idx_t nbr_cells = tmp->nbr_cells;
-	parser *p = q->m->p;
+	int n = depth < MAX_DEPTH ? avl_open(t, r) : -1;
 
-	if (nbr_cells > p->t->nbr_cells) {
-		p->t = realloc(p->t, sizeof(term)+(sizeof(cell)*(nbr_cells+1)));
-		ensure(p->t);
-		p->t->nbr_cells = nbr_cells;
+	if (n < 0) {
+		t->bad = true;
+		return r;
 	}
 
-	p->t->cidx = safe_copy_cells(p->t->cells, tmp, nbr_cells);
-	do_assign_vars(p, nbr_cells);
-	parser_term_to_body(p);
-	cell *h = get_head(p->t->cells);
+	int cmp = compare(t->q, avl_cell(key), key->ctx, avl_cell(&t->nodes[n].k), t->nodes[n].k.ctx, 0);
 
-	if (is_cstring(h)) {
-		idx_t off = index_from_pool(q->m->pl, GET_STR(h));
-		ensure (off != ERR_IDX);
-		DECR_REF(h);
-		h->val_type = TYPE_LITERAL;
-		h->val_off = off;
-		h->flags = 0;
-	}
+	if (!cmp || (cmp == ERR_CYCLE_CMP)) {
+		*val = t->nodes[n].v;
+		avl_ref l = t->nodes[n].l, rt = t->nodes[n].r;
 
-	if (!is_literal(h))
-		return throw_error(q, h, "type_error", "callable");
+		if (avl_is_empty(t, &l) || avl_is_empty(t, &rt)) {
+			*shrunk = true;
+			return avl_is_empty(t, &l) ? rt : l;
+		}
 
-	clause *r = assertz_to_db(q->m, p->t, 0);
-	may_ptr_error(r);
+		avl_ref k, v;
+		avl_ref sub = avl_delete_end(t, rt, 1, &k, &v, shrunk, depth+1);
 
-	if (!is_variable(p2)) {
-		uuid u;
-		uuid_from_buf(GET_STR(p2), &u);
-		r->u = u;
-	} else {
-		char tmpbuf[128];
-		uuid_to_buf(&r->u, tmpbuf, sizeof(tmpbuf));
-		cell tmp2;
-		may_error(make_cstring(&tmp2, tmpbuf));
-		set_var(q, p2, p2_ctx, &tmp2, q->st.curr_frame);
-		DECR_REF(&tmp2);
+		if (t->bad)
+			return r;
+
+		t->nodes[n].r = sub;
+		t->nodes[n].k = k;
+		t->nodes[n].v = v;
+
+		if (*shrunk)
+			n = avl_shrunk(t, n, -1, shrunk);
+
+		return avl_node_ref(n);
 	}
 
-	if (!q->m->loading && r->t.persist)
-		db_log(q, r, LOG_ASSERTZ);
+	int side = cmp < 0 ? 1 : -1;
+	avl_ref sub = avl_delete(t, side > 0 ? t->nodes[n].l : t->nodes[n].r, key, val, shrunk, depth+1);
 
-	return pl_success;
+	if (t->bad || t->missing)
+		return r;
+
+	if (side > 0)
+		t->nodes[n].l = sub;
+	else
+		t->nodes[n].r = sub;
+
+	if (*shrunk)
+		n = avl_shrunk(t, n, side, shrunk);
+
+	return avl_node_ref(n);
 }
 
-static USE_RESULT pl_status fn_assertz_2(query *q)
+// Anything not opened is a single cell in the new term: a copy if
+// it is atomic or a variable of this frame, else a fresh variable...
+
+static bool avl_needs_var(const query *q, const avl_ref *r)
 {
-	GET_FIRST_ARG(p1,nonvar);
-	GET_NEXT_ARG(p2,variable);
-	return do_assertz_2(q);
+	return r->c || (is_variable(&r->val) && (r->ctx != q->st.curr_frame));
 }
 
-static USE_RESULT pl_status fn_sys_assertz_2(query *q)
+static idx_t avl_count(avl_tree *t, const avl_ref *r)
 {
-	GET_FIRST_ARG(p1,nonvar);
-	GET_NEXT_ARG(p2,atom);
-	return do_assertz_2(q);
+	if (r->node < 0) {
+		if (avl_needs_var(t->q, r))
+			t->nbr_vars++;
+
+		return 1;
+	}
+
+	const avl_node *n = &t->nodes[r->node];
+	return 2 + avl_count(t, &n->k) + avl_count(t, &n->v)
+		+ avl_count(t, &n->l) + avl_count(t, &n->r);
 }
 
-static void save_db(FILE *fp, query *q, int logging)
+static cell *avl_emit(avl_tree *t, avl_ref *r, cell *dst)
 {
-	for (predicate *h = q->m->head; h; h = h->next) {
-		if (h->is_prebuilt)
-			continue;
+	query *q = t->q;
 
-		if (logging && !h->is_persist)
-			continue;
+	if (r->node < 0) {
+		if (avl_needs_var(q, r)) {
+			make_variable(dst, g_anon_s);
+			dst->flags |= FLAG2_FRESH;
+			dst->var_nbr = t->var_nbr++;
+			set_var(q, dst, q->st.curr_frame, avl_cell(r), r->ctx);
+		} else
+			safe_copy_cells(dst, &r->val, 1);
+
+		return dst + 1;
+	}
+
+	avl_node *n = &t->nodes[r->node];
+	cell *c = dst++;
+	c->val_type = TYPE_LITERAL;
+	c->arity = 5;
+	c->flags = 0;
+	c->val_off = t->t_s;
+	dst = avl_emit(t, &n->k, dst);
+	dst = avl_emit(t, &n->v, dst);
+	make_literal(dst++, n->bal < 0 ? g_lt_s : n->bal > 0 ? g_gt_s : g_eq_s);
+	dst = avl_emit(t, &n->l, dst);
+	dst = avl_emit(t, &n->r, dst);
+	c->nbr_cells = dst - c;
+	return dst;
+}
 
-		const char *src = GET_STR(&h->key);
+static pl_status avl_unify(avl_tree *t, avl_ref *r, cell *p1, idx_t p1_ctx)
+{
+	query *q = t->q;
 
-		if (src[0] == '$')
-			continue;
+	if (r->node < 0)
+		return unify(q, p1, p1_ctx, avl_cell(r), r->ctx);
 
-		for (clause *r = h->head; r; r = r->next) {
-			if (r->t.ugen_erased)
-				continue;
+	t->nbr_vars = 0;
+	idx_t nbr_cells = avl_count(t, r);
 
-			if (logging)
-				fprintf(fp, "z_(");
+	if (t->nbr_vars && ((GET_CURR_FRAME()->nbr_vars + t->nbr_vars) >= MAX_VARS))
+		return throw_error(q, p1, "resource_error", "too_many_vars");
 
-			print_term(q, fp, r->t.cells, q->st.curr_frame, 0);
+	// Making the variables can move the slots p1 may be in...
 
-			if (logging) {
-				char tmpbuf[256];
-				uuid_to_buf(&r->u, tmpbuf, sizeof(tmpbuf));
-				fprintf(fp, ",'%s')", tmpbuf);
-			}
+	cell save = *p1;
 
-			fprintf(fp, ".\n");
-		}
-	}
+	if (!is_structure(p1))
+		p1 = &save;
+
+	t->var_nbr = create_vars(q, t->nbr_vars);
+	cell *tmp = alloc_on_heap(q, nbr_cells);
+	may_ptr_error(tmp);
+	avl_emit(t, r, tmp);
+	return unify(q, p1, p1_ctx, tmp, q->st.curr_frame);
 }
 
-static USE_RESULT pl_status fn_listing_0(query *q)
+static pl_status avl_init(query *q, avl_tree *t, cell *p1, idx_t p1_ctx, avl_ref *r)
 {
-	save_db(stdout, q, 0);
+	memset(t, 0, sizeof(avl_tree));
+	t->q = q;
+	t->t_s = index_from_pool(q->m->pl, "t");
+	may_idx_error(t->t_s);
+
+	if (is_variable(p1))
+		return throw_error(q, p1, "instantiation_error", "not_sufficiently_instantiated");
+
+	avl_ref_from(t, p1, p1_ctx, r);
 	return pl_success;
 }
 
-static void save_name(FILE *fp, query *q, idx_t name, unsigned arity)
+static pl_status avl_done(avl_tree *t, cell *p1, idx_t p1_ctx, pl_status ok)
 {
-	module *m = q->st.curr_clause ? q->st.curr_clause->m : q->m;
+	query *q = t->q;
+	free(t->nodes);
 
-	for (predicate *h = m->head; h; h = h->next) {
-		if (h->is_prebuilt)
-			continue;
+	if (!t->bad)
+		return ok;
 
-		if (name != h->key.val_off)
-			continue;
+	q->latest_ctx = p1_ctx;
+	return throw_error(q, p1, "type_error", "assoc");
+}
 
-		if ((arity != h->key.arity) && (arity != -1U))
-			continue;
+static USE_RESULT pl_status fn_sys_get_assoc_3(query *q)
+{
+	GET_FIRST_ARG(p1,any);
+	GET_NEXT_ARG(p2,any);
+	GET_NEXT_ARG(p3,any);
+	idx_t t_s = index_from_pool(q->m->pl, "t");
+	may_idx_error(t_s);
+	cell *c = p2;
+	idx_t c_ctx = p2_ctx;
 
-		for (clause *r = h->head; r; r = r->next) {
-			if (r->t.ugen_erased)
-				continue;
+	if (is_variable(p2))
+		return throw_error(q, p2, "instantiation_error", "not_sufficiently_instantiated");
 
-			print_term(q, fp, r->t.cells, q->st.curr_frame, 0);
-			fprintf(fp, ".\n");
+	for (unsigned depth = 0; depth < MAX_DEPTH; depth++) {
+		if (is_literal(c) && !c->arity && (c->val_off == t_s))
+			return pl_failure;
+
+		if (!is_structure(c) || (c->arity != 5) || (c->val_off != t_s))
+			break;
+
+		cell *k = c + 1, *v = k + k->nbr_cells, *b = v + v->nbr_cells;
+		cell *l = b + b->nbr_cells, *r = l + l->nbr_cells;
+		cell *key = deref(q, k, c_ctx);
+		idx_t key_ctx = q->latest_ctx;
+		int cmp = compare(q, p1, p1_ctx, key, key_ctx, 0);
+
+		if (!cmp || (cmp == ERR_CYCLE_CMP)) {
+			v = deref(q, v, c_ctx);
+			return unify(q, p3, p3_ctx, v, q->latest_ctx);
 		}
+
+		c = deref(q, cmp < 0 ? l : r, c_ctx);
+		c_ctx = q->latest_ctx;
 	}
+
+	q->latest_ctx = p2_ctx;
+	return throw_error(q, p2, "type_error", "assoc");
 }
 
-static USE_RESULT pl_status fn_listing_1(query *q)
+static USE_RESULT pl_status fn_sys_put_assoc_4(query *q)
 {
 	GET_FIRST_ARG(p1,any);
-	idx_t name = p1->val_off;
-	unsigned arity = -1;
+	GET_NEXT_ARG(p2,any);
+	GET_NEXT_ARG(p3,any);
+	GET_NEXT_ARG(p4,any);
+	avl_tree t;
+	avl_ref root, key, val;
+	pl_status ok = avl_init(q, &t, p2, p2_ctx, &root);
 
-	if (p1->arity) {
-		if (strcmp(GET_STR(p1), "/") && strcmp(GET_STR(p1), "//"))
-			return throw_error(q, p1, "type_error", "predicate_indicator");
+	if (!ok || q->did_throw)
+		return ok;
 
-		cell *p2 = p1 + 1;
+	avl_ref_from(&t, p1, p1_ctx, &key);
+	avl_ref_from(&t, p3, p3_ctx, &val);
+	bool grew = false;
+	root = avl_insert(&t, root, &key, &val, &grew, 0);
 
-		if (!is_atom(p2))
-			return throw_error(q, p2, "type_error", "atom");
+	if (!t.bad)
+		ok = avl_unify(&t, &root, p4, p4_ctx);
 
-		cell *p3 = p2 + p2->nbr_cells;
+	return avl_done(&t, p2, p2_ctx, ok);
+}
 
-		if (!is_integer(p3))
-			return throw_error(q, p3, "type_error", "integer");
+static USE_RESULT pl_status fn_sys_del_assoc_4(query *q)
+{
+	GET_FIRST_ARG(p1,any);
+	GET_NEXT_ARG(p2,any);
+	GET_NEXT_ARG(p3,any);
+	GET_NEXT_ARG(p4,any);
+	avl_tree t;
+	avl_ref root, key, val;
+	pl_status ok = avl_init(q, &t, p2, p2_ctx, &root);
 
-		name = index_from_pool(q->m->pl, GET_STR(p2));
-		arity = p3->val_num;
+	if (!ok || q->did_throw)
+		return ok;
 
-		if (!strcmp(GET_STR(p1), "//"))
-			arity += 2;
-	}
+	avl_ref_from(&t, p1, p1_ctx, &key);
+	bool shrunk = false;
+	root = avl_delete(&t, root, &key, &val, &shrunk, 0);
 
-	save_name(stdout, q, name, arity);
-	return pl_success;
-}
+	if (!t.bad && !t.missing)
+		ok = unify(q, p3, p3_ctx, avl_cell(&val), val.ctx);
 
-static USE_RESULT pl_status fn_sys_timer_0(query *q)
-{
-	q->time_started = get_time_in_usec();
-	return pl_success;
-}
+	if (!t.bad && !t.missing && ok && !q->did_throw)
+		ok = avl_unify(&t, &root, p4, p4_ctx);
 
-static USE_RESULT pl_status fn_sys_elapsed_0(query *q)
-{
-	uint64_t elapsed = get_time_in_usec();
-	elapsed -= q->time_started;
-	fprintf(stdout, "Time elapsed %.03g secs\n", (double)elapsed/1000/1000);
-	return pl_success;
+	return avl_done(&t, p2, p2_ctx, t.missing ? pl_failure : ok);
 }
 
-static USE_RESULT pl_status fn_trace_0(query *q)
+static pl_status do_del_end_assoc(query *q, int side)
 {
-	q->trace = !q->trace;
-	return pl_success;
-}
+	GET_FIRST_ARG(p1,any);
+	GET_NEXT_ARG(p2,any);
+	GET_NEXT_ARG(p3,any);
+	GET_NEXT_ARG(p4,any);
+	avl_tree t;
+	avl_ref root, key, val;
+	pl_status ok = avl_init(q, &t, p1, p1_ctx, &root);
 
-static USE_RESULT pl_status fn_time_1(query *q)
-{
-	GET_FIRST_ARG(p1,callable);
-	DISCARD_RESULT fn_sys_timer_0(q);
-	cell *tmp = clone_to_heap(q, true, p1, 2);
-	idx_t nbr_cells = 1 + p1->nbr_cells;
-	make_structure(tmp+nbr_cells++, g_sys_elapsed_s, fn_sys_elapsed_0, 0, 0);
-	make_call(q, tmp+nbr_cells);
-	q->st.curr_cell = tmp;
-	return pl_success;
-}
+	if (!ok || q->did_throw)
+		return ok;
 
-static USE_RESULT pl_status fn_statistics_2(query *q)
-{
-	GET_FIRST_ARG(p1,atom);
-	GET_NEXT_ARG(p2,list_or_var);
+	if (avl_is_empty(&t, &root))
+		return avl_done(&t, p1, p1_ctx, pl_failure);
 
-	if (!strcmp(GET_STR(p1), "cputime") && is_variable(p2)) {
-		uint64_t now = get_time_in_usec();
-		double elapsed = now - q->time_started;
-		cell tmp;
-		make_float(&tmp, elapsed/1000/1000);
-		set_var(q, p2, p2_ctx, &tmp, q->st.curr_frame);
-		return pl_success;
-	}
+	bool shrunk = false;
+	root = avl_delete_end(&t, root, side, &key, &val, &shrunk, 0);
+
+	if (!t.bad)
+		ok = unify(q, p2, p2_ctx, avl_cell(&key), key.ctx);
+
+	if (!t.bad && ok && !q->did_throw)
+		ok = unify(q, p3, p3_ctx, avl_cell(&val), val.ctx);
+
+	if (!t.bad && ok && !q->did_throw)
+		ok = avl_unify(&t, &root, p4, p4_ctx);
 
-	if (!strcmp(GET_STR(p1), "gctime") && is_variable(p2)) {
-		cell tmp;
-		make_float(&tmp, 0);
-		set_var(q, p2, p2_ctx, &tmp, q->st.curr_frame);
-		return pl_success;
-	}
+	return avl_done(&t, p1, p1_ctx, ok);
+}
 
-	if (!strcmp(GET_STR(p1), "runtime")) {
-		uint64_t now = get_time_in_usec();
-		double elapsed = now - q->time_started;
-		cell tmp;
-		make_int(&tmp, elapsed/1000);
-		allocate_list(q, &tmp);
-		append_list(q, &tmp);
-		make_literal(&tmp, g_nil_s);
-		cell *l = end_list(q);
-		may_ptr_error(l);
-		return unify(q, p2, p2_ctx, l, q->st.curr_frame);
-	}
+static USE_RESULT pl_status fn_sys_del_min_assoc_4(query *q)
+{
+	return do_del_end_assoc(q, 1);
+}
 
-	return pl_failure;
+static USE_RESULT pl_status fn_sys_del_max_assoc_4(query *q)
+{
+	return do_del_end_assoc(q, -1);
 }
 
 static USE_RESULT pl_status fn_sleep_1(query *q)
@@ -7962,7 +10643,7 @@ static USE_RESULT pl_status fn_task_n(query *q)
 	tmp2->arity = arity;
 	bool found = false;
 
-	if ((tmp2->fn = get_builtin(q->m->pl, GET_STR(tmp2), arity, &found)), found)
+	if ((tmp2->fn = get_builtin_term(q->m->pl, tmp2, arity, &found)), found)
 		tmp2->flags |= FLAG_BUILTIN;
 	else {
 		tmp2->match = find_matching_predicate(q->m, tmp2);
@@ -9725,20 +12406,253 @@ static USE_RESULT pl_status fn_replace_4(query *q)
 	return pl_success;
 }
 
-static void load_properties(module *m);
+static const char *get_specifier_name(unsigned specifier)
+{
+	switch (specifier) {
+		case OP_FX: return "fx";
+		case OP_FY: return "fy";
+		case OP_XF: return "xf";
+		case OP_YF: return "yf";
+		case OP_XFX: return "xfx";
+		case OP_XFY: return "xfy";
+		case OP_YFX: return "yfx";
+		default: return "";
+	}
+}
+
+// Operators are enumerated straight from the module's op tables, its
+// own ops first and then the defaults, the cursor being kept in the
+// outer choice...
 
-static USE_RESULT pl_status fn_sys_load_properties_0(query *q)
+static USE_RESULT pl_status fn_sys_current_op_3(query *q)
 {
-	load_properties(q->m);
-	return pl_success;
+	GET_FIRST_ARG(p1,any);
+	GET_NEXT_ARG(p2,any);
+	GET_NEXT_ARG(p3,any);
+	idx_t i = 0;
+
+	if (!q->retry)
+		may_error(make_choice(q));
+	else
+		get_params(q, &i, NULL);
+
+	for (; i < ((MAX_OPS+1) * 2); i++) {
+		const struct op_table *ptr = i <= MAX_OPS ? q->m->ops + i : q->m->def_ops + (i - MAX_OPS - 1);
+
+		if (!ptr->name || !ptr->specifier)
+			continue;
+
+		if (is_atom(p3) && strcmp(GET_STR(p3), ptr->name))
+			continue;
+
+		if (is_integer(p1) && (p1->val_num != ptr->priority))
+			continue;
+
+		set_params(q, i+1, 0);
+		may_error(make_choice(q));
+		cell tmp;
+		make_literal(&tmp, index_from_pool(q->m->pl, get_specifier_name(ptr->specifier)));
+
+		if (!unify(q, p2, p2_ctx, &tmp, q->st.curr_frame)) {
+			retry_choice(q);
+			continue;
+		}
+
+		make_int(&tmp, ptr->priority);
+
+		if (!unify(q, p1, p1_ctx, &tmp, q->st.curr_frame)) {
+			retry_choice(q);
+			continue;
+		}
+
+		make_literal(&tmp, index_from_pool(q->m->pl, ptr->name));
+		ensure(tmp.val_off != ERR_IDX);
+
+		if (!unify(q, p3, p3_ctx, &tmp, q->st.curr_frame)) {
+			retry_choice(q);
+			continue;
+		}
+
+		return pl_success;
+	}
+
+	drop_choice(q);
+	return pl_failure;
+}
+
+// Control constructs and the meta-argument specs of builtins, for
+// predicate_property/2. Each character of a spec is one argument: a
+// digit is that integer, anything else is a one-character atom...
+
+static const struct {
+	const char *name;
+	unsigned arity;
+	bool is_control;
+	const char *spec;
+} g_builtin_props[] = {
+	{",", 2, true, "00"},
+	{";", 2, true, "00"},
+	{"->", 2, true, "00"},
+	{"*->", 2, true, "00"},
+	{"findall", 3, true, "?0-"},
+	{"bagof", 3, true, "?0-"},
+	{"setof", 3, true, "?0-"},
+	{"aggregate_all", 3, false, "?0-"},
+	{"throw", 1, true, NULL},
+	{"call", 1, true, NULL},
+	{"!", 0, true, NULL},
+	{"true", 0, true, NULL},
+	{"fail", 0, true, NULL},
+	{"|", 2, false, ":+"},
+	{"time", 1, false, "0"},
+	{"setup_call_cleanup", 3, false, "000"},
+	{"asserta", 1, false, ":"},
+	{"assertz", 1, false, ":"},
+	{"retract", 1, false, ":"},
+	{"retractall", 1, false, ":"},
+	{"current_predicate", 1, false, ":"},
+	{"predicate_property", 2, false, ":?"},
+	{"abolish", 1, false, ":"},
+	{"clause", 2, false, ":?"},
+	{"catch", 3, false, "0?0"},
+	{"phrase", 2, false, "2?"},
+	{"phrase", 3, false, "2??"},
+	{0}
+};
+
+static void push_property(query *q, bool *first, const cell *c)
+{
+	if (*first)
+		allocate_list(q, c);
+	else
+		append_list(q, c);
+
+	*first = false;
 }
 
-static void load_ops(query *q);
+static void push_property_name(query *q, bool *first, const char *name)
+{
+	cell tmp;
+	make_literal(&tmp, index_from_pool(q->m->pl, name));
+	push_property(q, first, &tmp);
+}
 
-static USE_RESULT pl_status fn_sys_load_ops_0(query *q)
+static bool push_meta_property(query *q, bool *first, const char *name, const char *spec)
 {
-	load_ops(q);
-	return pl_success;
+	unsigned arity = strlen(spec);
+	cell *tmp = alloc_on_heap(q, 2+arity);
+	if (!tmp) return false;
+	make_literal(tmp, index_from_pool(q->m->pl, "meta_predicate"));
+	tmp[0].arity = 1;
+	tmp[0].nbr_cells = 2 + arity;
+	make_literal(tmp+1, index_from_pool(q->m->pl, name));
+	tmp[1].arity = arity;
+	tmp[1].nbr_cells = 1 + arity;
+	unsigned specifier;
+
+	if (get_op(q->m, name, &specifier, arity == 1))
+		SET_OP(tmp+1, specifier);
+
+	for (unsigned i = 0; i < arity; i++) {
+		if (isdigit(spec[i]))
+			make_int(tmp+2+i, spec[i] - '0');
+		else {
+			char atom[2] = {spec[i], '\0'};
+			make_literal(tmp+2+i, index_from_pool(q->m->pl, atom));
+		}
+	}
+
+	push_property(q, first, tmp);
+	return true;
+}
+
+static USE_RESULT pl_status fn_sys_predicate_properties_2(query *q)
+{
+	GET_FIRST_ARG(p1,callable);
+	GET_NEXT_ARG(p2,any);
+	const char *name = GET_STR(p1);
+	bool first = true, found = false;
+
+	if (name[0] == '$') {
+		cell tmp;
+		make_literal(&tmp, g_nil_s);
+		return unify(q, p2, p2_ctx, &tmp, q->st.curr_frame);
+	}
+
+	if (get_builtin_term(q->m->pl, p1, p1->arity, &found), found) {
+		push_property_name(q, &first, "built_in");
+		push_property_name(q, &first, "static");
+		push_property_name(q, &first, "private");
+		push_property_name(q, &first, "native_code");
+	} else {
+		predicate *h = find_matching_predicate_quiet(q->m, p1);
+
+		if (h && h->is_prebuilt)
+			push_property_name(q, &first, "built_in");
+
+		if (h)
+			push_property_name(q, &first, h->is_dynamic ? "dynamic" : "static");
+
+		if (h && h->is_prebuilt)
+			push_property_name(q, &first, "private");
+
+		if (h && h->is_public)
+			push_property_name(q, &first, "public");
+
+		if (h && h->is_multifile)
+			push_property_name(q, &first, "multifile");
+
+		if (h && h->is_discontiguous)
+			push_property_name(q, &first, "discontiguous");
+
+		if (h && h->is_persist)
+			push_property_name(q, &first, "persist");
+
+		if (h && h->is_tabled)
+			push_property_name(q, &first, "tabled");
+
+		if (h && h->meta_spec) {
+			cell *tmp = alloc_on_heap(q, 1+h->meta_spec->nbr_cells);
+			may_ptr_error(tmp);
+			make_literal(tmp, index_from_pool(q->m->pl, "meta_predicate"));
+			tmp[0].arity = 1;
+			tmp[0].nbr_cells = 1 + h->meta_spec->nbr_cells;
+			copy_cells(tmp+1, h->meta_spec, h->meta_spec->nbr_cells);
+			push_property(q, &first, tmp);
+		}
+	}
+
+	for (unsigned i = 0; g_builtin_props[i].name; i++) {
+		if ((g_builtin_props[i].arity != p1->arity) || strcmp(g_builtin_props[i].name, name))
+			continue;
+
+		if (g_builtin_props[i].is_control)
+			push_property_name(q, &first, "control_construct");
+
+		if (g_builtin_props[i].spec)
+			may_error(push_meta_property(q, &first, name, g_builtin_props[i].spec));
+	}
+
+	// call/2-8 and task/2-8 are closures called with N-1 extra args...
+
+	if ((!strcmp(name, "call") || !strcmp(name, "task"))
+		&& (p1->arity >= 2) && (p1->arity <= 8)) {
+		char spec[10];
+		spec[0] = '0' + p1->arity - 1;
+		memset(spec+1, '?', p1->arity-1);
+		spec[p1->arity] = '\0';
+		may_error(push_meta_property(q, &first, name, spec));
+	}
+
+	if (first) {
+		cell tmp;
+		make_literal(&tmp, g_nil_s);
+		return unify(q, p2, p2_ctx, &tmp, q->st.curr_frame);
+	}
+
+	cell *l = end_list(q);
+	may_ptr_error(l);
+	return unify(q, p2, p2_ctx, l, q->st.curr_frame);
 }
 
 static USE_RESULT pl_status fn_legacy_predicate_property_2(query *q)
@@ -10634,6 +13548,54 @@ static USE_RESULT pl_status fn_memberchk_2(query *q)
 	return pl_failure;
 }
 
+static USE_RESULT pl_status fn_iso_sort_2(query *q)
+{
+	GET_FIRST_ARG(p1,any);
+	GET_NEXT_ARG(p2,any);
+	return do_sort(q, p1, p1_ctx, p2, p2_ctx, 0, true, true, false);
+}
+
+static USE_RESULT pl_status fn_msort_2(query *q)
+{
+	GET_FIRST_ARG(p1,any);
+	GET_NEXT_ARG(p2,any);
+	return do_sort(q, p1, p1_ctx, p2, p2_ctx, 0, true, false, false);
+}
+
+static USE_RESULT pl_status fn_iso_keysort_2(query *q)
+{
+	GET_FIRST_ARG(p1,any);
+	GET_NEXT_ARG(p2,any);
+	return do_sort(q, p1, p1_ctx, p2, p2_ctx, 1, true, false, true);
+}
+
+static USE_RESULT pl_status fn_sort_4(query *q)
+{
+	GET_FIRST_ARG(p1,integer);
+	GET_NEXT_ARG(p2,atom);
+	GET_NEXT_ARG(p3,any);
+	GET_NEXT_ARG(p4,any);
+
+	if (p1->val_num < 0)
+		return throw_error(q, p1, "domain_error", "not_less_than_zero");
+
+	const char *src = GET_STR(p2);
+	bool ascending, dedup;
+
+	if (!strcmp(src, "@<")) {
+		ascending = true; dedup = true;
+	} else if (!strcmp(src, "@=<")) {
+		ascending = true; dedup = false;
+	} else if (!strcmp(src, "@>")) {
+		ascending = false; dedup = true;
+	} else if (!strcmp(src, "@>=")) {
+		ascending = false; dedup = false;
+	} else
+		return throw_error(q, p2, "domain_error", "order");
+
+	return do_sort(q, p3, p3_ctx, p4, p4_ctx, p1->val_num, ascending, dedup, false);
+}
+
 static USE_RESULT pl_status fn_sys_put_chars_2(query *q)
 {
 	GET_FIRST_ARG(pstr,stream);
@@ -10909,6 +13871,8 @@ static const struct builtins g_predicates_iso[] =
 	{"number_codes", 2, fn_iso_number_codes_2, NULL},
 	{"clause", 2, fn_iso_clause_2, NULL},
 	{"length", 2, fn_iso_length_2, NULL},
+	{"sort", 2, fn_iso_sort_2, NULL},
+	{"keysort", 2, fn_iso_keysort_2, NULL},
 	{"arg", 3, fn_iso_arg_3, NULL},
 	{"functor", 3, fn_iso_functor_3, NULL},
 	{"copy_term", 2, fn_iso_copy_term_2, NULL},
@@ -10976,6 +13940,7 @@ static const struct builtins g_predicates_iso[] =
 	{"op", 3, fn_iso_op_3, NULL},
 	{"$findall", 3, fn_sys_findall_3, NULL},
 	{"$bagof", 3, fn_sys_bagof_3, NULL},
+	{"$aggregate_all", 3, fn_sys_aggregate_all_3, NULL},
 	{"current_predicate", 1, fn_iso_current_predicate_1, NULL},
 	{"acyclic_term", 1, fn_iso_acyclic_term_1, NULL},
 	{"compare", 3, fn_iso_compare_3, NULL},
@@ -11019,6 +13984,8 @@ static const struct builtins g_predicates_other[] =
 	// Miscellaneous...
 
 	{"memberchk", 2, fn_memberchk_2, "?term,+list"},
+	{"msort", 2, fn_msort_2, "+list,?list"},
+	{"sort", 4, fn_sort_4, "+integer,+atom,+list,?list"},
 	{"$put_chars", 2, fn_sys_put_chars_2, "+stream,+chars"},
 	{"ignore", 1, fn_ignore_1, "+callable"},
 
@@ -11094,8 +14061,8 @@ static const struct builtins g_predicates_other[] =
 	{"hex_chars", 2, fn_hex_chars_2, "?integer,?string"},
 	{"octal_chars", 2, fn_octal_chars_2, "?integer,?string"},
 	{"legacy_predicate_property", 2, fn_legacy_predicate_property_2, "+callable,?string"},
-	{"$load_properties", 0, fn_sys_load_properties_0, NULL},
-	{"$load_ops", 0, fn_sys_load_ops_0, NULL},
+	{"$predicate_properties", 2, fn_sys_predicate_properties_2, NULL},
+	{"$current_op", 3, fn_sys_current_op_3, NULL},
 	{"numbervars", 1, fn_numbervars_1, "+term"},
 	{"numbervars", 3, fn_numbervars_3, "+term,+start,?end"},
 	{"numbervars", 4, fn_numbervars_3, "+term,+start,?end,+list"},
@@ -11115,6 +14082,33 @@ static const struct builtins g_predicates_other[] =
 	{"unsetenv", 1, fn_unsetenv_1, NULL},
 	{"load_files", 2, fn_consult_1, "+files"},
 	{"statistics", 2, fn_statistics_2, "+string,-variable"},
+	{"garbage_collect", 0, fn_garbage_collect_0, NULL},
+	{"abolish_all_tables", 0, fn_abolish_all_tables_0, NULL},
+	{"$tbl_variant", 3, fn_sys_tbl_variant_3, NULL},
+	{"$tbl_push", 1, fn_sys_tbl_push_1, NULL},
+	{"$tbl_pop", 1, fn_sys_tbl_pop_1, NULL},
+	{"$tbl_abandon", 1, fn_sys_tbl_abandon_1, NULL},
+	{"$tbl_add_answer", 2, fn_sys_tbl_add_answer_2, NULL},
+	{"$tbl_answer", 4, fn_sys_tbl_answer_4, NULL},
+	{"nb_setval", 2, fn_nb_setval_2, "+atom,+term"},
+	{"b_setval", 2, fn_b_setval_2, "+atom,+term"},
+	{"nb_getval", 2, fn_nb_getval_2, "+atom,?term"},
+	{"b_getval", 2, fn_nb_getval_2, "+atom,?term"},
+	{"$ht_new", 1, fn_sys_ht_new_1, "-hashtable"},
+	{"$ht_free", 1, fn_sys_ht_free_1, "+hashtable"},
+	{"$ht_put", 3, fn_sys_ht_put_3, "+hashtable,+term,+term"},
+	{"$nb_ht_put", 3, fn_sys_nb_ht_put_3, "+hashtable,+term,+term"},
+	{"$ht_get", 3, fn_sys_ht_get_3, "+hashtable,+term,?term"},
+	{"$ht_del", 2, fn_sys_ht_del_2, "+hashtable,+term"},
+	{"$nb_ht_del", 2, fn_sys_nb_ht_del_2, "+hashtable,+term"},
+	{"$ht_size", 2, fn_sys_ht_size_2, "+hashtable,?integer"},
+	{"$ht_pairs", 2, fn_sys_ht_pairs_2, "+hashtable,-list"},
+	{"$get_assoc", 3, fn_sys_get_assoc_3, "+term,+assoc,?term"},
+	{"$put_assoc", 4, fn_sys_put_assoc_4, "+term,+assoc,+term,-assoc"},
+	{"$del_assoc", 4, fn_sys_del_assoc_4, "+term,+assoc,?term,-assoc"},
+	{"$del_min_assoc", 4, fn_sys_del_min_assoc_4, "+assoc,?term,?term,-assoc"},
+	{"$del_max_assoc", 4, fn_sys_del_max_assoc_4, "+assoc,?term,?term,-assoc"},
+	{"$tbl_changes", 2, fn_sys_tbl_changes_2, NULL},
 	{"duplicate_term", 2, fn_iso_copy_term_2, "+string,-variable"},
 	{"call_nth", 2, fn_call_nth_2, "+callable,+integer"},
 	{"limit", 2, fn_limit_2, "+integer,+callable"},
@@ -11164,16 +14158,25 @@ static const struct builtins g_predicates_other[] =
 	{0}
 };
 
-void *get_builtin(prolog *pl, const char *name, unsigned arity, bool *found)
+static idx_t builtin_hash(idx_t val_off, unsigned arity)
+{
+	uint64_t k = ((uint64_t)val_off << 8) ^ arity;
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdULL;
+	k ^= k >> 33;
+	return (idx_t)k;
+}
+
+static void *find_builtin(const prolog *pl, idx_t val_off, unsigned arity, bool *found)
 {
-	sliter *iter = sl_findkey(pl->funtab, name);
-	const struct builtins *ptr;
+	idx_t mask = pl->funtab_size - 1;
 
-	while (sl_nextkey(iter, (void**)&ptr)) {
-		if (ptr->arity == arity) {
-			sl_done(iter);
+	for (idx_t i = builtin_hash(val_off, arity) & mask; pl->funtab[i].ptr; i = (i + 1) & mask) {
+		const builtin_slot *b = &pl->funtab[i];
+
+		if ((b->val_off == val_off) && (b->arity == arity)) {
 			*found = true;
-			return ptr->fn;
+			return b->ptr->fn;
 		}
 	}
 
@@ -11181,292 +14184,79 @@ void *get_builtin(prolog *pl, const char *name, unsigned arity, bool *found)
 	return NULL;
 }
 
-extern const struct builtins g_functions[];
-extern const struct builtins g_contrib_funcs[];
-
-void load_builtins(prolog *pl)
+void *get_builtin(prolog *pl, const char *name, unsigned arity, bool *found)
 {
-	for (const struct builtins *ptr = g_predicates_iso; ptr->name; ptr++) {
-		sl_app(pl->funtab, ptr->name, ptr);
-	}
-
-	for (const struct builtins *ptr = g_functions; ptr->name; ptr++) {
-		sl_app(pl->funtab, ptr->name, ptr);
-	}
+	idx_t val_off = is_in_pool(pl, name);
 
-	for (const struct builtins *ptr = g_predicates_other; ptr->name; ptr++) {
-		sl_app(pl->funtab, ptr->name, ptr);
+	if (val_off == ERR_IDX) {
+		*found = false;
+		return NULL;
 	}
 
-	for (const struct builtins *ptr = g_contrib_funcs; ptr->name; ptr++) {
-		sl_app(pl->funtab, ptr->name, ptr);
-	}
+	return find_builtin(pl, val_off, arity, found);
 }
 
-char *format_property(char **bufptr, size_t *lenptr, char *dst, const char *name, unsigned arity, const char *type)
+void *get_builtin_term(prolog *pl, const cell *c, unsigned arity, bool *found)
 {
-	char *tmpbuf = *bufptr;
-	size_t buflen = *lenptr;
-
-	if ((buflen-(dst-tmpbuf)) < 1024) {
-		size_t offset = dst - tmpbuf;
-		*bufptr = tmpbuf = realloc(tmpbuf, *lenptr=(buflen*=2));
-		dst = tmpbuf + offset;
-	}
-
-	if (!isalpha(name[0]) && (name[0] != '_')) {
-		char namebuf[512];
-		const char *src = name;
-		char *dst2 = namebuf;
-		size_t len = sizeof(namebuf)-1;
-
-		while (*src && len-- > 1) {
-			if (*src == '\\') {
-				*dst2++ = *src;
-				len--;
-			}
+	if (!is_literal(c))
+		return get_builtin(pl, _GET_STR(pl, c), arity, found);
 
-			*dst2++ = *src++;
-		}
-
-		*dst2 = '\0';
-		dst += snprintf(dst, buflen-(dst-tmpbuf), "'$predicate_property'('%s'", namebuf);
-	} else
-		dst += snprintf(dst, buflen-(dst-tmpbuf), "'$predicate_property'(%s", name);
+	return find_builtin(pl, c->val_off, arity, found);
+}
 
+extern const struct builtins g_functions[];
+extern const struct builtins g_contrib_funcs[];
 
-	if (arity) {
-		dst += snprintf(dst, buflen-(dst-tmpbuf), "(");
+// The first definition of a name/arity wins, as it did when they
+// were appended to a skiplist in this order...
 
-		for (unsigned i = 0; i < arity; i++) {
-			if (i > 0)
-				dst += snprintf(dst, buflen-(dst-tmpbuf), ",");
+static void add_builtins(prolog *pl, const struct builtins *ptr)
+{
+	for (; ptr->name; ptr++) {
+		idx_t val_off = index_from_pool(pl, ptr->name);
+		ensure(val_off != ERR_IDX);
+		idx_t mask = pl->funtab_size - 1;
+		idx_t i = builtin_hash(val_off, ptr->arity) & mask;
 
-			dst += snprintf(dst, buflen-(dst-tmpbuf), "_");
+		for (; pl->funtab[i].ptr; i = (i + 1) & mask) {
+			if ((pl->funtab[i].val_off == val_off) && (pl->funtab[i].arity == ptr->arity))
+				break;
 		}
 
-		dst += snprintf(dst, buflen-(dst-tmpbuf), ")");
-	}
-
-	dst += snprintf(dst, buflen-(dst-tmpbuf), ", %s).\n", type);
-	return dst;
-}
+		if (pl->funtab[i].ptr)
+			continue;
 
-static char *push_property(char **bufptr, size_t *lenptr, char *dst, const struct builtins *ptr)
-{
-	dst = format_property(bufptr, lenptr, dst, ptr->name, ptr->arity, "built_in");
-	dst = format_property(bufptr, lenptr, dst, ptr->name, ptr->arity, "static");
-	dst = format_property(bufptr, lenptr, dst, ptr->name, ptr->arity, "private");
-	dst = format_property(bufptr, lenptr, dst, ptr->name, ptr->arity, "native_code");
-	return dst;
+		pl->funtab[i].ptr = ptr;
+		pl->funtab[i].val_off = val_off;
+		pl->funtab[i].arity = ptr->arity;
+	}
 }
 
-static void load_properties(module *m)
+static idx_t count_builtins(const struct builtins *ptr)
 {
-	if (m->loaded_properties)
-		return;
-
-	m->loaded_properties = true;
-	size_t buflen = 1024*8;
-	char *tmpbuf = malloc(buflen);
-	char *dst = tmpbuf;
-	*dst = '\0';
+	idx_t cnt = 0;
 
-	dst = format_property(&tmpbuf, &buflen, dst, ",", 2, "control_construct");
-	dst = format_property(&tmpbuf, &buflen, dst, ",", 2, "meta_predicate((0,0))");
-
-	dst = format_property(&tmpbuf, &buflen, dst, ";", 2, "control_construct");
-	dst = format_property(&tmpbuf, &buflen, dst, ";", 2, "meta_predicate((0;0))");
-
-	dst = format_property(&tmpbuf, &buflen, dst, "->", 2, "control_construct");
-	dst = format_property(&tmpbuf, &buflen, dst, "->", 2, "meta_predicate((0->0))");
-
-	dst = format_property(&tmpbuf, &buflen, dst, "*->", 2, "control_construct");
-	dst = format_property(&tmpbuf, &buflen, dst, "*->", 2, "meta_predicate((0*->0))");
-
-	dst = format_property(&tmpbuf, &buflen, dst, "findall", 3, "control_construct");
-	dst = format_property(&tmpbuf, &buflen, dst, "findall", 3, "meta_predicate(findall(?,0,-))");
-
-	dst = format_property(&tmpbuf, &buflen, dst, "bagof", 3, "control_construct");
-	dst = format_property(&tmpbuf, &buflen, dst, "bagof", 3, "meta_predicate(bagof(?,0,-))");
-
-	dst = format_property(&tmpbuf, &buflen, dst, "setof", 3, "control_construct");
-	dst = format_property(&tmpbuf, &buflen, dst, "setof", 3, "meta_predicate(setof(?,0,-))");
-
-	dst = format_property(&tmpbuf, &buflen, dst, "throw", 1, "control_construct");
-	dst = format_property(&tmpbuf, &buflen, dst, "call", 1, "control_construct");
-	dst = format_property(&tmpbuf, &buflen, dst, "!", 0, "control_construct");
-	dst = format_property(&tmpbuf, &buflen, dst, "true", 0, "control_construct");
-	dst = format_property(&tmpbuf, &buflen, dst, "fail", 0, "control_construct");
-	dst = format_property(&tmpbuf, &buflen, dst, "|", 2, "meta_predicate((:|+))");
-	dst = format_property(&tmpbuf, &buflen, dst, "time", 1, "meta_predicate(time(0))");
-	dst = format_property(&tmpbuf, &buflen, dst, "setup_call_cleanup", 3, "meta_predicate(setup_call_cleanup(0,0,0))");
-	dst = format_property(&tmpbuf, &buflen, dst, "asserta", 1, "meta_predicate(asserta(:))");
-	dst = format_property(&tmpbuf, &buflen, dst, "assertz", 1, "meta_predicate(assertz(:))");
-	dst = format_property(&tmpbuf, &buflen, dst, "retract", 1, "meta_predicate(retract(:))");
-	dst = format_property(&tmpbuf, &buflen, dst, "retractall", 1, "meta_predicate(retractall(:))");
-	dst = format_property(&tmpbuf, &buflen, dst, "current_predicate", 1, "meta_predicate(current_predicate(:))");
-	dst = format_property(&tmpbuf, &buflen, dst, "predicate_property", 1, "meta_predicate(predicate_property(:,?))");
-	dst = format_property(&tmpbuf, &buflen, dst, "abolish", 1, "meta_predicate(abolish(:))");
-	dst = format_property(&tmpbuf, &buflen, dst, "clause", 2, "meta_predicate(abolish(:,?))");
-	dst = format_property(&tmpbuf, &buflen, dst, "catch", 3, "meta_predicate(catch(0,?,0))");
-	dst = format_property(&tmpbuf, &buflen, dst, "phrase", 2, "meta_predicate(phrase(2,?))");
-	dst = format_property(&tmpbuf, &buflen, dst, "phrase", 3, "meta_predicate(phrase(2,?,?))");
-
-	for (int i = 2; i <= 7; i++) {
-		char metabuf[256];
-		char *dst2 = metabuf;
-		dst2 += snprintf(dst2, sizeof(metabuf), "meta_predicate(call(%d", i-1);
-
-		for (int j = 1; j < i; j++)
-			dst2 += snprintf(dst2, sizeof(metabuf)-(dst2-metabuf), ",?");
-
-
-		snprintf(dst2, sizeof(metabuf)-(dst2-metabuf), "))");
-		dst = format_property(&tmpbuf, &buflen, dst, "call", i, metabuf);
-	}
-
-	for (int i = 2; i <= 7; i++) {
-		char metabuf[256];
-		char *dst2 = metabuf;
-		dst2 += snprintf(dst2, sizeof(metabuf), "meta_predicate(task(%d", i-1);
-
-		for (int j = 1; j < i; j++)
-			dst2 += snprintf(dst2, sizeof(metabuf)-(dst2-metabuf), ",?");
-
-
-		snprintf(dst2, sizeof(metabuf)-(dst2-metabuf), "))");
-		dst = format_property(&tmpbuf, &buflen, dst, "task", i, metabuf);
-	}
-
-	for (const struct builtins *ptr = g_predicates_iso; ptr->name; ptr++) {
-		sl_app(m->pl->funtab, ptr->name, ptr);
-		if (ptr->name[0] == '$') continue;
-		dst = push_property(&tmpbuf, &buflen, dst, ptr);
-	}
-
-	for (const struct builtins *ptr = g_functions; ptr->name; ptr++) {
-		sl_app(m->pl->funtab, ptr->name, ptr);
-		if (ptr->name[0] == '$') continue;
-		dst = push_property(&tmpbuf, &buflen, dst, ptr);
-	}
-
-	for (const struct builtins *ptr = g_predicates_other; ptr->name; ptr++) {
-		sl_app(m->pl->funtab, ptr->name, ptr);
-		if (ptr->name[0] == '$') continue;
-		dst = push_property(&tmpbuf, &buflen, dst, ptr);
-	}
-
-	for (const struct builtins *ptr = g_contrib_funcs; ptr->name; ptr++) {
-		sl_app(m->pl->funtab, ptr->name, ptr);
-		if (ptr->name[0] == '$') continue;
-		dst = push_property(&tmpbuf, &buflen, dst, ptr);
-	}
+	for (; ptr->name; ptr++)
+		cnt++;
 
-	parser *p = create_parser(m);
-	p->srcptr = tmpbuf;
-	p->consulting = true;
-	parser_tokenize(p, false, false);
-	destroy_parser(p);
-	free(tmpbuf);
+	return cnt;
 }
 
-static void load_ops(query *q)
+void load_builtins(prolog *pl)
 {
-	if (q->m->loaded_ops)
-		return;
-
-	cell tmp;
-	make_literal(&tmp, index_from_pool(q->m->pl, "$current_op"));
-	tmp.arity = 3;
-
-	if (do_abolish(q, &tmp, &tmp, false) != pl_success)
-		return;
-
-	q->m->loaded_ops = true;
-	size_t buflen = 1024*8;
-	char *tmpbuf = malloc(buflen);
-	char *dst = tmpbuf;
-	*dst = '\0';
-
-	for (const struct op_table *ptr = q->m->ops; ptr->name; ptr++) {
-		char specifier[256], name[256];
-
-		if (!ptr->specifier)
-			continue;
-
-		if (ptr->specifier == OP_FX)
-			strcpy(specifier, "fx");
-		else if (ptr->specifier == OP_FY)
-			strcpy(specifier, "fy");
-		else if (ptr->specifier == OP_YF)
-			strcpy(specifier, "yf");
-		else if (ptr->specifier == OP_XF)
-			strcpy(specifier, "xf");
-		else if (ptr->specifier == OP_YFX)
-			strcpy(specifier, "yfx");
-		else if (ptr->specifier == OP_XFY)
-			strcpy(specifier, "xfy");
-		else if (ptr->specifier == OP_XFX)
-			strcpy(specifier, "xfx");
-
-		formatted(name, sizeof(name), ptr->name, strlen(ptr->name), false);
-
-		unsigned len = snprintf(NULL, 0, "'$current_op'(%u, %s, '%s').\n",
-			ptr->priority, specifier, name);
-
-		while ((buflen-(dst-tmpbuf)) <= len) {
-			size_t offset = dst - tmpbuf;
-			tmpbuf = realloc(tmpbuf, buflen*=2);
-			dst = tmpbuf + offset;
-		}
+	idx_t cnt = count_builtins(g_predicates_iso) + count_builtins(g_functions)
+		+ count_builtins(g_predicates_other) + count_builtins(g_contrib_funcs);
 
-		dst += snprintf(dst, buflen-(dst-tmpbuf), "'$current_op'(%u, %s, '%s').\n",
-			ptr->priority, specifier, name);
-	}
-
-	for (const struct op_table *ptr = q->m->def_ops; ptr->name; ptr++) {
-		char specifier[256], name[256];
-
-		if (!ptr->specifier)
-			continue;
-
-		if (ptr->specifier == OP_FX)
-			strcpy(specifier, "fx");
-		else if (ptr->specifier == OP_FY)
-			strcpy(specifier, "fy");
-		else if (ptr->specifier == OP_YF)
-			strcpy(specifier, "yf");
-		else if (ptr->specifier == OP_XF)
-			strcpy(specifier, "xf");
-		else if (ptr->specifier == OP_YFX)
-			strcpy(specifier, "yfx");
-		else if (ptr->specifier == OP_XFY)
-			strcpy(specifier, "xfy");
-		else if (ptr->specifier == OP_XFX)
-			strcpy(specifier, "xfx");
-
-		formatted(name, sizeof(name), ptr->name, strlen(ptr->name), false);
-
-		unsigned len = snprintf(NULL, 0, "'$current_op'(%u, %s, '%s').\n",
-			ptr->priority, specifier, name);
-
-		while ((buflen-(dst-tmpbuf)) <= len) {
-			size_t offset = dst - tmpbuf;
-			tmpbuf = realloc(tmpbuf, buflen*=2);
-			dst = tmpbuf + offset;
-		}
-
-		dst += snprintf(dst, buflen-(dst-tmpbuf), "'$current_op'(%u, %s, '%s').\n",
-			ptr->priority, specifier, name);
-	}
+	pl->funtab_size = 64;
 
-	//printf("%s", tmpbuf);
+	while (pl->funtab_size < (cnt * 2))
+		pl->funtab_size *= 2;
 
-	parser *p = create_parser(q->m);
-	p->srcptr = tmpbuf;
-	p->consulting = true;
-	parser_tokenize(p, false, false);
-	destroy_parser(p);
-	free(tmpbuf);
+	pl->funtab = calloc(pl->funtab_size, sizeof(builtin_slot));
+	ensure(pl->funtab);
+	add_builtins(pl, g_predicates_iso);
+	add_builtins(pl, g_functions);
+	add_builtins(pl, g_predicates_other);
+	add_builtins(pl, g_contrib_funcs);
 }
+
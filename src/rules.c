@@ -7,14 +7,14 @@ make_rule(m,
 
 make_rule(m, "predicate_property(P, A) :- "						\
 	"'$mustbe_callable'(P), "									\
-	"'$load_properties', "										\
 	"(var(A) -> true ; "										\
-	" (memberchk(A, [built_in,control_construct,discontiguous,private,static,dynamic,persist,multifile,meta_predicate(_)]) -> "							\
+	" (memberchk(A, [built_in,control_construct,discontiguous,private,public,static,dynamic,persist,multifile,tabled,native_code,meta_predicate(_)]) -> "							\
 		"true ; "												\
 		"throw(error(domain_error(predicate_property,A),P)) "	\
 		")"														\
 	"), "														\
-	"'$predicate_property'(P, A).");
+	"'$predicate_properties'(P, L), "							\
+	"(var(A) -> member(A, L) ; memberchk(A, L)).");
 
 make_rule(m, "subsumes_term(G,S) :- "							\
 	"\\+ \\+ ( "												\
@@ -43,6 +43,30 @@ make_rule(m,
 
 make_rule(m, "forall(Cond,Action) :- \\+ (Cond, \\+ Action).");
 
+// tabling...
+
+make_rule(m, "'$tbl_call'(G, Impl) :- "							\
+	"'$tbl_variant'(G, T, S), "									\
+	"(S == incomplete -> '$tbl_eval'(T, G, Impl) ; true), "		\
+	"'$tbl_answers'(T, 0, G).");
+
+make_rule(m, "'$tbl_eval'(T, G, Impl) :- "						\
+	"'$tbl_push'(T), "											\
+	"catch('$tbl_fixpoint'(T, G, Impl), E, "					\
+	" ('$tbl_abandon'(T), throw(E))), "							\
+	"'$tbl_pop'(T).");
+
+make_rule(m, "'$tbl_fixpoint'(T, G, Impl) :- "					\
+	"'$tbl_changes'(N0, C0), "									\
+	"(call(Impl), '$tbl_add_answer'(T, G), fail ; true), "		\
+	"'$tbl_changes'(N, C), "									\
+	"((N == N0 ; C == C0) -> true ; '$tbl_fixpoint'(T, G, Impl)).");
+
+make_rule(m, "'$tbl_answers'(T, I, G) :- "						\
+	"'$tbl_answer'(T, I, A, More), "								\
+	"(More == false -> G = A ; "									\
+	" (G = A ; I2 is I + 1, '$tbl_answers'(T, I2, G))).");
+
 make_rule(m, "chars_base64(Plain,Base64,_) :- base64(Plain,Base64).");
 make_rule(m, "chars_urlenc(Plain,Url,_) :- urlenc(Plain,Url).");
 
@@ -61,111 +85,90 @@ make_rule(m, "merge(=, H1, _, T1, T2, [H1|R]) :- "				\
 make_rule(m, "merge(<, H1, H2, T1, T2, [H1|R]) :- "				\
 	"merge(T1, [H2|T2], R).");
 
-// sort...
+// Fallback for sort/2, msort/2, keysort/2 and sort/4 on lists with
+// too many unbound elements to localize...
+
+make_rule(m, "'$sort'(K, O, L, R) :- "							\
+	"length(L, N), "											\
+	"'$sort'(N, K, O, L, _, R1), !, "							\
+	"R = R1.");
 
-make_rule(m, "sort(L, R) :- "									\
+make_rule(m, "'$sort'(0, _, _, L, L, []) :- !.");
+make_rule(m, "'$sort'(1, _, _, [X|L], L, [X]) :- !.");
+make_rule(m, "'$sort'(N, K, O, L1, L3, R) :- "					\
+	"N1 is N // 2, "											\
+	"N2 is N - N1, "											\
+	"'$sort'(N1, K, O, L1, L2, R1), "							\
+	"'$sort'(N2, K, O, L2, L3, R2), "							\
+	"'$sort_merge'(K, O, R1, R2, R).");
+
+make_rule(m, "'$sort_merge'(_, _, [], R, R) :- !.");
+make_rule(m, "'$sort_merge'(_, _, R, [], R) :- !.");
+make_rule(m, "'$sort_merge'(K, O, [H1|T1], [H2|T2], Result) :- "	\
+	"'$sort_key'(K, H1, K1), "									\
+	"'$sort_key'(K, H2, K2), "									\
+	"compare(D, K1, K2), "										\
+	"'$sort_order'(O, D, Delta), !, "							\
+	"'$sort_merge'(Delta, K, O, H1, H2, T1, T2, Result).");
+
+make_rule(m, "'$sort_merge'(<, K, O, H1, H2, T1, T2, [H1|R]) :- "	\
+	"'$sort_merge'(K, O, T1, [H2|T2], R).");
+make_rule(m, "'$sort_merge'(=, K, O, H1, H2, T1, T2, [H1|R]) :- "	\
+	"'$sort_merge'(K, O, T1, [H2|T2], R).");
+make_rule(m, "'$sort_merge'(==, K, O, H1, _, T1, T2, R) :- "		\
+	"'$sort_merge'(K, O, [H1|T1], T2, R).");
+make_rule(m, "'$sort_merge'(>, K, O, H1, H2, T1, T2, [H2|R]) :- "	\
+	"'$sort_merge'(K, O, [H1|T1], T2, R).");
+
+make_rule(m, "'$sort_key'(0, X, X) :- !.");
+make_rule(m, "'$sort_key'(K, X, Y) :- arg(K, X, Y).");
+
+make_rule(m, "'$sort_order'(@<, =, ==) :- !.");
+make_rule(m, "'$sort_order'(@>, =, ==) :- !.");
+make_rule(m, "'$sort_order'(@>, <, >) :- !.");
+make_rule(m, "'$sort_order'(@>, >, <) :- !.");
+make_rule(m, "'$sort_order'(@>=, <, >) :- !.");
+make_rule(m, "'$sort_order'(@>=, >, <) :- !.");
+make_rule(m, "'$sort_order'(_, D, D).");
+
+// predsort...
+
+make_rule(m, "predsort(P, L, R) :- "							\
 	"'$mustbe_instantiated'(L, R), "							\
 	"'$mustbe_list'(L), "										\
 	"'$mustbe_list_or_var'(R), "								\
-	"length(L,N), "												\
-	"sort(N, L, _, R).");
+	"length(L, N), "											\
+	"'$predsort'(P, N, L, _, R1), !, "							\
+	"R = R1.");
 
-make_rule(m, "sort(2, [X1, X2|L], L, R) :- !, "					\
-	"compare(Delta, X1, X2), "									\
+make_rule(m, "'$predsort'(P, 2, [X1, X2|L], L, R) :- !, "		\
+	"call(P, Delta, X1, X2), "									\
 	"'$sort2'(Delta, X1, X2, R).");
-make_rule(m, "sort(1, [X|L], L, [X]) :- !.");
-make_rule(m, "sort(0, L, L, []) :- !.");
-make_rule(m, "sort(N, L1, L3, R) :- "							\
+make_rule(m, "'$predsort'(_, 1, [X|L], L, [X]) :- !.");
+make_rule(m, "'$predsort'(_, 0, L, L, []) :- !.");
+make_rule(m, "'$predsort'(P, N, L1, L3, R) :- "					\
 	"N1 is N // 2, "											\
 	"plus(N1, N2, N), "											\
-	"sort(N1, L1, L2, R1), "									\
-	"sort(N2, L2, L3, R2), "									\
-	"merge(R1, R2, R).");
+	"'$predsort'(P, N1, L1, L2, R1), "							\
+	"'$predsort'(P, N2, L2, L3, R2), "							\
+	"'$predmerge'(P, R1, R2, R).");
 
 make_rule(m, "'$sort2'(<, X1, X2, [X1, X2]).");
 make_rule(m, "'$sort2'(=, X1, _,  [X1]).");
 make_rule(m, "'$sort2'(>, X1, X2, [X2, X1]).");
 
-// mmerge...
-
-make_rule(m, "mmerge([], R, R) :- !.");
-make_rule(m, "mmerge(R, [], R) :- !.");
-make_rule(m, "mmerge([H1|T1], [H2|T2], Result) :- "				\
-	"compare(Delta, H1, H2), !, "								\
-	"mmerge(Delta, H1, H2, T1, T2, Result).");
-
-make_rule(m, "mmerge(>, H1, H2, T1, T2, [H2|R]) :- "			\
-	"mmerge([H1|T1], T2, R).");
-make_rule(m, "mmerge(=, H1, H2, T1, T2, [H1|R]) :- "			\
-	"mmerge(T1, [H2|T2], R).");
-make_rule(m, "mmerge(<, H1, H2, T1, T2, [H1|R]) :- "			\
-	"mmerge(T1, [H2|T2], R).");
-
-// msort...
-
-make_rule(m, "msort(L, R) :- "									\
-	"'$mustbe_instantiated'(L, R), "							\
-	"'$mustbe_list'(L), "										\
-	"'$mustbe_list_or_var'(R), "								\
-	"length(L,N), "												\
-	"msort(N, L, _, R).");
-
-make_rule(m, "msort(2, [X1, X2|L], L, R) :- !, "				\
-	"compare(Delta, X1, X2), "									\
-	"'$msort2'(Delta, X1, X2, R).");
-make_rule(m, "msort(1, [X|L], L, [X]) :- !.");
-make_rule(m, "msort(0, L, L, []) :- !.");
-make_rule(m, "msort(N, L1, L3, R) :- "							\
-	"N1 is N // 2, "											\
-	"plus(N1, N2, N), "											\
-	"msort(N1, L1, L2, R1), "									\
-	"msort(N2, L2, L3, R2), "									\
-	"mmerge(R1, R2, R).");
-
-make_rule(m, "'$msort2'(<, X1, X2, [X1, X2]).");
-make_rule(m, "'$msort2'(=, X1, X2, [X1, X2]).");
-make_rule(m, "'$msort2'(>, X1, X2, [X2, X1]).");
-
-// keymerge...
-
-make_rule(m, "keymerge([], R, R) :- !.");
-make_rule(m, "keymerge(R, [], R) :- !.");
-make_rule(m, "keymerge([H1|T1], [H2|T2], Result) :- "			\
-	"keycompare(Delta, H1, H2), !, "							\
-	"keymerge(Delta, H1, H2, T1, T2, Result).");
-
-make_rule(m, "keymerge(>, H1, H2, T1, T2, [H2|R]) :- "			\
-	"keymerge([H1|T1], T2, R).");
-make_rule(m, "keymerge(=, H1, H2, T1, T2, [H1|R]) :- "			\
-	"keymerge(T1, [H2|T2], R).");
-make_rule(m, "keymerge(<, H1, H2, T1, T2, [H1|R]) :- "			\
-	"keymerge(T1, [H2|T2], R).");
+make_rule(m, "'$predmerge'(_, [], R, R) :- !.");
+make_rule(m, "'$predmerge'(_, R, [], R) :- !.");
+make_rule(m, "'$predmerge'(P, [H1|T1], [H2|T2], Result) :- "	\
+	"call(P, Delta, H1, H2), !, "								\
+	"'$predmerge'(Delta, P, H1, H2, T1, T2, Result).");
 
-// keysort...
-
-make_rule(m, "keycompare(Delta, (K1-_), (K2-_)) :- "			\
-	"(K1 @< K2 -> Delta = '<' ; "								\
-	"(K1 @> K2 -> Delta = '>' ; "								\
-	"Delta = '=')).");
-
-make_rule(m, "keysort(L, R) :- "								\
-	"'$mustbe_instantiated'(L, R), "							\
-	"'$mustbe_pairlist'(L), "									\
-	"'$mustbe_pairlist_or_var'(R), "							\
-	"length(L,N), "												\
-	"keysort(N, L, _, R).");
-
-make_rule(m, "keysort(2, [X1, X2|L], L, R) :- !, "				\
-	"keycompare(Delta, X1, X2), "								\
-	"'$msort2'(Delta, X1, X2, R).");
-make_rule(m, "keysort(1, [X|L], L, [X]) :- !.");
-make_rule(m, "keysort(0, L, L, []) :- !.");
-make_rule(m, "keysort(N, L1, L3, R) :- "						\
-	"N1 is N // 2, "											\
-	"plus(N1, N2, N), "											\
-	"keysort(N1, L1, L2, R1), "									\
-	"keysort(N2, L2, L3, R2), "									\
-	"keymerge(R1, R2, R).");
+make_rule(m, "'$predmerge'(<, P, H1, H2, T1, T2, [H1|R]) :- "	\
+	"'$predmerge'(P, T1, [H2|T2], R).");
+make_rule(m, "'$predmerge'(=, P, H1, _, T1, T2, [H1|R]) :- "	\
+	"'$predmerge'(P, T1, T2, R).");
+make_rule(m, "'$predmerge'(>, P, H1, H2, T1, T2, [H2|R]) :- "	\
+	"'$predmerge'(P, [H1|T1], T2, R).");
 
 make_rule(m, "findall(T, G, B) :- "								\
 	"copy_term('$findall'(T,G,B),TMP_G),"						\
@@ -191,6 +194,15 @@ make_rule(m, "setof(T,G,B) :- "									\
 	"'$bagof'(T,G,TMP_B)=TMP_G,"								\
 	"sort(TMP_B,B).");
 
+make_rule(m, "aggregate_all(A, G, B) :- "						\
+	"nonvar(A), A = bag(T), !, findall(T, G, B).");
+make_rule(m, "aggregate_all(A, G, S) :- "						\
+	"nonvar(A), A = set(T), !, findall(T, G, B), sort(B, S).");
+make_rule(m, "aggregate_all(A, G, R) :- "							\
+	"copy_term('$aggregate_all'(A,G,R),TMP_G),"					\
+	"'$call'(TMP_G),"											\
+	"'$aggregate_all'(A,G,R)=TMP_G.");
+
 make_rule(m, "catch(G,E,C) :- "									\
 	"copy_term('$catch'(G,E,C),TMP_G),"							\
 	"'$call'(TMP_G),"											\
@@ -370,7 +382,7 @@ make_rule(m, "server(H,S) :- server(H,S,[]).");
 
 make_rule(m, 																	\
 	"current_op(A,B,C) :- var(A), var(B), var(C), "								\
-	"	!, '$load_ops', '$current_op'(A, B, C)."								\
+	"	!, '$current_op'(A, B, C)."								\
 	"current_op(_,_,C) :- nonvar(C), \\+ atom(C), "								\
 	"	!, throw(error(type_error(atom,C),current_op/3))."						\
 	"current_op(_,B,_) :- nonvar(B), \\+ atom(B), "								\
@@ -388,4 +400,4 @@ make_rule(m, 																	\
 	"	\\+ (A =< 1200), "														\
 	"	!, throw(error(domain_error(operator_priority,A),current_op/3))."		\
 	"current_op(A,B,C) :- "														\
-	"	!, '$load_ops', '$current_op'(A, B, C).");
+	"	!, '$current_op'(A, B, C).");
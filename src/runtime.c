@@ -88,7 +88,7 @@ static USE_RESULT pl_status check_frame(query *q)
 	return pl_success;
 }
 
-static USE_RESULT pl_status check_slot(query *q, unsigned cnt)
+USE_RESULT pl_status check_slot(query *q, unsigned cnt)
 {
 	idx_t nbr = q->st.sp + cnt + MAX_ARITY;
 
@@ -115,16 +115,6 @@ static USE_RESULT pl_status check_slot(query *q, unsigned cnt)
 // Note: when in commit there is a provisional choice point
 // that we should skip over, hence the '2' ...
 
-static bool any_choices(query *q, frame *g, bool in_commit)
-{
-	if (q->cp < (in_commit ? 2 : 1))
-		return false;
-
-	idx_t curr_choice = q->cp - (in_commit ? 2 : 1);
-	const choice *ch = GET_CHOICE(curr_choice);
-	return ch->cgen >= g->cgen ? true : false;
-}
-
 static void trace_call(query *q, cell *c, box_t box)
 {
 	if (!c || !c->fn || is_empty(c))
@@ -172,11 +162,22 @@ static void unwind_trail(query *q, const choice *ch)
 	while (q->st.tp > ch->st.tp) {
 		const trail *tr = q->trails + --q->st.tp;
 
+		if (tr->ctx == ERR_IDX) {
+			undo_trailed(q, q->st.tp);
+			continue;
+		}
+
 		if (ch->pins) {
 			if (ch->pins & (1 << tr->var_nbr))
 				continue;
 		}
 
+		// Frames newer than the choice are discarded anyway, and
+		// may since have been trimmed and their index reused...
+
+		if (tr->ctx >= ch->st.fp)
+			continue;
+
 		const frame *g = GET_FRAME(tr->ctx);
 		slot *e = GET_SLOT(g, tr->var_nbr);
 		DECR_REF(&e->c);
@@ -197,6 +198,7 @@ void try_me(const query *q, unsigned nbr_vars)
 	g->nbr_slots = nbr_vars;
 	g->nbr_vars = nbr_vars;
 	g->ctx = q->st.sp;
+	g->is_referenced = false;
 	slot *e = GET_SLOT(g, 0);
 
 	for (unsigned i = 0; i < nbr_vars; i++, e++) {
@@ -209,7 +211,7 @@ void try_me(const query *q, unsigned nbr_vars)
 static void trim_heap(query *q, const choice *ch)
 {
 	for (arena *a = q->arenas; a;) {
-		if (a->nbr <= ch->st.anbr)
+		if (a->nbr < ch->st.anbr)
 			break;
 
 		for (idx_t i = 0; i < a->hp; i++) {
@@ -256,7 +258,6 @@ bool retry_choice(query *q)
 		return retry_choice(q);
 
 	trim_heap(q, ch);
-	sl_done(q->st.iter);
 	q->st = ch->st;
 
 	frame *g = GET_CURR_FRAME();
@@ -302,72 +303,115 @@ static void trim_trail(query *q)
 	}
 }
 
+// The callee's frame has been filled in by head unification, move
+// its slots down over the current frame and take it over...
+
 static void reuse_frame(query *q, unsigned nbr_vars)
 {
 	frame *g = GET_CURR_FRAME();
-	g->nbr_slots = nbr_vars;
-	g->nbr_vars = nbr_vars;
-	g->overflow = 0;
+
+	for (unsigned i = 0; i < g->nbr_vars; i++) {
+		slot *e = GET_SLOT(g, i);
+		DECR_REF(&e->c);
+		e->c.val_type = TYPE_EMPTY;
+		e->c.attrs = NULL;
+	}
 
 	const frame *new_g = GET_FRAME(q->st.fp);
-	const choice *ch = GET_CURR_CHOICE();
-	q->st.sp = ch->st.sp;
+	slot *from = GET_SLOT(new_g, 0);
+	slot *to = q->slots + g->ctx;
+	memmove(to, from, sizeof(slot)*nbr_vars);
 
-	// See if we can reclaim the slots as well... what about trails?
+	for (unsigned i = 0; i < nbr_vars; i++) {
+		slot *e = to + i;
 
-	if (!q->no_tco && q->m->pl->opt) {
-		for (unsigned i = 0; i < nbr_vars; i++) {
-			slot *e = GET_SLOT(g, i);
-			DECR_REF(&e->c);
-			e->c.val_type = TYPE_EMPTY;
-			e->c.attrs = NULL;
-		}
+		if (e->ctx == q->st.fp)
+			e->ctx = q->st.curr_frame;
+	}
 
-		const slot *from = GET_SLOT(new_g, 0);
-		slot *to = GET_SLOT(g, 0);
-		memmove(to, from, sizeof(slot)*nbr_vars);
-		q->st.sp = g->ctx + nbr_vars;
-	} else {
-		g->ctx = new_g->ctx;
+	// Ownership of the moved slots passed to the current frame...
+
+	for (idx_t i = MAX(g->ctx+nbr_vars, new_g->ctx); i < new_g->ctx+nbr_vars; i++) {
+		slot *e = q->slots + i;
+		e->c.val_type = TYPE_EMPTY;
+		e->c.attrs = NULL;
 	}
 
+	g->nbr_slots = nbr_vars;
+	g->nbr_vars = nbr_vars;
+	g->overflow = 0;
+	g->cgen = ++q->st.cgen;
+	q->st.sp = g->ctx + nbr_vars;
 	q->tot_tcos++;
 }
 
-static bool check_slots(const query *q, frame *g, term *t)
+// The callee can take over the current frame if that is the newest,
+// no choice point was made since it was created, nothing older refers
+// into it and none of the callee's head bindings point back into it.
+// Any provisional choice point made for the match is skipped over...
+
+static bool check_slots(const query *q, const frame *g, const term *t, bool provisional)
 {
-	if (g->nbr_vars != t->nbr_vars)
+	if (q->st.curr_frame != (q->st.fp-1))
 		return false;
 
-	for (unsigned i = 0; i < g->nbr_vars; i++) {
-		const slot *e = GET_SLOT(g, i);
+	if (g->is_referenced)
+		return false;
+
+	if (q->cp > provisional) {
+		const choice *ch = GET_CHOICE(q->cp-1-provisional);
 
-		if (is_indirect(&e->c))
+		if (ch->st.fp > q->st.curr_frame)
 			return false;
+	}
 
-		if (is_string(&e->c))
+	const frame *new_g = GET_FRAME(q->st.fp);
+
+	if (new_g->is_referenced)
+		return false;
+
+	for (unsigned i = 0; i < t->nbr_vars; i++) {
+		const slot *e = GET_SLOT(new_g, i);
+
+		if (is_empty(&e->c) && e->c.attrs)
+			return false;
+
+		if ((is_variable(&e->c) || is_indirect(&e->c))
+			&& (e->ctx == q->st.curr_frame))
 			return false;
 	}
 
 	return true;
 }
 
-static void commit_me(query *q, term *t)
+// Does anything follow this goal before the end of the body?
+
+static bool is_last_call(const cell *c)
+{
+	c += c->nbr_cells;
+
+	while (c) {
+		if (is_end(c))
+			c = c->val_ptr;
+		else if (is_noop(c))
+			c++;
+		else
+			return false;
+	}
+
+	return true;
+}
+
+static void commit_me(query *q, term *t, bool last_match, bool provisional)
 {
 	frame *g = GET_CURR_FRAME();
 	g->m = q->m;
 	q->m = q->st.curr_clause->m;
-	q->st.iter = NULL;
-	bool last_match = !q->st.curr_clause->next || t->first_cut;
-	bool recursive = is_tail_recursive(q->st.curr_cell);
-	bool tco = !q->no_tco && recursive && !any_choices(q, g, true) && check_slots(q, g, t);
+	last_match = last_match || t->first_cut;
+	bool tco = last_match && q->m->pl->opt && is_last_call(q->st.curr_cell)
+		&& check_slots(q, g, t, provisional);
 	choice *ch = GET_CURR_CHOICE();
 
-#if 0
-	printf("*** tco=%d, q->no_tco=%d, last_match=%d, rec=%d, any_choices=%d, check_slots=%d\n",
-		tco, q->no_tco, last_match, recursive, any_choices(q, g, true), check_slots(q, g, t));
-#endif
-
 #if 0
 	if (tco && !last_match) {
 		printf("*** here1\n");
@@ -375,17 +419,23 @@ static void commit_me(query *q, term *t)
 	}
 #endif
 
-	if (tco && last_match && q->m->pl->opt)
+	if (tco) {
 		reuse_frame(q, t->nbr_vars);
-	else
+		g->m = q->m;
+	} else
 		g = make_frame(q, t->nbr_vars);
 
+	g->r = q->st.curr_clause;
+
 	if (last_match || t->cut_only) {
-		sl_done(ch->st.iter);
-		drop_choice(q);
+		if (provisional)
+			drop_choice(q);
+
 		trim_trail(q);
 	} else {
 		ch->st.curr_clause = q->st.curr_clause;
+		ch->st.ref = q->st.ref;
+		ch->st.ref2 = q->st.ref2;
 		ch->cgen = g->cgen;
 	}
 
@@ -393,7 +443,7 @@ static void commit_me(query *q, term *t)
 	//memset(q->nv_mask, 0, MAX_ARITY);
 }
 
-void stash_me(query *q, term *t, bool last_match)
+void stash_me(query *q, clause *r, bool last_match)
 {
 	idx_t cgen = q->st.cgen;
 
@@ -402,13 +452,24 @@ void stash_me(query *q, term *t, bool last_match)
 	else {
 		choice *ch = GET_CURR_CHOICE();
 		ch->st.curr_clause2 = q->st.curr_clause2;
+		ch->st.ref = q->st.ref;
+		ch->st.ref2 = q->st.ref2;
 		cgen = ++q->st.cgen;
 		ch->cgen = cgen;
 	}
 
-	unsigned nbr_vars = t->nbr_vars;
-	idx_t new_frame = q->st.fp++;
-	frame *g = GET_FRAME(new_frame);
+	// The clause's frame only has to be kept if something older was
+	// bound into it, otherwise it is left for the next call to reuse
+	// and the caller stays the newest frame...
+
+	frame *g = GET_FRAME(q->st.fp);
+
+	if (!g->is_referenced)
+		return;
+
+	unsigned nbr_vars = r->t.nbr_vars;
+	q->st.fp++;
+	g->r = r;
 	g->prev_frame = q->st.curr_frame;
 	g->prev_cell = NULL;
 	g->cgen = cgen;
@@ -487,7 +548,6 @@ void cut_me(query *q, bool local_cut, bool soft_cut)
 		if (ch->cgen < g->cgen)
 			break;
 
-		sl_done(ch->st.iter);
 		q->cp--;
 
 		if (ch->chk_is_det) {
@@ -547,6 +607,48 @@ static void follow_me(query *q)
 	}
 }
 
+// A frame can be dropped on exit if it is the newest, no choice
+// point was made since it was created and nothing older has been
+// bound to a term living in it...
+
+static bool can_trim_frame(const query *q, const frame *g)
+{
+	if (q->st.curr_frame != (q->st.fp-1))
+		return false;
+
+	if (g->is_referenced)
+		return false;
+
+	if (q->cp) {
+		const choice *ch = GET_CURR_CHOICE();
+
+		if (ch->st.fp > q->st.curr_frame)
+			return false;
+	}
+
+	return true;
+}
+
+static void trim_frame(query *q, frame *g)
+{
+	for (unsigned i = 0; i < g->nbr_vars; i++) {
+		slot *e = GET_SLOT(g, i);
+		DECR_REF(&e->c);
+		e->c.val_type = TYPE_EMPTY;
+		e->c.attrs = NULL;
+	}
+
+	idx_t nbr_overflow = g->nbr_vars - g->nbr_slots;
+
+	if (g->overflow && ((g->overflow + nbr_overflow) == q->st.sp))
+		q->st.sp = g->overflow;
+
+	if ((g->ctx + g->nbr_slots) == q->st.sp)
+		q->st.sp = g->ctx;
+
+	q->st.fp--;
+}
+
 // Reached end of body, return to previous frame
 
 static bool resume_frame(query *q)
@@ -556,14 +658,8 @@ static bool resume_frame(query *q)
 
 	frame *g = GET_CURR_FRAME();
 
-#if 0
-	term *t = &q->st.curr_clause->t;
-
-	if ((q->st.curr_frame == (q->st.fp-1))
-		&& q->m->pl->opt && t->tail_rec
-		&& !any_choices(q, g, false) && check_slots(q, g, t))
-		q->st.fp--;
-#endif
+	if (q->m->pl->opt && can_trim_frame(q, g))
+		trim_frame(q, g);
 
 	q->st.curr_cell = g->prev_cell;
 	q->st.curr_frame = g->prev_frame;
@@ -618,11 +714,21 @@ unsigned create_vars(query *q, unsigned cnt)
 	return var_nbr;
 }
 
+// Binding an older variable to a term (or variable) in a newer
+// frame means that frame must outlive its own exit...
+
+static void mark_referenced(query *q, idx_t c_ctx, const cell *v, idx_t v_ctx)
+{
+	if ((v_ctx > c_ctx) && (is_structure(v) || is_variable(v)))
+		GET_FRAME(v_ctx)->is_referenced = true;
+}
+
 void set_var(query *q, const cell *c, idx_t c_ctx, cell *v, idx_t v_ctx)
 {
 	const frame *g = GET_FRAME(c_ctx);
 	slot *e = GET_SLOT(g, c->var_nbr);
 	cell *frozen = NULL;
+	mark_referenced(q, c_ctx, v, v_ctx);
 
 	if (is_empty(&e->c) && e->c.attrs && !is_list_or_nil(e->c.attrs))
 		frozen = e->c.attrs;
@@ -652,6 +758,19 @@ void set_var(query *q, const cell *c, idx_t c_ctx, cell *v, idx_t v_ctx)
 	tr->ctx = c_ctx;
 }
 
+// Backtrackable updates outside the frames (global variables, hash
+// tables) are undone when unwinding reaches a trail entry with no
+// frame...
+
+pl_status trail_undo(query *q)
+{
+	may_error(check_trail(q));
+	trail *tr = q->trails + q->st.tp++;
+	tr->ctx = ERR_IDX;
+	tr->var_nbr = 0;
+	return pl_success;
+}
+
 void reset_value(query *q, const cell *c, idx_t c_ctx, cell *v, idx_t v_ctx)
 {
 	const frame *g = GET_FRAME(c_ctx);
@@ -664,6 +783,7 @@ void reset_value(query *q, const cell *c, idx_t c_ctx, cell *v, idx_t v_ctx)
 		e = GET_SLOT(g, c->var_nbr);
 	}
 
+	mark_referenced(q, c_ctx, v, v_ctx);
 	e->ctx = v_ctx;
 
 	if (v->arity && !is_string(v))
@@ -797,9 +917,6 @@ bool unify_internal(query *q, cell *p1, idx_t p1_ctx, cell *p2, idx_t p2_ctx, un
 		return false;
 	}
 
-	if (p1_ctx == q->st.curr_frame)
-		q->no_tco = true;
-
 	if (is_variable(p1) && is_variable(p2)) {
 		if (p2_ctx > p1_ctx)
 			set_var(q, p2, p2_ctx, p1, p1_ctx);
@@ -853,6 +970,87 @@ static bool CHECK_UPDATE_VIEW(__attribute__((unused)) query *q, clause *c)
 	return true;
 }
 
+// When keyed the candidates are the merge, in clause order, of the
+// bucket for the first argument and the unkeyed clauses...
+
+static clause *next_key(query *q, clause *r)
+{
+	if (!q->st.is_keyed)
+		return r ? r->next : NULL;
+
+	clause_ref *ref = q->st.ref, *ref2 = q->st.ref2;
+
+	if (ref && (!ref2 || (ref->seq < ref2->seq))) {
+		q->st.ref = ref->next;
+		return ref->r;
+	}
+
+	if (ref2) {
+		q->st.ref2 = ref2->next;
+		return ref2->r;
+	}
+
+	q->st.is_keyed = false;
+	return NULL;
+}
+
+bool has_next_key(const query *q, const clause *r)
+{
+	if (q->st.is_keyed)
+		return q->st.ref || q->st.ref2;
+
+	return r->next;
+}
+
+// Use the first-argument index if that argument is bound, else look
+// for a later bound argument to index on. An atomic cstring could match
+// a keyed atom so it is treated as unbound. The key is the dereferenced
+// argument of the live goal, so an indexed call allocates nothing...
+
+static db_index *select_index(query *q, predicate *h, cell *c, idx_t c_ctx, cell **key)
+{
+	if (!h->index)
+		return NULL;
+
+	cell *arg = c + 1;
+
+	for (unsigned i = 0; (i < c->arity) && (i <= MAX_JIT_ARGS); i++, arg += arg->nbr_cells) {
+		*key = deref(q, arg, c_ctx);
+
+		if (is_variable(*key) || is_cstring(*key))
+			continue;
+
+		if (!i)
+			return h->index;
+
+		db_index *idx = get_jit_index(h, i);
+
+		if (idx)
+			return idx;
+	}
+
+	return NULL;
+}
+
+// The first candidate clause for goal 'c', which also sets up the
+// iteration used by next_key...
+
+static clause *first_key(query *q, predicate *h, cell *c, idx_t c_ctx)
+{
+	cell *key;
+	db_index *idx = select_index(q, h, c, c_ctx, &key);
+
+	if (!idx) {
+		q->st.is_keyed = false;
+		return h->head;
+	}
+
+	q->st.ref = is_index_key(key) ? find_in_index(idx, key) : NULL;
+	q->st.ref2 = idx->vars;
+	q->st.is_keyed = true;
+	return next_key(q, NULL);
+}
+
 // Match HEAD :- BODY.
 
 USE_RESULT pl_status match_rule(query *q, cell *p1, idx_t p1_ctx)
@@ -876,7 +1074,7 @@ USE_RESULT pl_status match_rule(query *q, cell *p1, idx_t p1_ctx)
 		if (!h) {
 			bool found = false;
 
-			if (get_builtin(q->m->pl, GET_STR(head), head->arity, &found), found)
+			if (get_builtin_term(q->m->pl, head, head->arity, &found), found)
 				return throw_error(q, head, "permission_error", "modify,static_procedure");
 
 			q->st.curr_clause2 = NULL;
@@ -885,23 +1083,24 @@ USE_RESULT pl_status match_rule(query *q, cell *p1, idx_t p1_ctx)
 			if (!h->is_dynamic)
 				return throw_error(q, head, "permission_error", "modify,static_procedure");
 
-			q->st.curr_clause2 = h->head;
+			q->st.curr_clause2 = first_key(q, h, head, p1_ctx);
 		}
 
 		frame *g = GET_FRAME(q->st.curr_frame);
 		g->ugen = q->m->pl->ugen;
 	} else {
-		q->st.curr_clause2 = q->st.curr_clause2->next;
+		q->st.curr_clause2 = next_key(q, q->st.curr_clause2);
 	}
 
 	if (!q->st.curr_clause2)
 		return pl_failure;
 
 	may_error(make_choice(q));
+	GET_CURR_CHOICE()->is_iter = true;
 	cell *p1_body = get_logical_body(p1);
 	cell *orig_p1 = p1;
 
-	for (; q->st.curr_clause2; q->st.curr_clause2 = q->st.curr_clause2->next) {
+	for (; q->st.curr_clause2; q->st.curr_clause2 = next_key(q, q->st.curr_clause2)) {
 
 		if (!CHECK_UPDATE_VIEW(q, q->st.curr_clause2))
 			continue;
@@ -965,7 +1164,7 @@ USE_RESULT pl_status match_clause(query *q, cell *p1, idx_t p1_ctx, int is_retra
 		if (!h) {
 			bool found = false;
 
-			if (get_builtin(q->m->pl, GET_STR(p1), p1->arity, &found), found) {
+			if (get_builtin_term(q->m->pl, p1, p1->arity, &found), found) {
 				if (is_retract != DO_CLAUSE)
 					return throw_error(q, p1, "permission_error", "modify,static_procedure");
 				else
@@ -982,21 +1181,22 @@ USE_RESULT pl_status match_clause(query *q, cell *p1, idx_t p1_ctx, int is_retra
 					return throw_error(q, p1, "permission_error", "access,private_procedure");
 			}
 
-			q->st.curr_clause2 = h->head;
+			q->st.curr_clause2 = first_key(q, h, p1, p1_ctx);
 		}
 
 		frame *g = GET_FRAME(q->st.curr_frame);
 		g->ugen = q->m->pl->ugen;
 	} else {
-		q->st.curr_clause2 = q->st.curr_clause2->next;
+		q->st.curr_clause2 = next_key(q, q->st.curr_clause2);
 	}
 
 	if (!q->st.curr_clause2)
 		return pl_failure;
 
 	may_error(make_choice(q));
+	GET_CURR_CHOICE()->is_iter = true;
 
-	for (; q->st.curr_clause2; q->st.curr_clause2 = q->st.curr_clause2->next) {
+	for (; q->st.curr_clause2; q->st.curr_clause2 = next_key(q, q->st.curr_clause2)) {
 
 		if (!CHECK_UPDATE_VIEW(q, q->st.curr_clause2))
 			continue;
@@ -1034,15 +1234,92 @@ static const char *dump_key(void *p, const void *p1)
 }
 #endif
 
-static void next_key(query *q)
+// An atom, small integer or functor in the first argument of the goal
+// can't unify with a different one in the clause head, so such clauses
+// are passed over without a trial unification. This also lets a call
+// that only one clause can match run without a choice point...
+
+static bool is_clash(const cell *key, clause *r)
 {
-	if (q->st.iter) {
-		if (!sl_nextkey(q->st.iter, (void**)&q->st.curr_clause)) {
-			q->st.curr_clause = NULL;
-			q->st.iter = NULL;
-		}
-	} else if (q->st.curr_clause)
-		q->st.curr_clause = q->st.curr_clause->next;
+	if (!key)
+		return false;
+
+	const cell *arg = get_head(r->t.cells) + 1;
+
+	if (!is_index_key(arg))
+		return false;
+
+	if (arg->val_type != key->val_type)
+		return true;
+
+	if (is_literal(arg))
+		return (arg->val_off != key->val_off) || (arg->arity != key->arity);
+
+	return arg->val_num != key->val_num;
+}
+
+static clause *skip_clashes(query *q, clause *r, const cell *key)
+{
+	while (r && is_clash(key, r))
+		r = next_key(q, r);
+
+	return r;
+}
+
+static bool has_next_match(const query *q, clause *r, const cell *key)
+{
+	if (q->st.is_keyed || !key)
+		return has_next_key(q, r);
+
+	for (r = r->next; r; r = r->next) {
+		if (!is_clash(key, r))
+			return true;
+	}
+
+	return false;
+}
+
+// The key is copied out as the slots it may live in can move when
+// they are grown...
+
+static const cell *first_arg_key(query *q, cell *tmp)
+{
+	cell *c = q->st.curr_cell;
+
+	if (!c->arity)
+		return NULL;
+
+	const cell *key = deref(q, c+1, q->st.curr_frame);
+
+	if (!is_index_key(key))
+		return NULL;
+
+	*tmp = *key;
+	return tmp;
+}
+
+static USE_RESULT pl_status match_only(query *q)
+{
+	if (!CHECK_UPDATE_VIEW(q, q->st.curr_clause))
+		return pl_failure;
+
+	may_error(check_frame(q));
+	may_error(check_slot(q, GET_CURR_FRAME()->nbr_vars));
+	term *t = &q->st.curr_clause->t;
+	cell *head = get_head(t->cells);
+	try_me(q, t->nbr_vars);
+	q->tot_matches++;
+
+	if (!unify_structure(q, q->st.curr_cell, q->st.curr_frame, head, q->st.fp, 0))
+		return pl_failure;
+
+	Trace(q, q->st.curr_cell, EXIT);
+
+	if (q->error)
+		return pl_error;
+
+	commit_me(q, t, true, false);
+	return pl_success;
 }
 
 static USE_RESULT pl_status match_head(query *q)
@@ -1085,39 +1362,30 @@ static USE_RESULT pl_status match_head(query *q)
 				c->match = h;
 		}
 
-		if (h->index) {
-			cell *key = deep_clone_to_heap(q, c, q->st.curr_frame);
-			unsigned arity = key->arity;
-			bool all_vars = true;
-
-			for (cell *c = key + 1; arity--; c += c->nbr_cells) {
-				if (!is_variable(c)) {
-					all_vars = false;
-					break;
-				}
-			}
-
-			if (!all_vars) {
-				q->st.iter = sl_findkey(h->index, key);
-				next_key(q);
-			} else {
-				q->st.curr_clause = h->head;
-			}
-		} else {
-			q->st.curr_clause = h->head;
-		}
-
+		q->st.curr_clause = first_key(q, h, c, q->st.curr_frame);
 		frame *g = GET_FRAME(q->st.curr_frame);
 		g->ugen = q->m->pl->ugen;
 	} else
-		next_key(q);
+		q->st.curr_clause = next_key(q, q->st.curr_clause);
+
+	cell tmp;
+	const cell *key = first_arg_key(q, &tmp);
+	q->st.curr_clause = skip_clashes(q, q->st.curr_clause, key);
 
 	if (!q->st.curr_clause)
 		return pl_failure;
 
+	// A lone candidate leaves nothing to retry, so it is matched
+	// without a provisional choice point and failure just falls
+	// back to the previous one...
+
+	if (!has_next_match(q, q->st.curr_clause, key))
+		return match_only(q);
+
 	may_error(make_choice(q));
+	GET_CURR_CHOICE()->is_iter = true;
 
-	for (; q->st.curr_clause; next_key(q)) {
+	for (; q->st.curr_clause; q->st.curr_clause = skip_clashes(q, next_key(q, q->st.curr_clause), key)) {
 
 		if (!CHECK_UPDATE_VIEW(q, q->st.curr_clause))
 			continue;
@@ -1126,7 +1394,6 @@ static USE_RESULT pl_status match_head(query *q)
 		cell *head = get_head(t->cells);
 		try_me(q, t->nbr_vars);
 		q->tot_matches++;
-		q->no_tco = false;
 
 		if (unify_structure(q, q->st.curr_cell, q->st.curr_frame, head, q->st.fp, 0)) {
 			Trace(q, q->st.curr_cell, EXIT);
@@ -1134,7 +1401,7 @@ static USE_RESULT pl_status match_head(query *q)
 			if (q->error)
 				return pl_error;
 
-			commit_me(q, t);
+			commit_me(q, t, !has_next_match(q, q->st.curr_clause, key), true);
 			return pl_success;
 		}
 
@@ -1307,6 +1574,12 @@ pl_status run_query(query *q)
 				break;
 		}
 
+		if (q->gc_pending)
+			collect_heap(q);
+
+		if (q->purge_pending)
+			purge_dirty_list(q);
+
 		if (is_variable(q->st.curr_cell)) {
 			if (!fn_call_0(q, q->st.curr_cell))
 				continue;
@@ -1432,9 +1705,13 @@ pl_status query_execute(query *q, term *t)
 	frame *g = q->frames + q->st.curr_frame;
 	g->nbr_vars = t->nbr_vars;
 	g->nbr_slots = t->nbr_vars;
+	g->overflow = 0;
+	g->is_referenced = true;
+	g->r = NULL;
 	g->ugen = ++q->m->pl->ugen;
-	pl_status ret = run_query(q);
-	sl_done(q->st.iter);
-	return ret;
+	q->m->pl->nbr_running++;
+	pl_status ok = run_query(q);
+	q->m->pl->nbr_running--;
+	return ok;
 }
 
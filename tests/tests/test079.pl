@@ -0,0 +1,23 @@
+:- initialization(main).
+
+loop(0, S, S) :- !.
+loop(N, S0, S) :-
+	T = req(N, [a,b,c], "payload"),
+	copy_term(T, T2),
+	arg(1, T2, X),
+	S1 is S0 + X,
+	N1 is N - 1,
+	loop(N1, S1, S).
+
+main :-
+	freeze(V, (write(thawed(V)), nl)),
+	loop(1000000, 0, S),
+	write(S), nl,
+	garbage_collect,
+	findall(X-Y, (member(X, [a,b,c]), Y = f(X)), L),
+	garbage_collect,
+	write(L), nl,
+	V = 1,
+	statistics(gctime, T),
+	(number(T) -> write(ok) ; write(bad)), nl,
+	halt.
@@ -0,0 +1,24 @@
+:- initialization(main).
+:- dynamic(g/2).
+
+mk :- between(1, 60, I), assertz(g(I, a)), fail.
+mk :-
+	assertz(g(_, any)),
+	assertz(g(foo, b)),
+	assertz(g(1.0, flt)),
+	asserta(g(1, first)),
+	asserta(g(_, top)),
+	atom_codes(A, [0'b,0'a,0'r]),
+	assertz(g(A, bar)).
+
+main :-
+	mk,
+	findall(X, g(1, X), L1), write(L1), nl,
+	findall(X, g(foo, X), L2), write(L2), nl,
+	findall(X, g(1.0, X), L3), write(L3), nl,
+	atom_codes(B, [0'f,0'o,0'o]), findall(X, g(B, X), L4), write(L4), nl,
+	findall(X, g(bar, X), L5), write(L5), nl,
+	findall(X, g(f(x), X), L6), write(L6), nl,
+	retract(g(1, a)), findall(X, g(1, X), L7), write(L7), nl,
+	findall(K, g(K, _), L8), length(L8, N8), write(N8), nl,
+	halt.
@@ -0,0 +1,20 @@
+:- initialization(main).
+:- dynamic(edge/3).
+
+mk :- between(1, 100, I), J is I+1, assertz(edge(I, J, I)), fail.
+mk :- assertz(edge(_, 7, any)), asserta(edge(x, 7, first)).
+
+rev(L) :- findall(W, edge(_, 7, W), L).
+
+main :-
+	mk,
+	rev(L1), write(L1), nl,
+	rev(L2), write(L2), nl,
+	rev(L3), write(L3), nl,
+	assertz(edge(y, 7, last)),
+	asserta(edge(z, 7, top)),
+	rev(L4), write(L4), nl,
+	findall(W, edge(_, _, W), L5), length(L5, N5), write(N5), nl,
+	findall(W, edge(_, f(x), W), L6), write(L6), nl,
+	(edge(I7, 51, _) -> write(I7) ; write(no)), nl,
+	halt.
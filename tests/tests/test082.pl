@@ -0,0 +1,22 @@
+:- initialization(main).
+:- dynamic(val/2).
+
+mk :- between(1, 60, I), assertz(val(p(I), I)), fail.
+mk :-
+	assertz(val(q(_), other)),
+	assertz(val(x:y, mod)),
+	assertz(val([a], lst)),
+	asserta(val(_, any)),
+	assertz(val([], nil)),
+	assertz(val(p(1,2), p2)).
+
+main :-
+	mk,
+	findall(X, val(p(7), X), L1), write(L1), nl,
+	findall(X, val(q(7), X), L2), write(L2), nl,
+	findall(X, val(_:_, X), L3), write(L3), nl,
+	findall(X, val([_|_], X), L4), write(L4), nl,
+	findall(X, val([], X), L5), write(L5), nl,
+	findall(X, val(p(_,_), X), L6), write(L6), nl,
+	findall(X, val(p, X), L7), write(L7), nl,
+	halt.
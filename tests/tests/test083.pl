@@ -0,0 +1,54 @@
+:- initialization(main).
+
+:- table path/2.
+
+edge(1,2). edge(2,3). edge(3,1). edge(3,4).
+
+path(X,Y) :- path(X,Z), edge(Z,Y).
+path(X,Y) :- edge(X,Y).
+
+:- table fib/2.
+
+fib(0, 0).
+fib(1, 1).
+fib(N, F) :- N > 1, N1 is N-1, N2 is N-2, fib(N1, F1), fib(N2, F2), F is F1+F2.
+
+:- table a/1, b/1.
+
+a(X) :- b(X).
+a(1).
+b(X) :- a(Y), X is Y + 1, X < 5.
+b(10).
+
+:- table expr/2.
+
+expr(S0, S) :- expr(S0, [+|S1]), term(S1, S).
+expr(S0, S) :- term(S0, S).
+term([D|S], S) :- integer(D).
+
+:- table echo/2.
+
+echo(X, f(X)).
+
+:- table bad/1.
+
+bad(X) :- nonvar(X), throw(oops).
+bad(0).
+
+main :-
+	findall(Y, path(1,Y), L1), sort(L1, S1), write(S1), nl,
+	fib(90, F), write(F), nl,
+	findall(X, a(X), L2), sort(L2, S2), write(S2), nl,
+	findall(X, b(X), L3), sort(L3, S3), write(S3), nl,
+	(expr([1,+,2,+,3], []) -> write(parsed) ; write(noparse)), nl,
+	catch(bad(1), E, (write(caught(E)), nl)),
+	findall(X, bad(X), L4), write(L4), nl,
+	(predicate_property(path(_,_), tabled) -> write(tabled) ; write(untabled)), nl,
+	echo(abc, R3), atom_codes(A3, [0'a,0'b,0'c]), echo(A3, R4), write(R3/R4), nl,
+	echo("abc", R5), write(R5), nl,
+	statistics(atoms, N0),
+	(between(1, 100, I), number_codes(I, Cs), atom_codes(A, Cs), echo(A, _), fail ; true),
+	statistics(atoms, N1), (N1 - N0 < 10 -> write(no_new_atoms) ; write(N1-N0)), nl,
+	abolish_all_tables,
+	fib(30, F30), write(F30), nl,
+	halt.
@@ -0,0 +1,35 @@
+:- initialization(main).
+
+:- dynamic(f/1).
+:- dynamic(g/2).
+
+f(1).
+f(2).
+f(3).
+
+fill(N, N, []) :- !.
+fill(I, N, [R|Rs]) :- recordz(q, I, R), I1 is I+1, fill(I1, N, Rs).
+
+main :-
+	recordz(k, 10, R1), recordz(k, 20, R2), recordz(k, 30, R3),
+	(R1 \== R2, R2 \== R3 -> write(distinct) ; write(same)), nl,
+	instance(R2, V2), write(V2), nl,
+	erase(R2),
+	findall(V, recorded(k, V), L1), write(L1), nl,
+	erase(R1), erase(R3),
+	findall(V, recorded(k, V), L2), write(L2), nl,
+	clause(f(X), true, Ref), X == 2, !,
+	erase(Ref),
+	findall(Y, f(Y), L3), write(L3), nl,
+	fill(0, 1000, Rs),
+	Rs = [_,_|Rest], erase_all(Rest),
+	findall(V, recorded(q, V), L4), write(L4), nl,
+	clause(f(3), true, R4), clause(f(Z), B4, R4), write(Z-B4), nl,
+	assertz((g(A, C) :- C is A*2)), clause(g(_, _), _, R5),
+	clause(g(5, W), B5, R5), call(B5), write(W), nl,
+	(clause(f(1), _, R4) -> write(yes) ; write(no)), nl,
+	erase(R4), (clause(f(_), _, R4) -> write(yes) ; write(no)), nl,
+	halt.
+
+erase_all([]).
+erase_all([R|Rs]) :- erase(R), erase_all(Rs).
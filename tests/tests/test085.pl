@@ -0,0 +1,28 @@
+:- initialization(main).
+
+:- dynamic(f/2).
+:- dynamic(r/1).
+
+fill(N, N) :- !.
+fill(I, N) :-
+	K is I mod 10,
+	assertz(f(K, I)),
+	assertz((r(K) :- I > 0)),
+	I1 is I+1,
+	fill(I1, N).
+
+main :-
+	fill(0, 100),
+	assertz(f(_, any)),
+	findall(X, clause(f(3, X), true), L1), write(L1), nl,
+	retract(f(5, A)), write(A), nl,
+	findall(X, (retract(f(7, X)), assertz(f(7, new))), L2), write(L2), nl,
+	findall(X, f(7, X), L3), write(L3), nl,
+	retractall(f(2, _)),
+	findall(X, clause(f(2, X), true), L4), write(L4), nl,
+	retract((r(4) :- B)), write(B), nl,
+	findall(K, clause(f(K, 43), true), L5), write(L5), nl,
+	findall(K, clause(f(K, 43), true), L6), write(L6), nl,
+	findall(K, clause(f(K, 43), true), L7), write(L7), nl,
+	findall(K, clause(f(K, 43), true), L8), write(L8), nl,
+	halt.
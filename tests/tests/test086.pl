@@ -0,0 +1,39 @@
+:- initialization(main).
+
+:- dynamic(s/2).
+:- dynamic(f/1).
+:- dynamic(p/0).
+:- dynamic(cnt/1).
+
+fill(N) :- forall(between(1, N, I), assertz(s(I, data(I, [I, I])))).
+
+churn(0) :- !.
+churn(N) :- K is N mod 2999 + 2, retract(s(K, D)), assertz(s(K, D)), N1 is N-1, churn(N1).
+
+hold :- retract(s(1, D)), churn(5000), D = data(1, L), write(L), nl.
+
+iter :-
+	forall(between(1, 3000, I), assertz(f(I))),
+	findall(X, (f(X), retract(f(X))), L), length(L, Len), write(Len), nl,
+	forall(between(1, 3000, I), assertz(f(I))),
+	findall(X, (f(X), X > 2995, forall(f(Y), retract(f(Y)))), L2), write(L2), nl.
+
+p :- retract((p :- _)), churn(2000), write(self), nl.
+
+loop(M) :-
+	assertz(cnt(0)),
+	repeat,
+		retract(cnt(N)),
+		K is N mod 2999 + 2,
+		retract(s(K, D)),
+		assertz(s(K, D)),
+		N1 is N+1,
+		assertz(cnt(N1)),
+		N1 >= M,
+	!, write(N1), nl.
+
+main :-
+	fill(3000), hold, iter, p, loop(5000),
+	findall(K, s(K, _), Ks), length(Ks, NK), write(NK), nl,
+	s(2345, D), write(D), nl,
+	halt.
@@ -0,0 +1,44 @@
+:- initialization(main).
+
+fresh(N, A) :-
+	number_codes(N, Cs),
+	atom_codes(A0, Cs),
+	atom_concat(fresh_atom_, A0, A).
+
+check(N) :-
+	fresh(N, A),
+	atom_concat('f(', A, S1),
+	atom_concat(S1, ', [', S2),
+	atom_concat(S2, A, S3),
+	atom_concat(S3, ', bar])', S),
+	read_term_from_atom(S, T, []),
+	T = f(X, [Y, Z]),
+	atom(X), X == A, X == Y, Z == bar,
+	msort([X, bar], [bar, X]),
+	G =.. [X, N],
+	assertz(G), call(X, V), retract(G),
+	write(V), nl.
+
+churn(I) :-
+	fresh(I, A),
+	read_term_from_atom(A, T, []),
+	T \== A.
+
+main :-
+	current_prolog_flag(atom_gc, F0), write(F0), nl,
+	set_prolog_flag(atom_gc, true),
+	current_prolog_flag(atom_gc, F1), write(F1), nl,
+	check(1),
+	set_prolog_flag(atom_gc, false),
+	check(2),
+	set_prolog_flag(atom_gc, true),
+	statistics(atoms, N0),
+	\+ (between(1000, 2000, I), churn(I)),
+	statistics(atoms, N1),
+	N1 =:= N0,
+	write(ok), nl,
+	halt.
+
+main :-
+	write(failed), nl,
+	halt.
@@ -0,0 +1,18 @@
+:- initialization(main).
+
+try(F) :-
+	G =.. [F, X],
+	catch((call(G) -> write(X) ; write(no)), error(E, _), (functor(E, N, _), write(N))),
+	nl.
+
+main :-
+	try(later),
+	assertz(later(1)),
+	try(later),
+	abolish(later/1),
+	try(later),
+	assertz(later(2)),
+	try(later),
+	retract(later(2)),
+	try(later),
+	halt.
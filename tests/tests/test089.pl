@@ -0,0 +1,31 @@
+:- initialization(main).
+:- dynamic(d/1).
+:- meta_predicate(m(0, ?)).
+:- discontiguous(s/0).
+:- table(f/1).
+
+m(G, _) :- call(G).
+s.
+f(1).
+
+show(P) :-
+	findall(A, predicate_property(P, A), L),
+	functor(P, N, Ar),
+	write(N/Ar-L), nl.
+
+main :-
+	show(d(_)),
+	show(m(_,_)),
+	show(s),
+	show(f(_)),
+	show(findall(_,_,_)),
+	show(call(_,_,_)),
+	show(atom_length(_,_)),
+	show(nosuch),
+	assertz(newp(1)),
+	show(newp(_)),
+	(predicate_property(s, dynamic) -> write(yes) ; write(no)), nl,
+	(predicate_property(m(_,_), meta_predicate(S)) -> write(S) ; write(no)), nl,
+	(predicate_property((_->_), meta_predicate(S2)) -> write(S2) ; write(no)), nl,
+	catch(predicate_property(d(_), bogus), error(E, _), (write(E), nl)),
+	halt.
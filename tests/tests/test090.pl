@@ -0,0 +1,19 @@
+:- initialization(main).
+
+main :-
+	findall(P, (stream_property(user_output, P), P \= position(_)), L),
+	write(L), nl,
+	findall(S, stream_property(S, alias(user_error)), Ss),
+	length(Ss, NS), write(NS), nl,
+	stream_property(S2, alias(user_input)),
+	stream_property(S2, mode(M)), write(M), nl,
+	findall(A, stream_property(_, alias(A)), As), write(As), nl,
+	catch(stream_property(_, bogus), error(E, _), (write(E), nl)),
+	findall(T-N, current_op(700, T, N), Ops), length(Ops, NO), write(NO), nl,
+	(current_op(P1, T1, mod) -> write(P1-T1) ; write(none)), nl,
+	op(201, xfx, ===>),
+	(current_op(P2, T2, ===>) -> write(P2-T2) ; write(none)), nl,
+	op(0, xfx, ===>),
+	(current_op(_, _, ===>) -> write(still) ; write(gone)), nl,
+	findall(P3-T3, current_op(P3, T3, -), L3), msort(L3, S3), write(S3), nl,
+	halt.
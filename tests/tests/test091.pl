@@ -0,0 +1,22 @@
+:- initialization(main).
+
+:- op(700, xfx, ===>).
+:- op(200, fy, ===>).
+:- op(100, xf, pct).
+
+show(T) :- write_canonical(T), nl.
+
+main :-
+	read_term_from_atom('a ===> b', T1, []), show(T1),
+	read_term_from_atom('===> a', T2, []), show(T2),
+	read_term_from_atom('a pct', T3, []), show(T3),
+	findall(P-S, current_op(P, S, ===>), L1), msort(L1, S1), show(S1),
+	op(0, xfx, ===>),
+	findall(P-S, current_op(P, S, ===>), L2), show(L2),
+	op(900, xfx, ===>),
+	findall(P-S, current_op(P, S, ===>), L3), msort(L3, S3), show(S3),
+	op(0, fy, ===>),
+	( catch(read_term_from_atom('===> a', _, []), _, fail) -> show(prefix) ; show(no_prefix) ),
+	( current_op(P5, S5, -), S5 = fy -> show(P5-S5) ; show(none) ),
+	( current_op(_, _, not_an_op_xyz) -> show(yes) ; show(no) ),
+	halt.
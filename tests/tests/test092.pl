@@ -0,0 +1,37 @@
+:- initialization(main).
+
+mk(0, []) :- !.
+mk(N, [f(N,X)-X|T]) :- N1 is N-1, mk(N1, T).
+
+big(0, []) :- !.
+big(N, [N-_|T]) :- N1 is N-1, big(N1, T).
+
+rev(0, []) :- !.
+rev(N, [N|T]) :- N1 is N-1, rev(N1, T).
+
+t(G) :- catch((G -> true ; write(failed)), _, write(caught)), nl.
+r(G) :- catch((G -> write(G) ; write(failed)), error(E, _), write(E)), nl.
+
+main :-
+	t((msort([c,b,a,b], L1), write(L1))),
+	t((sort([c,b,a,b], L2), write(L2))),
+	t((keysort([2-a,1-b,2-c,1-d], L3), write(L3))),
+	t((sort(0, @>=, [1,3,2,3], L4), write(L4))),
+	t((sort(1, @<, [f(2,a),f(1,b),f(2,c)], L5), write(L5))),
+	t((sort(2, @=<, [f(2,b),f(1,a),f(3,b)], L6), write(L6))),
+	t((sort(1, @>, [f(2,a),f(1,b),f(2,c)], L7), write(L7))),
+	t((predsort(compare, [c,a,b,a], L8), write(L8))),
+	t((sort([b,a], [X|Y]), write(X/Y))),
+	mk(6, P), msort(P, S), S = [f(1,_)-V|_], V = shared,
+	t((last(P, f(1,W)-_), write(W))),
+	t((rev(20000, RL), msort(RL, SL), reverse(RL, NL), SL == NL, write(ok))),
+	t((big(40000, BL), keysort(BL, BS), BS = [1-_|_], length(BS, BN), write(BN))),
+	t((big(40000, BL2), BL2 = [_-V2|_], sort(1, @>=, BL2, [_-W2|_]), V2 == W2, write(ok))),
+	r(sort(_, _)),
+	r(sort([a|_], _)),
+	r(sort(foo, _)),
+	r(sort([a], foo)),
+	r(keysort([a], _)),
+	r(sort(0, foo, [], _)),
+	r(sort(1, @<, [a], _)),
+	halt.
@@ -0,0 +1,25 @@
+:- initialization(main).
+
+p(1,b). p(2,a). p(3,b). p(4,c). p(5,a).
+q(1,f(_)). q(2,f(_)). q(3,g). q(4,f(a)). q(5,f(_)).
+r(1,A,A). r(2,_,_). r(3,B,B).
+
+show_q(f(V), L) :- var(V), !, write(f(var)-L), nl.
+show_q(Y, L) :- write(Y-L), nl.
+
+show_r(U, W, L) :- U == W, !, write(same-L), nl.
+show_r(_, _, L) :- write(diff-L), nl.
+
+t1 :- forall(bagof(X, p(X,K), L), (write(K-L), nl)).
+t2 :- forall(setof(K-X, p(X,K), L), (write(L), nl)).
+t3 :- ( bagof(X, p(X,z), _) -> write(yes) ; write(no) ), nl.
+t4 :- ( bagof(X, K^p(X,K), L) -> write(L) ; write(no) ), nl.
+t5 :- forall(bagof(X, q(X,Y), L), show_q(Y, L)).
+t6 :- forall(bagof(X, r(X,U,W), L), show_r(U, W, L)).
+t7 :- forall(bagof(X, member(X-W, [1-V1, 2-_, 3-V1]), L),
+	(( W == V1 -> write(v1-L) ; write(other-L) ), nl)).
+t8 :- forall(setof(X, member(X, [c,a,b,a]), L), (write(L), nl)).
+t9 :- findall(C-S, setof(A, I^(between(1, 1000, I), C is I mod 7, A is I mod 3), S), R),
+	length(R, N), R = [C0-S0|_], write(N/C0/S0), nl.
+
+main :- t1, t2, t3, t4, t5, t6, t7, t8, t9, halt.
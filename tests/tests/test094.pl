@@ -0,0 +1,23 @@
+:- initialization(main).
+
+nest(0, X, X) :- !.
+nest(N, X, L) :- N1 is N-1, findall(Y, nest(N1, X, Y), L).
+
+depth(X, 0) :- atomic(X), !.
+depth([X], N) :- depth(X, N0), N is N0+1.
+
+p(A, B) :- q(A), r(B).
+q(f(_)).
+r(g(_)).
+
+main :-
+	nest(40, a, L), depth(L, D), write(D), nl,
+	findall(A-B, p(A, B), L2), L2 = [f(V1)-g(V2)],
+	(V1 == V2 -> write(shared) ; write(distinct)), nl,
+	findall(X-X-_, member(X, [_, _]), L3), L3 = [P1-P2-P3, Q1-_-_],
+	(P1 == P2, P1 \== P3, P1 \== Q1 -> write(ok) ; write(bad)), nl,
+	findall(I-J, (between(1, 3, I), findall(K, between(1, I, K), J)), L4), write(L4), nl,
+	findall(N, between(1, 100000, N), L5), length(L5, Len), last(L5, Last), write(Len/Last), nl,
+	catch(findall(f(_), between(1, 100000, _), _), error(E, _), true), functor(E, F, _), write(F), nl,
+	findall(X, fail, L6), write(L6), nl,
+	halt.
@@ -0,0 +1,26 @@
+:- initialization(main).
+p(1,a). p(3,b). p(2,c). p(3,d).
+main :-
+	aggregate_all(count, p(_,_), C), write(C), nl,
+	aggregate_all(sum(X), p(X,_), S), write(S), nl,
+	aggregate_all(sum(X*1.5), p(X,_), S2), write(S2), nl,
+	aggregate_all(max(X), p(X,_), Mx), write(Mx), nl,
+	aggregate_all(min(X), p(X,_), Mn), write(Mn), nl,
+	aggregate_all(max(X,W), p(X,W), MW), write(MW), nl,
+	aggregate_all(min(X,f(W,W)), p(X,W), MW2), write(MW2), nl,
+	aggregate_all(bag(W), p(_,W), B), write(B), nl,
+	aggregate_all(set(X), p(X,_), St), write(St), nl,
+	aggregate_all(count, fail, C0), write(C0), nl,
+	aggregate_all(sum(X), fail, S0), write(S0), nl,
+	(aggregate_all(max(X), fail, _) -> write(yes) ; write(no)), nl,
+	catch(aggregate_all(foo, true, _), E1, true), write(E1), nl,
+	catch(aggregate_all(_, true, _), E2, true), write(E2), nl,
+	catch(aggregate_all(sum(a), true, _), E3, true), write(E3), nl,
+	catch(aggregate_all(max(X), member(X, [a,b]), _), E4, true), write(E4), nl,
+	aggregate_all(max(X), member(X, [1,2.5,2]), Mx2), write(Mx2), nl,
+	aggregate_all(min(X), member(X, [3,2.5,2]), Mn2), write(Mn2), nl,
+	aggregate_all(max(X), member(X, [2.0,1,2]), Mx3), write(Mx3), nl,
+	aggregate_all(min(X,X), member(X, [3,1.5,2]), Mn3), write(Mn3), nl,
+	aggregate_all(count, (member(X, [1,2,3]), aggregate_all(count, member(_, [X,X]), 2)), C3), write(C3), nl,
+	aggregate_all(count, member(_, [a,b]), 2), write(ok), nl,
+	halt.
@@ -0,0 +1,16 @@
+:- initialization(main).
+count(N) :- between(1, N, _), nb_getval(cnt, C0), C is C0+1, nb_setval(cnt, C), fail.
+count(_).
+main :-
+	nb_setval(cnt, 0), count(1000), nb_getval(cnt, C), write(C), nl,
+	nb_setval(t, f(X, Y, X, "str", [a|_])), nb_getval(t, T1), nb_getval(t, T2), write(T1), nl,
+	T1 = f(A, _, B, _, _), (A == B -> write(shared) ; write(bad)), nl,
+	(T1 == T2 -> write(same) ; write(fresh)), nl,
+	b_setval(v, 1), (b_setval(v, 2), nb_getval(v, V1), write(V1), nl, fail ; nb_getval(v, V2), write(V2), nl),
+	(b_setval(w, 1), fail ; true), catch(b_getval(w, _), E, true), write(E), nl,
+	catch(nb_getval(nope, _), E2, true), write(E2), nl,
+	catch(nb_setval(_, 1), E3, true), write(E3), nl,
+	catch(nb_setval(1, 1), E4, true), write(E4), nl,
+	(member(Z, [a,b,c]), b_setval(m, Z), Z == c -> b_getval(m, M), write(M) ; true), nl,
+	nb_setval(x, 0), (b_setval(x, 1), fail ; nb_getval(x, XV), write(XV)), nl,
+	halt.
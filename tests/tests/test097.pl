@@ -0,0 +1,19 @@
+:- initialization(main).
+:- use_module(library(hashtable)).
+main :-
+	ht_new(H), ht_put(H, foo(1,"ab"), v(X,Y,X)), ht_get(H, foo(1,[a,b]), V), write(V), nl,
+	( ht_put(H, k, 1), ht_get(H, k, K1), write(K1), nl, fail ; true ),
+	( ht_get(H, k, _) -> write(still) ; write(gone) ), nl,
+	nb_ht_put(H, k, 2), ( ht_del(H, k), fail ; true ), ht_get(H, k, K2), write(K2), nl,
+	( ht_put(H, k, 3), ht_del(H, k), ht_put(H, k, 4), fail ; true ), ht_get(H, k, K3), write(K3), nl,
+	( between(1, 1000, I), nb_ht_put(H, I, sq(I)), fail ; true ),
+	( between(1, 1000, I), I mod 2 =:= 0, nb_ht_del(H, I), fail ; true ),
+	ht_size(H, N), write(N), nl,
+	ht_get(H, 999, S), write(S), nl,
+	( ht_get(H, 998, _) -> true ; write(no998), nl ),
+	ht_put(H, -0.0, zero), ht_get(H, 0.0, Z0), write(Z0), nl,
+	ht_new(H2), ht_put(H2, a, 1), ht_put(H2, b, f(Z)), ht_pairs(H2, Ps), msort(Ps, Ss), write(Ss), nl,
+	catch(ht_put(H2, _, 1), E1, (write(E1), nl)),
+	catch(ht_get(foo, a, _), E2, (write(E2), nl)),
+	ht_free(H2), catch(ht_get(H2, a, _), E3, (E3 = error(Err,_), write(Err), nl)),
+	halt.
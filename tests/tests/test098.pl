@@ -0,0 +1,51 @@
+:- initialization(main).
+:- use_module(library(assoc)).
+:- use_module(library(lists)).
+
+avl(t, 0).
+avl(t(_,_,B,L,R), H) :-
+	avl(L, HL), avl(R, HR),
+	compare(B, HL, HR),
+	abs(HL - HR) =< 1,
+	H is max(HL, HR) + 1.
+
+is_x(x(_)).
+unx(x(I), I).
+
+ops(0, A, A, M, M) :- !.
+ops(N, A0, A, M0, M) :-
+	K is (N * 7919 + (N // 7) * 104729) mod 50,
+	Op is ((N * 2654435761) // 65536) mod 3,
+	(	Op < 2 ->
+		put_assoc(K, A0, N, A1),
+		(select(K-_, M0, M2) -> true ; M2 = M0),
+		M1 = [K-N|M2]
+	;	del_assoc(K, A0, V, A1) -> select(K-V, M0, M1)
+	;	A1 = A0, \+ member(K-_, M0), M1 = M0
+	),
+	avl(A1, _),
+	assoc_to_list(A1, L1),
+	msort(M1, L1),
+	N1 is N - 1,
+	ops(N1, A1, A, M1, M).
+
+main :-
+	ops(600, t, A, [], M), length(M, Len), write(Len), nl,
+	assoc_range(A, 10, 20, Rg), write(Rg), nl,
+	max_assoc(A, MaxK, MaxV), write(MaxK-MaxV), nl,
+	min_assoc(A, MinK, MinV), write(MinK-MinV), nl,
+	del_min_assoc(A, K1, _, A1), del_max_assoc(A1, K2, _, A2), avl(A2, _), write(K1/K2), nl,
+	findall(X-x(X), between(1, 1000, X), Ps), reverse(Ps, Rs),
+	list_to_assoc(Rs, B), avl(B, HB), write(HB), nl,
+	get_assoc(500, B, V500), write(V500), nl,
+	( get_assoc(1001, B, _) -> write(found) ; write(missing) ), nl,
+	put_assoc(500, B, y, B1), get_assoc(500, B, Old), get_assoc(500, B1, New), write(Old/New), nl,
+	findall(K, gen_assoc(K, B, _), Ks), assoc_to_keys(B, Ks), length(Ks, NK), write(NK), nl,
+	list_to_assoc([b-"two",a-1,c-f(Z,Z)], C), assoc_to_list(C, CL), assoc_to_values(C, CV), write(CL), nl, write(CV), nl,
+	catch(list_to_assoc([a-1,b-2,a-3], _), E1, true), write(E1), nl,
+	catch(ord_list_to_assoc([b-1,a-2], _), E2, true), write(E2), nl,
+	catch(put_assoc(a, foo, 1, _), E3, true), write(E3), nl,
+	empty_assoc(E), ( max_assoc(E, _, _) -> write(nonempty) ; write(empty) ), nl,
+	assoc_range(B, 998, 2000, Top), write(Top), nl,
+	map_assoc(is_x, B), map_assoc(unx, B, BI), get_assoc(7, BI, I7), write(I7), nl,
+	halt.
@@ -0,0 +1,15 @@
+:- initialization(main).
+:- dynamic(x/1).
+
+x(0).
+
+loop(0, F) :- !, statistics(frames, F).
+loop(N, F) :- retract(x(A)), B is A+1, assertz(x(B)), N1 is N-1, loop(N1, F).
+
+main :-
+	loop(10, F0),
+	loop(100000, F1),
+	x(X), write(X), nl,
+	D is F1 - F0,
+	(D < 10 -> write(flat) ; write(D)), nl,
+	halt.